@@ -19,17 +19,29 @@
 #include <linux/moduleparam.h>
 #include <linux/kernel.h>
 #include <linux/sched.h>
+#include <linux/pid_namespace.h>
 #include <linux/errno.h>
 #include <linux/string.h>
 #include <linux/interrupt.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <linux/fb.h>
 #include <linux/delay.h>
 #include <linux/init.h>
 #include <linux/ioport.h>
 #include <linux/cpufreq.h>
 #include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/poll.h>
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/kref.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/uaccess.h>
 #include <asm/io.h>
@@ -50,6 +62,221 @@
 #define TVOUT_ENABLE			0
 #endif
 
+/*
+ * Sleep on the vsync queue from an ioctl.  The fb core holds info->lock
+ * around our ioctl, drop it so long waits don't stall other clients.
+ *
+ * The core unlocks info->lock again after we return, so it is taken back
+ * unconditionally rather than with lock_fb_info(), which would leave it
+ * released on failure; the same fbops check then tells us whether the
+ * fb went away while we slept.
+ */
+#define relock_fb_info(fbi)						\
+({									\
+	mutex_lock(&(fbi)->fb.lock);					\
+	(fbi)->fb.fbops && !(fbi)->removed ? 0 : -ENODEV;		\
+})
+
+#define wait_vsync_unlocked(fbi, condition)				\
+({									\
+	int __ret, __err;						\
+	mutex_unlock(&(fbi)->fb.lock);					\
+	__ret = wait_event_interruptible((fbi)->vsync_wait,		\
+					 (condition) || (fbi)->removed);	\
+	__err = relock_fb_info(fbi);					\
+	__err ? __err : __ret;						\
+})
+
+/* as above, giving up after timeout jiffies: 0 then, else > 0 */
+#define wait_vsync_unlocked_timeout(fbi, condition, timeout)		\
+({									\
+	long __ret;							\
+	int __err;							\
+	mutex_unlock(&(fbi)->fb.lock);					\
+	__ret = wait_event_interruptible_timeout((fbi)->vsync_wait,	\
+				(condition) || (fbi)->removed, timeout);	\
+	__err = relock_fb_info(fbi);					\
+	__err ? __err : __ret;						\
+})
+
+#ifdef LF1000FB_MMIO_TRACE
+/*
+ * MMIO trace.  Every MLC/DPC register access is recorded in a ring
+ * buffer that debugfs lf1000fb/mmio_trace dumps one access per line:
+ *
+ *	<ns> <mlc0|mlc1|dpc0|dpc1> <r16|r32|w16|w32> <offset> <value>
+ *
+ * Writing to mmio_trace empties the ring, mmio_trace_enable pauses
+ * recording.  The fb memory goes through __raw_* and is not traced.
+ * tools/mmioreplay replays a dump on top of a registers snapshot.
+ */
+#define MMIO_TRACE_LEN		4096
+#define MMIO_TRACE_SPAN		0x800	/* both banks of a controller */
+
+enum {
+	MMIO_R16,
+	MMIO_R32,
+	MMIO_W16,
+	MMIO_W32,
+};
+
+struct mmio_trace_entry {
+	s64	ns;
+	u8	ctrl;
+	u8	op;
+	u16	offset;
+	u32	value;
+};
+
+static const char *mmio_ctrl_name[] = { "mlc0", "mlc1", "dpc0", "dpc1" };
+static const char *mmio_op_name[] = { "r16", "r32", "w16", "w32" };
+
+static struct mmio_trace_entry mmio_trace_ring[MMIO_TRACE_LEN];
+static unsigned int mmio_trace_head;
+static unsigned int mmio_trace_count;
+static u32 mmio_trace_enable = 1;
+static const u8 __iomem *mmio_trace_mlc;
+static const u8 __iomem *mmio_trace_dpc;
+static DEFINE_SPINLOCK(mmio_trace_lock);
+
+static void mmio_trace(const void __iomem *addr, int op, u32 value)
+{
+	const u8 __iomem *a = addr;
+	struct mmio_trace_entry *e;
+	unsigned long flags, off;
+	int ctrl;
+
+	if(!mmio_trace_enable)
+		return;
+	if(a >= mmio_trace_mlc && a < mmio_trace_mlc + MMIO_TRACE_SPAN) {
+		off = a - mmio_trace_mlc;
+		ctrl = 0;
+	}
+	else if(a >= mmio_trace_dpc && a < mmio_trace_dpc + MMIO_TRACE_SPAN) {
+		off = a - mmio_trace_dpc;
+		ctrl = 2;
+	}
+	else
+		return;
+
+	spin_lock_irqsave(&mmio_trace_lock, flags);
+	e = &mmio_trace_ring[(mmio_trace_head + mmio_trace_count) %
+			     MMIO_TRACE_LEN];
+	if(mmio_trace_count == MMIO_TRACE_LEN)
+		mmio_trace_head = (mmio_trace_head + 1) % MMIO_TRACE_LEN;
+	else
+		mmio_trace_count++;
+	e->ns = ktime_to_ns(ktime_get());
+	e->ctrl = ctrl + (off >= 0x400);
+	e->op = op;
+	e->offset = off & 0x3FF;
+	e->value = value;
+	spin_unlock_irqrestore(&mmio_trace_lock, flags);
+}
+
+static u16 trace_ioread16(const void __iomem *addr)
+{
+	u16 v = readw(addr);
+
+	mmio_trace(addr, MMIO_R16, v);
+	return v;
+}
+
+static u32 trace_ioread32(const void __iomem *addr)
+{
+	u32 v = readl(addr);
+
+	mmio_trace(addr, MMIO_R32, v);
+	return v;
+}
+
+static void trace_iowrite16(u16 v, void __iomem *addr)
+{
+	mmio_trace(addr, MMIO_W16, v);
+	writew(v, addr);
+}
+
+static void trace_iowrite32(u32 v, void __iomem *addr)
+{
+	mmio_trace(addr, MMIO_W32, v);
+	writel(v, addr);
+}
+
+#undef ioread16
+#undef ioread32
+#undef iowrite16
+#undef iowrite32
+#define ioread16(a)		trace_ioread16(a)
+#define ioread32(a)		trace_ioread32(a)
+#define iowrite16(v, a)		trace_iowrite16(v, a)
+#define iowrite32(v, a)		trace_iowrite32(v, a)
+
+static void *mmio_trace_start(struct seq_file *m, loff_t *pos)
+{
+	spin_lock_irq(&mmio_trace_lock);
+	if(*pos >= mmio_trace_count)
+		return NULL;
+	return &mmio_trace_ring[(mmio_trace_head + *pos) % MMIO_TRACE_LEN];
+}
+
+static void *mmio_trace_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	if(++*pos >= mmio_trace_count)
+		return NULL;
+	return &mmio_trace_ring[(mmio_trace_head + *pos) % MMIO_TRACE_LEN];
+}
+
+static void mmio_trace_stop(struct seq_file *m, void *v)
+{
+	spin_unlock_irq(&mmio_trace_lock);
+}
+
+static int mmio_trace_show(struct seq_file *m, void *v)
+{
+	struct mmio_trace_entry *e = v;
+
+	seq_printf(m, "%lld %s %s 0x%03x 0x%08x\n", (long long)e->ns,
+		   mmio_ctrl_name[e->ctrl], mmio_op_name[e->op],
+		   e->offset, e->value);
+	return 0;
+}
+
+static const struct seq_operations mmio_trace_seq_ops = {
+	.start	= mmio_trace_start,
+	.next	= mmio_trace_next,
+	.stop	= mmio_trace_stop,
+	.show	= mmio_trace_show,
+};
+
+static int mmio_trace_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &mmio_trace_seq_ops);
+}
+
+static ssize_t mmio_trace_clear(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	spin_lock_irq(&mmio_trace_lock);
+	mmio_trace_head = 0;
+	mmio_trace_count = 0;
+	spin_unlock_irq(&mmio_trace_lock);
+	return count;
+}
+
+static const struct file_operations mmio_trace_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mmio_trace_open,
+	.read		= seq_read,
+	.write		= mmio_trace_clear,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+#endif /* LF1000FB_MMIO_TRACE */
+
+/* shared with tools/, after the trace wrappers so MLC writes are traced */
+#include "lf1000fb_mlc.h"
+#include "lf1000fb_convert.h"
+
 /* fixed framebuffer settings */
 static struct fb_fix_screeninfo lf1000fb_fix __initdata = {
 	.id		= "lf1000-fb",
@@ -58,8 +285,8 @@ static struct fb_fix_screeninfo lf1000fb_fix __initdata = {
 	.type		= FB_TYPE_PACKED_PIXELS,
 	.visual		= VISUALTYPE, 
 	.type_aux	= 0,
-	.xpanstep	= 0,
-	.ypanstep	= 0,
+	.xpanstep	= 1,
+	.ypanstep	= 1,
 	.ywrapstep	= 0,
 	.line_length	= X_RESOLUTION*BYTESPP, //was X_RESOLUTION for 8 bit ? X_RESOLUTION*4,
 	.accel		= FB_ACCEL_NONE,
@@ -84,6 +311,80 @@ static int __init lf1000fb_fb_setup(char *str)
 
 __setup("mlc_fb=", lf1000fb_fb_setup);
 
+/* TV out standard from lf1000fb_tv=ntsc|pal kernel cmd line arg */
+static int tvout_standard = TVOUT_NTSC;
+
+static int __init lf1000fb_tv_setup(char *str)
+{
+	if(!strcmp(str, "pal"))
+		tvout_standard = TVOUT_PAL;
+	else if(!strcmp(str, "ntsc"))
+		tvout_standard = TVOUT_NTSC;
+	else
+		printk(KERN_WARNING "lf1000fb: unknown TV standard %s\n", str);
+	return 1;
+}
+
+__setup("lf1000fb_tv=", lf1000fb_tv_setup);
+
+/*
+ * Register snapshot in debugfs lf1000fb/registers.  Together with the
+ * fb memory from mmap() this is the complete input of the MLC, so a
+ * capture can be composed offline by tools/mlccompose:
+ *
+ *	fb <address> <size>
+ *	<mlc0|mlc1|dpc0|dpc1> <offset> <value>
+ *
+ * The 2nd bank is only listed while TV out runs, its clocks are off
+ * otherwise.
+ */
+#define SNAPSHOT_MLC_END	0xC0	/* per-layer and top registers */
+#define SNAPSHOT_DPC_END	0xAA	/* sync, control and upscaler */
+
+/* plain readl()/readw(), a snapshot must not show up in the MMIO trace */
+static void snapshot_bank(struct seq_file *m, const char *name,
+			  void __iomem *mlc, void __iomem *dpc)
+{
+	int off;
+
+	for(off = 0; off < SNAPSHOT_MLC_END; off += 4)
+		seq_printf(m, "mlc%s 0x%03x 0x%08x\n", name, off,
+			   readl(mlc+off));
+	seq_printf(m, "mlc%s 0x%03x 0x%08x\n", name, MLCCLKENB,
+		   readl(mlc+MLCCLKENB));
+	for(off = 0; off < SNAPSHOT_DPC_END; off += 2)
+		seq_printf(m, "dpc%s 0x%03x 0x%04x\n", name, off,
+			   readw(dpc+off));
+	for(off = DPCCLKENB; off <= DPCCLKGEN1; off += 4)
+		seq_printf(m, "dpc%s 0x%03x 0x%08x\n", name, off,
+			   readl(dpc+off));
+}
+
+static int snapshot_show(struct seq_file *m, void *v)
+{
+	struct lf1000fb_info *fbi = m->private;
+
+	seq_printf(m, "fb 0x%08x 0x%08x\n", mlc_fb_addr, mlc_fb_size);
+	snapshot_bank(m, "0", fbi->mlc_base, fbi->dpc_base);
+	if(fbi->fb.var.reserved[0])
+		snapshot_bank(m, "1", fbi->mlc_base+0x400,
+			      fbi->dpc_base+0x400);
+	return 0;
+}
+
+static int snapshot_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, snapshot_show, inode->i_private);
+}
+
+static const struct file_operations snapshot_fops = {
+	.owner		= THIS_MODULE,
+	.open		= snapshot_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 
 
 static void schedule_palette_update(struct lf1000fb_info *fbi,
@@ -170,11 +471,94 @@ static int lf1000fb_setcolreg(unsigned regno,
 //int mlc_layer_ioctl(struct inode *inode, struct file *filp, unsigned int cmd,unsigned long arg)
 //static int pollux_ioctl(struct fb_info *info, unsigned int cmd, unsigned long arg)
 
+static int lf1000fb_tvout_request(struct lf1000fb_info *fbi, int enable);
+static int lf1000fb_set_tvout_standard(struct lf1000fb_info *fbi, int std);
+static int lf1000fb_set_field_pair(struct lf1000fb_info *fbi,
+				   struct field_pair_cmd *fc);
+static int lf1000fb_queue_flip(struct lf1000fb_info *fbi, struct flip_cmd *f,
+			       struct file **fence_file);
+static int lf1000fb_flip_done(struct lf1000fb_info *fbi,
+			      struct flip_done_cmd *d);
+static int lf1000fb_convert_rect(struct lf1000fb_info *fbi,
+				 struct convert_cmd *c);
+static int lf1000fb_user_blit(struct lf1000fb_info *fbi,
+			      struct user_blit_cmd *b);
+static int lf1000fb_wait_vsync(struct lf1000fb_info *fbi);
+static int lf1000fb_blit_list(struct lf1000fb_info *fbi,
+			      struct blit_list_cmd *bl);
+static int lf1000fb_ctl_page(struct lf1000fb_info *fbi);
+static int lf1000fb_set_rw_rect(struct lf1000fb_info *fbi, struct rect_cmd *r);
+static int lf1000fb_set_sprite(struct lf1000fb_info *fbi, struct sprite_cmd *sc);
+static int lf1000fb_move_sprite(struct lf1000fb_info *fbi,
+				struct sprite_pos_cmd *pos);
+static int lf1000fb_set_anim(struct lf1000fb_info *fbi, struct anim_cmd *ac);
+static int lf1000fb_set_compose(struct lf1000fb_info *fbi,
+				struct compose_cmd *cc);
+static int lf1000fb_get_compose(struct lf1000fb_info *fbi,
+				struct compose_cmd *cc);
+static int lf1000fb_set_scanout3d(struct lf1000fb_info *fbi,
+				  struct scanout3d_cmd *sc);
+static int lf1000fb_flip_scanout3d(struct lf1000fb_info *fbi);
+static u32 access_mask(struct lf1000fb_info *fbi, pid_t tgid);
+static struct lf1000fb_client *find_client(struct lf1000fb_info *fbi,
+					   pid_t tgid);
+static int lf1000fb_access(struct lf1000fb_info *fbi, u32 need);
+static int lf1000fb_ioctl_access(struct lf1000fb_info *fbi, unsigned int cmd,
+				 int layer);
+static int lf1000fb_claim(struct lf1000fb_info *fbi, unsigned int layer);
+static int lf1000fb_release_layer(struct lf1000fb_info *fbi,
+				  unsigned int layer);
+static int lf1000fb_lease(struct lf1000fb_info *fbi, struct lease_cmd *lc);
+
+static void tv_program(struct lf1000fb_tv *tv);
+static void lf1000fb_free(struct kref *ref);
+
+/* the TV MLC follows the LCD unless the TV framebuffer has taken it */
+static inline int tv_mirror(struct lf1000fb_info *fbi)
+{
+	return fbi->fb.var.reserved[0] && !fbi->tv_extended;
+}
+
+/*
+ * Video layer sizes as last set on one MLC, fbi->overlaysize or
+ * tv->overlaysize.  The vsync interrupt updates them for ANIM_SCALE
+ * tracks, hence fbi->lock.
+ */
+static void overlaysize_save(struct lf1000fb_info *fbi,
+			     struct overlaysize_cmd *saved,
+			     const struct overlaysize_cmd *os)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	*saved = *os;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+}
+
+/* 0, leaving os alone, if no sizes were set since boot */
+static int overlaysize_load(struct lf1000fb_info *fbi,
+			    struct overlaysize_cmd *saved,
+			    struct overlaysize_cmd *os)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	if(saved->dstwidth) {
+		*os = *saved;
+		ret = 1;
+	}
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return ret;
+}
+
 static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long arg)
 {
-	int tvout_enable = info->var.reserved[0];
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	int tvout_enable = tv_mirror(fbi);
 	int result = 0;
 	void __user *argp = (void __user *)arg;
+	struct file *file;
 	union mlc_cmd c;
 	//int size = 0;
 	//void *pdata = NULL;
@@ -196,6 +580,10 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 
 	int layerID = 0; //hard coded, for now
 
+	result = lf1000fb_ioctl_access(fbi, cmd, layerID);
+	if(result < 0)
+		return result;
+
 	switch(cmd) {
 		
 		case MLC_IOCTENABLE:
@@ -290,6 +678,8 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 			result = mlc_SetHStride(layerID, arg);
 			mlcregs -= 0x400;
 		}
+		/* plain strides end any mirroring set up by MLC_IOCSORIENT */
+		fbi->orient_offset[layerID] = 0;
 		break;
 
 		case MLC_IOCTVSTRIDE:
@@ -299,6 +689,7 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 			result = mlc_SetVStride(layerID, arg);
 			mlcregs -= 0x400;
 		}
+		fbi->orient_offset[layerID] = 0;
 		break;
 		
 		case MLC_IOCQVSTRIDE:
@@ -475,29 +866,36 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 		if(copy_from_user((void *)&c, argp, 
 				  sizeof(struct overlaysize_cmd)))
 			return -EFAULT;
-		result = mlc_SetOverlaySize(layerID,
+		if(c.overlaysize.dstwidth < 2 || c.overlaysize.dstheight < 2)
+			return -EINVAL;
+		result = mlc_SetOverlaySize(MLC_VIDEO_LAYER,
 					    c.overlaysize.srcwidth,
 					    c.overlaysize.srcheight,
 					    c.overlaysize.dstwidth,
 					    c.overlaysize.dstheight);
 		if (tvout_enable) {
 			mlcregs += 0x400;
-			result = mlc_SetOverlaySize(layerID,
+			result = mlc_SetOverlaySize(MLC_VIDEO_LAYER,
 						    c.overlaysize.srcwidth,
 						    c.overlaysize.srcheight,
 						    c.overlaysize.dstwidth,
 						    c.overlaysize.dstheight);
 			mlcregs -= 0x400;
 		}
+		if(result == 0)
+			overlaysize_save(fbi, &fbi->overlaysize,
+					 &c.overlaysize);
 		break;
 		
 		case MLC_IOCGOVERLAYSIZE:
 		if(!(_IOC_DIR(cmd) & _IOC_READ))
 			return -EFAULT;
-		result = mlc_GetOverlaySize(layerID, 
+		result = mlc_GetOverlaySize(MLC_VIDEO_LAYER,
 					    (struct mlc_overlay_size *)&c);
 		if(result < 0)
 			return result;
+		/* the sizes as set, the ratios if none were */
+		overlaysize_load(fbi, &fbi->overlaysize, &c.overlaysize);
 		if(copy_to_user(argp, (void *)&c, 
 				sizeof(struct overlaysize_cmd)))
 			return -EFAULT;
@@ -538,10 +936,10 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 		
 		
 		case MLC_IOCTADDRESSCB:
-		result = mlc_SetAddressCb(layerID, arg);
+		result = mlc_SetAddressCb(MLC_VIDEO_LAYER, arg);
 		if (tvout_enable) {
 			mlcregs += 0x400;
-			result = mlc_SetAddressCb(layerID, arg);
+			result = mlc_SetAddressCb(MLC_VIDEO_LAYER, arg);
 			mlcregs -= 0x400;
 		}
 		break;
@@ -549,10 +947,10 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 
 		
 		case MLC_IOCTADDRESSCR:
-		result = mlc_SetAddressCr(layerID, arg);
+		result = mlc_SetAddressCr(MLC_VIDEO_LAYER, arg);
 		if (tvout_enable) {
 			mlcregs += 0x400;
-			result = mlc_SetAddressCr(layerID, arg);
+			result = mlc_SetAddressCr(MLC_VIDEO_LAYER, arg);
 			mlcregs -= 0x400;
 		}
 		break;
@@ -589,12 +987,12 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 		break;
 
 		case MLC_IOCQADDRESSCR:
-		if(mlc_GetAddressCr(layerID, &result) < 0)
+		if(mlc_GetAddressCr(MLC_VIDEO_LAYER, &result) < 0)
 		return -EFAULT;
 		break;
 		
 		case MLC_IOCQADDRESSCB:
-		if(mlc_GetAddressCb(layerID, &result) < 0)
+		if(mlc_GetAddressCb(MLC_VIDEO_LAYER, &result) < 0)
 		return -EFAULT;
 		break;
 				
@@ -606,18 +1004,296 @@ static int lf1000fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 		break;
 		
 		case FBIO_ENABLE_TVOUT:
-		if (info->var.reserved[0]==1)
-			return -EFAULT;
-		info->var.reserved[0]=1;
-		enable_tvout_dpc(info);
-		enable_tvout_mlc(info);
+		/* returns at once, poll FBIO_QTVOUT_STATUS for completion */
+		result = lf1000fb_tvout_request(fbi, 1);
 		break;
 		
 		case FBIO_DISABLE_TVOUT:
-		if (info->var.reserved[0]==0)
+		result = lf1000fb_tvout_request(fbi, 0);
+		break;
+
+		case FBIO_QTVOUT_STATUS:
+		result = fbi->tvout_status;
+		break;
+
+		case MLC_IOCSTVSTANDARD:
+		result = lf1000fb_set_tvout_standard(fbi, (int)arg);
+		break;
+
+		case MLC_IOCQREFRESH:
+		result = fbi->refresh;
+		break;
+
+		case MLC_IOCSFLIP:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct flip_cmd)))
+			return -EFAULT;
+		if(c.flip.layer < MLC_NUM_LAYERS &&
+		   lf1000fb_access(fbi, 1<<c.flip.layer) < 0)
+			return -EPERM;
+		result = lf1000fb_queue_flip(fbi, &c.flip, &file);
+		if(result < 0)
+			return result;
+		/* the fence fd only becomes visible once the caller knows it */
+		if(copy_to_user(argp, (void *)&c, sizeof(struct flip_cmd))) {
+			if(file) {
+				put_unused_fd(c.flip.fence);
+				fput(file);
+			}
+			return -EFAULT;
+		}
+		if(file)
+			fd_install(c.flip.fence, file);
+		break;
+
+		case MLC_IOCGFLIPDONE:
+		if(!(_IOC_DIR(cmd) & _IOC_READ))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct flip_done_cmd)))
+			return -EFAULT;
+		if(c.flip_done.layer < MLC_NUM_LAYERS &&
+		   lf1000fb_access(fbi, 1<<c.flip_done.layer) < 0)
+			return -EPERM;
+		result = lf1000fb_flip_done(fbi, &c.flip_done);
+		if(result < 0)
+			return result;
+		if(copy_to_user(argp, (void *)&c,
+				sizeof(struct flip_done_cmd)))
+			return -EFAULT;
+		break;
+
+		case MLC_IOCQVBLANK:
+		result = fbi->vblank_count & MLC_VBLANK_MASK;
+		break;
+
+		case MLC_IOCSLAYERSTATE:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct layer_state_cmd)))
+			return -EFAULT;
+		if(c.layer_state.layer < MLC_NUM_LAYERS &&
+		   lf1000fb_access(fbi, 1<<c.layer_state.layer) < 0)
+			return -EPERM;
+		result = mlc_SetLayerState(&c.layer_state);
+		if (result == 0 && tvout_enable) {
+			mlcregs += 0x400;
+			result = mlc_SetLayerState(&c.layer_state);
+			mlcregs -= 0x400;
+		}
+		if(result == 0 && (c.layer_state.mask &
+				   (LAYER_HSTRIDE|LAYER_VSTRIDE)))
+			fbi->orient_offset[c.layer_state.layer] = 0;
+		if(result == 0 && (c.layer_state.mask & LAYER_OVERLAYSIZE))
+			overlaysize_save(fbi, &fbi->overlaysize,
+					 &c.layer_state.overlaysize);
+		break;
+
+		case MLC_IOCSCONVERT:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct convert_cmd)))
+			return -EFAULT;
+		result = lf1000fb_convert_rect(fbi, &c.convert);
+		break;
+
+		case MLC_IOCSUSERBLIT:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct user_blit_cmd)))
+			return -EFAULT;
+		result = lf1000fb_user_blit(fbi, &c.user_blit);
+		break;
+
+		case MLC_IOCSBLITLIST:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct blit_list_cmd)))
+			return -EFAULT;
+		result = lf1000fb_blit_list(fbi, &c.blit_list);
+		break;
+
+		case MLC_IOCGCTLPAGE:
+		result = lf1000fb_ctl_page(fbi);
+		break;
+
+		case MLC_IOCSRWRECT:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct rect_cmd)))
+			return -EFAULT;
+		result = lf1000fb_set_rw_rect(fbi, &c.rect);
+		break;
+
+		case MLC_IOCSSPRITE:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct sprite_cmd)))
+			return -EFAULT;
+		if(lf1000fb_access(fbi, 1<<SPRITE_LAYER) < 0)
+			return -EPERM;
+		result = lf1000fb_set_sprite(fbi, &c.sprite);
+		break;
+
+		case MLC_IOCSSPRITEPOS:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct sprite_pos_cmd)))
+			return -EFAULT;
+		if(lf1000fb_access(fbi, 1<<SPRITE_LAYER) < 0)
+			return -EPERM;
+		result = lf1000fb_move_sprite(fbi, &c.sprite_pos);
+		break;
+
+		case MLC_IOCSANIM:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct anim_cmd)))
+			return -EFAULT;
+		if(c.anim.layer < MLC_NUM_LAYERS &&
+		   lf1000fb_access(fbi, 1<<c.anim.layer) < 0)
+			return -EPERM;
+		result = lf1000fb_set_anim(fbi, &c.anim);
+		break;
+
+		case MLC_IOCQANIM:
+		if(arg >= MLC_NUM_LAYERS)
+			return -EINVAL;
+		result = fbi->anim[arg].running;
+		break;
+
+		case MLC_IOCTANIMWAIT:
+		if(arg >= MLC_NUM_LAYERS)
+			return -EINVAL;
+		if(lf1000fb_access(fbi, 1<<arg) < 0)
+			return -EPERM;
+		result = wait_vsync_unlocked(fbi, !fbi->anim[arg].running);
+		break;
+
+		case MLC_IOCSCOMPOSE:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct compose_cmd)))
+			return -EFAULT;
+		if(c.compose.layer < MLC_NUM_LAYERS &&
+		   lf1000fb_access(fbi, 1<<c.compose.layer) < 0)
+			return -EPERM;
+		result = lf1000fb_set_compose(fbi, &c.compose);
+		break;
+
+		case MLC_IOCGCOMPOSE:
+		if(!(_IOC_DIR(cmd) & _IOC_READ))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct compose_cmd)))
+			return -EFAULT;
+		result = lf1000fb_get_compose(fbi, &c.compose);
+		if(result < 0)
+			return result;
+		if(copy_to_user(argp, (void *)&c, sizeof(struct compose_cmd)))
+			return -EFAULT;
+		break;
+
+		case MLC_IOCS3DSCANOUT:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct scanout3d_cmd)))
+			return -EFAULT;
+		if(c.scanout3d.layer < MLC_NUM_LAYERS &&
+		   lf1000fb_access(fbi, 1<<c.scanout3d.layer) < 0)
+			return -EPERM;
+		result = lf1000fb_set_scanout3d(fbi, &c.scanout3d);
+		if(result < 0)
+			return result;
+		if(copy_to_user(argp, (void *)&c, sizeof(struct scanout3d_cmd)))
+			return -EFAULT;
+		break;
+
+		case MLC_IOCT3DFLIP:
+		if(lf1000fb_access(fbi, 1<<fbi->scanout3d.layer) < 0)
+			return -EPERM;
+		result = lf1000fb_flip_scanout3d(fbi);
+		break;
+
+		case MLC_IOCTCLAIM:
+		result = lf1000fb_claim(fbi, arg);
+		break;
+
+		case MLC_IOCTRELEASE:
+		result = lf1000fb_release_layer(fbi, arg);
+		break;
+
+		case MLC_IOCSLEASE:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct lease_cmd)))
+			return -EFAULT;
+		result = lf1000fb_lease(fbi, &c.lease);
+		break;
+
+		case MLC_IOCSFIELDPAIR:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct field_pair_cmd)))
+			return -EFAULT;
+		if(c.field_pair.layer < MLC_NUM_LAYERS &&
+		   lf1000fb_access(fbi, 1<<c.field_pair.layer) < 0)
+			return -EPERM;
+		result = lf1000fb_set_field_pair(fbi, &c.field_pair);
+		break;
+
+		case MLC_IOCQFIELD:
+		/* same wrap as vblank counts, the parity is kept */
+		result = fbi->field_count & MLC_VBLANK_MASK;
+		break;
+
+		case MLC_IOCSORIENT:
+		if(!(_IOC_DIR(cmd) & _IOC_WRITE))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp, sizeof(struct orient_cmd)))
+			return -EFAULT;
+		if(c.orient.layer < MLC_NUM_LAYERS &&
+		   lf1000fb_access(fbi, 1<<c.orient.layer) < 0)
+			return -EPERM;
+		result = mlc_SetOrientation(&c.orient);
+		if (result == 0 && tvout_enable) {
+			mlcregs += 0x400;
+			result = mlc_SetOrientation(&c.orient);
+			mlcregs -= 0x400;
+		}
+		if(result == 0)
+			fbi->orient_offset[c.orient.layer] =
+				mlc_OrientOffset(&c.orient);
+		break;
+
+		case MLC_IOCQOWNER:
+		if(arg >= MLC_NUM_LAYERS)
+			return -EINVAL;
+		result = fbi->layer_owner[arg];
+		break;
+
+		case MLC_IOCGLAYERSTATE:
+		if(!(_IOC_DIR(cmd) & _IOC_READ))
+			return -EFAULT;
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct layer_state_cmd)))
+			return -EFAULT;
+		result = mlc_GetLayerState(&c.layer_state);
+		if(result < 0)
+			return result;
+		if(c.layer_state.layer == MLC_VIDEO_LAYER &&
+		   overlaysize_load(fbi, &fbi->overlaysize,
+				    &c.layer_state.overlaysize))
+			c.layer_state.mask |= LAYER_OVERLAYSIZE;
+		if(copy_to_user(argp, (void *)&c,
+				sizeof(struct layer_state_cmd)))
 			return -EFAULT;
-		info->var.reserved[0]=0;
-		disable_tvout();
 		break;
 		
 		
@@ -664,39 +1340,17 @@ void mlc_SetMLCEnable(u8 en)
 
 
 
-static void *SelectLayerControl(u8 layer)
+int mlc_SetLayerEnable(u8 layer, u8 en)
 {
-	void *ctl = mlcregs;
+	unsigned long flags;
+	void *reg;
+	u32 tmp;
 
-	if(!mlcregs) {
-		return 0;
-	}
-	switch(layer) {
-		case 0:
-		ctl += MLCCONTROL0;
-		break;
-		case 1:
-		ctl += MLCCONTROL1;
-		break;
-		case 2:
-		ctl += MLCCONTROL2;
-		break;
-		default:
-		return 0;
-	}
-
-	return ctl;
-}
-
-int mlc_SetLayerEnable(u8 layer, u8 en)
-{
-	void *reg;
-	u32 tmp;
-
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	spin_lock_irqsave(mlc_lock, flags);
 	tmp = ioread32(reg);
 
 	BIT_SET(tmp,PALETTEPWD); /* power up */
@@ -706,155 +1360,92 @@ int mlc_SetLayerEnable(u8 layer, u8 en)
 	en ? BIT_SET(tmp,LAYERENB) : BIT_CLR(tmp,LAYERENB);
 
 	iowrite32(tmp,reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
 	return 0;
 }
 
-int mlc_GetAddress(u8 layer, int *addr) /* FIXME */
+int mlc_GetAddress(u8 layer, int *addr)
 {
-	void *reg = NULL;
-
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
-	
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCADDRESS0;
-		break;
-		case 1:
-		reg = mlcregs+MLCADDRESS1;
-		break;
-		case 2:
-		reg = mlcregs+MLCADDRESS2; /* note: weird datasheet naming - says MLCADDRESS3 */
-		break;
-	}
 
-	*addr = ioread32(reg);
+	*addr = mlc_layer_read(mlcregs, layer, MLC_REG_ADDRESS);
 	return 0;
 }
 
 
 int mlc_GetAddressCb(u8 layer, int *addr)
 {
-	void *reg = NULL;
-	if(layer > MLC_NUM_LAYERS || layer != MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_ADDRESSCB))
 		return -EINVAL;
 
-	reg = mlcregs+MLCADDRESSCB;
-	*addr = ioread32(reg);
+	*addr = mlc_layer_read(mlcregs, layer, MLC_REG_ADDRESSCB);
 	return 0;
 }
 
 int mlc_GetAddressCr(u8 layer, int *addr)
 {
-	void *reg = NULL;
-	
-	if(layer > MLC_NUM_LAYERS || layer != MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_ADDRESSCR))
 		return -EINVAL;
 
-	reg = mlcregs+MLCADDRESSCR;
-	*addr = ioread32(reg);
+	*addr = mlc_layer_read(mlcregs, layer, MLC_REG_ADDRESSCR);
 	return 0;
 }
 
 
 int mlc_SetAddress(u8 layer, u32 addr)
 {
-	void *reg = NULL;
-
-	if(layer > MLC_NUM_LAYERS) 
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
 	if(!mlcregs)
 		return -ENOMEM;
-		
-	switch(layer) {
-		case 0:
-		reg = mlcregs + MLCADDRESS0;
-		break;
-		case 1:
-		reg = mlcregs + MLCADDRESS1;
-		break;
-		case 2:
-		reg = mlcregs + MLCADDRESS2; /* note: weird datasheet naming MLCADDRESS3 */
-		break;
-	}
 
-	iowrite32(addr, reg);
+	mlc_layer_write(mlcregs, layer, MLC_REG_ADDRESS, addr);
 	return 0;
 }
 
 int mlc_GetHStride(u8 layer)
 {
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_HSTRIDE))
 		return -EINVAL;
-	return ioread32(mlcregs+MLCHSTRIDE0+layer*0x34);
+	return mlc_layer_read(mlcregs, layer, MLC_REG_HSTRIDE);
 }
 
 int mlc_SetHStride(u8 layer, u32 hstride)
 {
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_HSTRIDE))
 		return -EINVAL;
 
-	//hstride &= 0x7FFFFFFF;
-	iowrite32(hstride, mlcregs + MLCHSTRIDE0);
-
-
+	/* two's complement, negative scans right to left */
+	mlc_layer_write(mlcregs, layer, MLC_REG_HSTRIDE, hstride);
 	return 0;
 }
 
 int mlc_SetVStride(u8 layer, u32 vstride)
 {
-	void *reg = NULL;
-
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCVSTRIDE0;
-		break;
-		case 1:
-		reg = mlcregs+MLCVSTRIDE1;
-		break;
-		case 2:
-		reg = mlcregs+MLCVSTRIDE2; /* note: weird datasheet naming MLCVSTRIDE3*/
-		break;
-	}
-	
-	iowrite32(vstride, reg);
-	
-	  if (layer == MLC_VIDEO_LAYER) {
-		iowrite32(vstride, mlcregs+MLCSTRIDECB);
-		iowrite32(vstride, mlcregs+MLCSTRIDECR);
+	mlc_layer_write(mlcregs, layer, MLC_REG_VSTRIDE, vstride);
+	if(mlc_has_reg(layer, MLC_REG_STRIDECB)) {
+		mlc_layer_write(mlcregs, layer, MLC_REG_STRIDECB, vstride);
+		mlc_layer_write(mlcregs, layer, MLC_REG_STRIDECR, vstride);
 	}
-	
 	return 0;
 }
 
 int mlc_GetVStride(u8 layer)
 {
-	void *reg = NULL;
-
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
-
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCVSTRIDE0;
-		break;
-		case 1:
-		reg = mlcregs+MLCVSTRIDE1;
-		break;
-		case 2:
-		reg = mlcregs+MLCVSTRIDE2; /* note: weird datasheet naming - they have MLCSTRIDE3*/
-		break;
-	}
-	return ioread32(reg);
+	return mlc_layer_read(mlcregs, layer, MLC_REG_VSTRIDE);
 }
 
 
 int mlc_SetLockSize(u8 layer, u32 locksize)
 {
+	unsigned long flags;
 	u32 tmp;
 	void *reg;
 
@@ -862,14 +1453,16 @@ int mlc_SetLockSize(u8 layer, u32 locksize)
 	if(!(locksize == 4 || locksize == 8 || locksize == 16))
 		return -EINVAL;
 
-	if(layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	spin_lock_irqsave(mlc_lock, flags);
 	tmp = ioread32(reg);
 	tmp &= ~(3<<LOCKSIZE);
 	tmp |= ((locksize/8)<<LOCKSIZE);
 	iowrite32(tmp,reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
 	return 0;
 }
 
@@ -878,10 +1471,10 @@ int mlc_GetLockSize(u8 layer, int *locksize) /*Orignal code had this comment: FI
 	u32 tmp;
 	void *reg;
 
-	if(layer == MLC_VIDEO_LAYER || layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
 	tmp = ioread32(reg);
 	*locksize = ((tmp & (3<<LOCKSIZE))>>LOCKSIZE)*8;
 	return 0;
@@ -889,17 +1482,20 @@ int mlc_GetLockSize(u8 layer, int *locksize) /*Orignal code had this comment: FI
 
 int mlc_Set3DEnable(u8 layer, u8 en)
 {
+	unsigned long flags;
 	void *reg;
 	u32 tmp;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	spin_lock_irqsave(mlc_lock, flags);
 	tmp = ioread32(reg);
 
 	en ? BIT_SET(tmp,GRP3DENB) : BIT_CLR(tmp,GRP3DENB);
 	iowrite32(tmp, reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
 	return 0;
 }
 
@@ -908,10 +1504,10 @@ int mlc_Get3DEnable(u8 layer, int *en) /*original comment said: FIXME*/
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
 	tmp = ioread32(reg);
 	*en = IS_SET(tmp,GRP3DENB) ? 1 : 0;
 	return 0;
@@ -978,18 +1574,21 @@ void mlc_GetScreenSize(struct mlc_screen_size *size)
 
 int mlc_SetFormat(u8 layer, enum RGBFMT format)
 {
+	unsigned long flags;
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER || 
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER || 
 			format > 0xFFFF)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	spin_lock_irqsave(mlc_lock, flags);
 	tmp = ioread32(reg);
 	tmp &= ~(0xFFFF<<FORMAT); /* clear format bits */
 	tmp |= (format<<FORMAT); /* set format */
 	iowrite32(tmp,reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
 	return 0;
 }
 
@@ -998,10 +1597,10 @@ int mlc_GetFormat(u8 layer, int *format)
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
 	tmp = ioread32(reg);
 	*format = ((tmp & (0xFFFF<<FORMAT))>>FORMAT);
 	return 0;
@@ -1009,7 +1608,7 @@ int mlc_GetFormat(u8 layer, int *format)
 
 int mlc_SetPosition(u8 layer, s32 top, s32 left, s32 right, s32 bottom)
 {
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
 	right--;
@@ -1020,10 +1619,10 @@ int mlc_SetPosition(u8 layer, s32 top, s32 left, s32 right, s32 bottom)
 	right &= 0x7FF;
 	bottom &= 0x7FF;
 
-	iowrite32(((left<<LEFT)|(right<<RIGHT)),
-			mlcregs+MLCLEFTRIGHT0+0x34*layer);
-	iowrite32(((top<<TOP)|(bottom<<BOTTOM)),
-			mlcregs+MLCTOPBOTTOM0+0x34*layer);
+	mlc_layer_write(mlcregs, layer, MLC_REG_LEFTRIGHT,
+			(left<<LEFT)|(right<<RIGHT));
+	mlc_layer_write(mlcregs, layer, MLC_REG_TOPBOTTOM,
+			(top<<TOP)|(bottom<<BOTTOM));
 	return 0;
 }
 
@@ -1031,14 +1630,14 @@ int mlc_GetPosition(u8 layer, struct mlc_layer_position *p)
 {
 	u32 tmp;
 
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	tmp = ioread32(mlcregs+MLCLEFTRIGHT0+0x34*layer);
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_LEFTRIGHT);
 	p->left = ((tmp & (0x7FF<<LEFT))>>LEFT);
 	p->right  = ((tmp & (0x7FF<<RIGHT))>>RIGHT);
 
-	tmp = ioread32(mlcregs+MLCTOPBOTTOM0+0x34*layer);
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_TOPBOTTOM);
 	p->top  = ((tmp & (0x7FF<<TOP))>>TOP);
 	p->bottom = ((tmp & (0x7FF<<BOTTOM))>>BOTTOM);
 	return 0;
@@ -1046,17 +1645,20 @@ int mlc_GetPosition(u8 layer, struct mlc_layer_position *p)
 
 int mlc_SetDirtyFlag(u8 layer)
 {
+	unsigned long flags;
 	void *reg;
 	u32 tmp;
 
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	spin_lock_irqsave(mlc_lock, flags);
 	tmp = ioread32(reg);
 	BIT_SET(tmp,DIRTYFLAG);
 
 	iowrite32(tmp,reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
 	return 0;
 }
 
@@ -1065,10 +1667,10 @@ int mlc_GetDirtyFlag(u8 layer)
 	void *reg;
 	u32 tmp, ret=false;
 
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
 	tmp = ioread32(reg);
 	ret = IS_SET(tmp,DIRTYFLAG) ? 1 : 0;
 
@@ -1081,26 +1683,10 @@ int mlc_SetTransparencyAlpha(u8 layer, u8 alpha)
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	//if (layer == MLC_VIDEO_LAYER) 
-	//	reg = mlcregs+MLCTPCOLOR2;
-	//else
-	//	reg = mlcregs+MLCTPCOLOR0+layer*0x34;
-		
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCTPCOLOR0;
-		break;
-		case 1:
-		reg = mlcregs+MLCTPCOLOR1;
-		break;
-		case 2:
-		reg = mlcregs+MLCTPCOLOR2; /* note: weird datasheet naming - says MLCTPCOLOR3 */
-		break;
-	}
-	
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_TPCOLOR);
 	tmp = ioread32(reg);
 	tmp &= ~(0xF<<ALPHA);
 	tmp |= ((0xF & alpha)<<ALPHA);
@@ -1112,27 +1698,11 @@ int mlc_SetTransparencyAlpha(u8 layer, u8 alpha)
 int mlc_GetTransparencyAlpha(u8 layer)
 {
 	u32 tmp;
-	void *reg;
 
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	//if (layer == MLC_VIDEO_LAYER) 
-	//	reg = mlc.mem+MLCTPCOLOR3;
-	//else
-	//	reg = mlc.mem+MLCTPCOLOR0+layer*0x34;
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCTPCOLOR0;
-		break;
-		case 1:
-		reg = mlcregs+MLCTPCOLOR1;
-		break;
-		case 2:
-		reg = mlcregs+MLCTPCOLOR2; /* note: weird datasheet naming - says MLCTPCOLOR3 */
-		break;
-	}
-	tmp = ioread32(reg);
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_TPCOLOR);
 	return ((tmp & (0xF<<ALPHA))>>ALPHA);
 }
 
@@ -1142,23 +1712,10 @@ int mlc_SetTransparencyColor(u8 layer, u32 color)
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	//reg = SelectLayerControl(layer);
-    //reg = SelectLayerControl(layer) + MLCTPCOLOR0 - MLCCONTROL0;
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCTPCOLOR0;
-		break;
-		case 1:
-		reg = mlcregs+MLCTPCOLOR1;
-		break;
-		case 2:
-		reg = mlcregs+MLCTPCOLOR2; /* note: weird datasheet naming - says MLCTPCOLOR3 */
-		break;
-	}
-	
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_TPCOLOR);
 	tmp = ioread32(reg);
 	tmp &= ~(0xFFFFFF<<TPCOLOR);
 	tmp |= ((0xFFFFFF & color)<<TPCOLOR);
@@ -1169,28 +1726,11 @@ int mlc_SetTransparencyColor(u8 layer, u32 color)
 int mlc_GetTransparencyColor(u8 layer, int *color)
 {
 	u32 tmp;
-	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
 		return -EINVAL;
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCTPCOLOR0;
-		break;
-		case 1:
-		reg = mlcregs+MLCTPCOLOR1;
-		break;
-		case 2:
-		reg = mlcregs+MLCTPCOLOR2; /* note: weird datasheet naming - says MLCTPCOLOR3 */
-		break;
-	}
-//	reg = SelectLayerControl(layer);
-//should be reg = SelectLayerControl(layer) + MLCTPCOLOR0 - MLCCONTROL0;
-
-
-
 
-	tmp = ioread32(reg);
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_TPCOLOR);
 	*color = ((tmp & (0xFFFFFF<<TPCOLOR))>>TPCOLOR);
 	return 0;
 }
@@ -1198,16 +1738,19 @@ int mlc_GetTransparencyColor(u8 layer, int *color)
 
 int mlc_SetBlendEnable(u8 layer, u8 en)
 {
+	unsigned long flags;
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	spin_lock_irqsave(mlc_lock, flags);
 	tmp = ioread32(reg);
 	en ? BIT_SET(tmp,BLENDENB) : BIT_CLR(tmp,BLENDENB);
 	iowrite32(tmp,reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
 	return 0;
 }
 
@@ -1216,10 +1759,10 @@ int mlc_GetBlendEnable(u8 layer, int *en) /* original comment said FIXME*/
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS)
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
 	tmp = ioread32(reg);
 	*en = IS_SET(tmp,BLENDENB) ? 1 : 0;
 	return 0;
@@ -1228,16 +1771,19 @@ int mlc_GetBlendEnable(u8 layer, int *en) /* original comment said FIXME*/
 
 int mlc_SetTransparencyEnable(u8 layer, u8 en)
 {
+	unsigned long flags;
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	spin_lock_irqsave(mlc_lock, flags);
 	tmp = ioread32(reg);
 	en ? BIT_SET(tmp,TPENB) : BIT_CLR(tmp,TPENB);
 	iowrite32(tmp,reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
 	return 0;
 }
 
@@ -1246,10 +1792,10 @@ int mlc_GetTransparencyEnable(u8 layer, int *en)
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
 
 	tmp = ioread32(reg);
 	*en = IS_SET(tmp,TPENB) ? 1 : 0;
@@ -1259,17 +1805,20 @@ int mlc_GetTransparencyEnable(u8 layer, int *en)
 
 int mlc_SetInvertEnable(u8 layer, u8 en)
 {
+	unsigned long flags;
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER) 
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER) 
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	spin_lock_irqsave(mlc_lock, flags);
 
 	tmp = ioread32(reg);
 	en ? BIT_SET(tmp,INVENB) : BIT_CLR(tmp,INVENB);
 	iowrite32(tmp,reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
 	return 0;
 }
 
@@ -1278,10 +1827,10 @@ int mlc_GetInvertEnable(u8 layer, int *en)
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
 		return -EINVAL;
 
-	reg = SelectLayerControl(layer);
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
 
 	tmp = ioread32(reg);
 	*en = IS_SET(tmp,INVENB) ? 1 : 0;
@@ -1293,22 +1842,10 @@ int mlc_SetInvertColor(u8 layer, u32 color)
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_INVCOLOR))
 		return -EINVAL;
 
-	//reg = mlc.mem+MLCINVCOLOR0+layer*0x34;
-		switch(layer) {
-		case 0:
-		reg = mlcregs+MLCINVCOLOR0;
-		break;
-		case 1:
-		reg = mlcregs+MLCINVCOLOR1;
-		break;
-		case 2:
-		reg = mlcregs+MLCINVCOLOR2; 
-		break;
-	}
-	
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_INVCOLOR);
 	tmp = ioread32(reg);
 	tmp &= ~(0xFFFFFF<<INVCOLOR);
 	tmp |= ((0xFFFFFF & color)<<INVCOLOR);
@@ -1320,25 +1857,11 @@ int mlc_SetInvertColor(u8 layer, u32 color)
 int mlc_GetInvertColor(u8 layer, int *color)
 {
 	u32 tmp;
-	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_INVCOLOR))
 		return -EINVAL;
 
-	//reg = mlc.mem+MLCINVCOLOR0+layer*0x34;
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCINVCOLOR0;
-		break;
-		case 1:
-		reg = mlcregs+MLCINVCOLOR1;
-		break;
-		case 2:
-		reg = mlcregs+MLCINVCOLOR2; 
-		break;
-	}
-
-	tmp = ioread32(reg);
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_INVCOLOR);
 	*color = ((tmp & (0xFFFFFF<<INVCOLOR))>>INVCOLOR);
 	return 0;
 }
@@ -1347,77 +1870,60 @@ int mlc_GetInvertColor(u8 layer, int *color)
 int mlc_SetOverlaySize(u8 layer, u32 srcwidth, u32 srcheight, u32 dstwidth, 
 		u32 dstheight)
 {
-	/* Enable adjusted ratio with bilinear filter for upscaling */
-	if (srcwidth < dstwidth)
-		iowrite32((1<<28) | (((srcwidth-1)<<11)/(dstwidth-1)), mlcregs+MLCHSCALE);
-	else
-		iowrite32((srcwidth<<11)/(dstwidth), mlcregs+MLCHSCALE);
-	/* Ditto for height which scales independently of width */
-	if (srcheight < dstheight)	
-		iowrite32((1<<28) | (((srcheight-1)<<11)/(dstheight-1)), mlcregs+MLCVSCALE);
-	else
-		iowrite32((srcheight<<11)/(dstheight), mlcregs+MLCVSCALE);
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_HSCALE))
+		return -EINVAL;
+
+	mlc_layer_scale(mlcregs, layer, srcwidth, srcheight, dstwidth,
+			dstheight);
 	return 0;
 }
 
 int mlc_GetOverlaySize(u8 layer, struct mlc_overlay_size *psize)
 {
-	u32 hscale = ioread32(mlcregs+MLCHSCALE);
-	u32 vscale = ioread32(mlcregs+MLCVSCALE);
+	u32 hscale, vscale;
+
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_HSCALE))
+		return -EINVAL;
 
-	psize->srcwidth = (hscale>>11) & 0x7FF;
-	psize->srcheight = hscale & 0x7FF;
-	psize->dstwidth = (vscale>>11) & 0x7FF;
-	psize->dstheight = vscale & 0x7FF;
+	hscale = mlc_layer_read(mlcregs, layer, MLC_REG_HSCALE);
+	vscale = mlc_layer_read(mlcregs, layer, MLC_REG_VSCALE);
+
+	/*
+	 * The registers only hold the ratios, in 11 bit fixed point, so
+	 * that is what comes back: src/2048.  The ioctls report the sizes
+	 * as they were set.
+	 */
+	psize->srcwidth = hscale & ~(1<<HFILTERENB);
+	psize->srcheight = vscale & ~(1<<VFILTERENB);
+	psize->dstwidth = 1<<11;
+	psize->dstheight = 1<<11;
 
 	return 0;
 }
 
-int mlc_SetLayerInvisibleAreaEnable(u8 layer, u8 en) /***********************VALIDATE?*/
+int mlc_SetLayerInvisibleAreaEnable(u8 layer, u8 en)
 {
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_INVLEFTRIGHT))
 		return -EINVAL;
-		
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCLEFTRIGHT0_0;
-		break;
-		case 1:
-		reg = mlcregs+MLCLEFTRIGHT1_0;
-		break;
-	}
 
-	//reg = mlcregs+MLCLEFTRIGHT0_0+layer*0x34;
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_INVLEFTRIGHT);
 	tmp = ioread32(reg);
 	en ? BIT_SET(tmp, INVALIDENB) : BIT_CLR(tmp, INVALIDENB);
 	iowrite32(tmp, reg);
-
 	return 0;
 }
 
-int mlc_GetLayerInvisibleAreaEnable(u8 layer) /***********************VALIDATE?*/
+int mlc_GetLayerInvisibleAreaEnable(u8 layer)
 {
 	u32 tmp;
-	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_INVLEFTRIGHT))
 		return -EINVAL;
 
-	//reg = mlcregs+MLCLEFTRIGHT0_0+layer*0x34;
-	
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCLEFTRIGHT0_0;
-		break;
-		case 1:
-		reg = mlcregs+MLCLEFTRIGHT1_0;
-		break;
-	}
-	tmp = ioread32(reg);
-
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_INVLEFTRIGHT);
 	return IS_SET(tmp, INVALIDENB) ? 1 : 0;
 }
 
@@ -1426,7 +1932,7 @@ int mlc_SetLayerInvisibleArea(u8 layer, s32 top, s32 left, s32 right, s32 bottom
 	u32 tmp;
 	void *reg;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_INVLEFTRIGHT))
 		return -EINVAL;
 
 	top &= 0x7FF;
@@ -1434,36 +1940,17 @@ int mlc_SetLayerInvisibleArea(u8 layer, s32 top, s32 left, s32 right, s32 bottom
 	right &= 0x7FF;
 	bottom &= 0x7FF;
 
-	//reg = mlcregs+MLCLEFTRIGHT0_0+layer*0x34;
-	
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCLEFTRIGHT0_0;
-		break;
-		case 1:
-		reg = mlcregs+MLCLEFTRIGHT1_0;
-		break;
-	}
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_INVLEFTRIGHT);
 	tmp = ioread32(reg);
 	tmp &= ~((0x7FF<<INVALIDLEFT)|(0x7FF<<INVALIDRIGHT));
 	tmp |= (left<<INVALIDLEFT)|(right<<INVALIDRIGHT);
 	iowrite32(tmp, reg);
 
-	//reg = mlcregs+MLCTOPBOTTOM0_0+layer*0x34;
-	switch(layer) {
-		case 0:
-		reg = mlcregs+MLCTOPBOTTOM0_0;
-		break;
-		case 1:
-		reg = mlcregs+MLCTOPBOTTOM1_0;
-		break;
-	}
-	
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_INVTOPBOTTOM);
 	tmp = ioread32(reg);
 	tmp &= ~((0x7FF<<INVALIDTOP)|(0x7FF<<INVALIDBOTTOM));
-	tmp |= (left<<INVALIDTOP)|(right<<INVALIDBOTTOM);
+	tmp |= (top<<INVALIDTOP)|(bottom<<INVALIDBOTTOM);
 	iowrite32(tmp, reg);
-
 	return 0;
 }
 
@@ -1472,43 +1959,25 @@ int mlc_GetLayerInvisibleArea(u8 layer, struct mlc_layer_position *p)
 {
 	u32 tmp;
 
-	if(layer > MLC_NUM_LAYERS || layer == MLC_VIDEO_LAYER)
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_INVLEFTRIGHT))
 		return -EINVAL;
 
-	//tmp = ioread32(mlc.mem+MLCLEFTRIGHT0_0+0x34*layer);
-	
-	switch(layer) {
-		case 0:
-		tmp = mlcregs+MLCLEFTRIGHT0_0;
-		break;
-		case 1:
-		tmp = mlcregs+MLCLEFTRIGHT1_0;
-		break;
-	}
-	p->left = ((tmp & (0x7FF<<LEFT))>>LEFT);
-	p->right  = ((tmp & (0x7FF<<RIGHT))>>RIGHT);
-
-	//tmp = ioread32(mlc.mem+MLCTOPBOTTOM0_0+0x34*layer);
-	switch(layer) {
-		case 0:
-		tmp = mlcregs+MLCTOPBOTTOM0_0;
-		break;
-		case 1:
-		tmp = mlcregs+MLCTOPBOTTOM1_0;
-		break;
-	}
-	p->top  = ((tmp & (0x7FF<<TOP))>>TOP);
-	p->bottom = ((tmp & (0x7FF<<BOTTOM))>>BOTTOM);
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_INVLEFTRIGHT);
+	p->left = ((tmp & (0x7FF<<INVALIDLEFT))>>INVALIDLEFT);
+	p->right  = ((tmp & (0x7FF<<INVALIDRIGHT))>>INVALIDRIGHT);
 
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_INVTOPBOTTOM);
+	p->top  = ((tmp & (0x7FF<<INVALIDTOP))>>INVALIDTOP);
+	p->bottom = ((tmp & (0x7FF<<INVALIDBOTTOM))>>INVALIDBOTTOM);
 	return 0;
 }
 
 
 int mlc_SetAddressCb(u8 layer, u32 addr)
 {
-	if (layer != MLC_VIDEO_LAYER) 
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_ADDRESSCB))
 		return -EINVAL;
-	iowrite32(addr, mlcregs+MLCADDRESSCB);
+	mlc_layer_write(mlcregs, layer, MLC_REG_ADDRESSCB, addr);
 	return 0;
 }
 
@@ -1517,9 +1986,153 @@ int mlc_SetAddressCb(u8 layer, u32 addr)
 
 int mlc_SetAddressCr(u8 layer, u32 addr)
 {
-	if (layer != MLC_VIDEO_LAYER) 
+	if(layer >= MLC_NUM_LAYERS || !mlc_has_reg(layer, MLC_REG_ADDRESSCR))
+		return -EINVAL;
+	mlc_layer_write(mlcregs, layer, MLC_REG_ADDRESSCR, addr);
+	return 0;
+}
+
+/*
+ * Apply several layer properties at once.  Everything is checked before
+ * the first register is touched, so a rejected call leaves the layer as
+ * it was.  The writes then go out under mlc_lock so the flip IRQ cannot
+ * set the dirty flag halfway through, and the control register bits
+ * (enable, format, blend, transparency, dirty) are merged into one
+ * read-modify-write that goes out last, so the dirty flag covers
+ * everything else.
+ */
+int mlc_SetLayerState(struct layer_state_cmd *st)
+{
+	u8 layer = st->layer;
+	struct position_cmd *p = &st->position;
+	unsigned long flags;
+	void *reg;
+	u32 tmp;
+
+	if(layer >= MLC_NUM_LAYERS || !mlcregs)
+		return -EINVAL;
+	if(st->mask & ~(LAYER_ENABLE|LAYER_ADDRESS|LAYER_FORMAT|LAYER_HSTRIDE|
+			LAYER_VSTRIDE|LAYER_POSITION|LAYER_OVERLAYSIZE|
+			LAYER_ALPHA|LAYER_TPCOLOR|LAYER_BLEND|LAYER_TRANSP|
+			LAYER_DIRTY))
+		return -EINVAL;
+	if(layer == MLC_VIDEO_LAYER && (st->mask & LAYER_RGB_ONLY))
+		return -EINVAL;
+	if((st->mask & LAYER_HSTRIDE) && !mlc_has_reg(layer, MLC_REG_HSTRIDE))
+		return -EINVAL;
+	if((st->mask & LAYER_FORMAT) && st->format > 0xFFFF)
+		return -EINVAL;
+	/* right and bottom are exclusive; each edge is an 11 bit field */
+	if((st->mask & LAYER_POSITION) &&
+	   ((s32)p->left < -0x400 || (s32)p->top < -0x400 ||
+	    (s32)p->right > 0x800 || (s32)p->bottom > 0x800 ||
+	    (s32)p->right <= (s32)p->left || (s32)p->bottom <= (s32)p->top))
+		return -EINVAL;
+	if((st->mask & LAYER_OVERLAYSIZE) && (layer != MLC_VIDEO_LAYER ||
+	   st->overlaysize.dstwidth < 2 || st->overlaysize.dstheight < 2))
+		return -EINVAL;
+	if((st->mask & LAYER_ALPHA) && st->alpha > 0xF)
+		return -EINVAL;
+	if((st->mask & LAYER_TPCOLOR) && st->tpcolor > 0xFFFFFF)
+		return -EINVAL;
+
+	/* nothing below can fail */
+	spin_lock_irqsave(mlc_lock, flags);
+	if(st->mask & LAYER_ADDRESS)
+		mlc_SetAddress(layer, st->address);
+	if(st->mask & LAYER_HSTRIDE)
+		mlc_SetHStride(layer, st->hstride);
+	if(st->mask & LAYER_VSTRIDE)
+		mlc_SetVStride(layer, st->vstride);
+	if(st->mask & LAYER_POSITION)
+		mlc_SetPosition(layer, p->top, p->left, p->right, p->bottom);
+	if(st->mask & LAYER_OVERLAYSIZE)
+		mlc_SetOverlaySize(layer, st->overlaysize.srcwidth,
+				   st->overlaysize.srcheight,
+				   st->overlaysize.dstwidth,
+				   st->overlaysize.dstheight);
+	if(st->mask & LAYER_ALPHA)
+		mlc_SetTransparencyAlpha(layer, st->alpha);
+	if(st->mask & LAYER_TPCOLOR)
+		mlc_SetTransparencyColor(layer, st->tpcolor);
+
+	reg = mlc_layer_reg(mlcregs, layer, MLC_REG_CONTROL);
+	tmp = ioread32(reg);
+	if(st->mask & LAYER_ENABLE) {
+		/* same palette power sequence as mlc_SetLayerEnable() */
+		BIT_SET(tmp,PALETTEPWD);
+		iowrite32(tmp,reg);
+		st->enable ? BIT_SET(tmp,PALETTESLD) : BIT_CLR(tmp,PALETTESLD);
+		iowrite32(tmp,reg);
+		st->enable ? BIT_SET(tmp,LAYERENB) : BIT_CLR(tmp,LAYERENB);
+	}
+	if(st->mask & LAYER_FORMAT) {
+		tmp &= ~(0xFFFF<<FORMAT);
+		tmp |= (st->format<<FORMAT);
+	}
+	if(st->mask & LAYER_BLEND)
+		st->blend ? BIT_SET(tmp,BLENDENB) : BIT_CLR(tmp,BLENDENB);
+	if(st->mask & LAYER_TRANSP)
+		st->transp ? BIT_SET(tmp,TPENB) : BIT_CLR(tmp,TPENB);
+	if(st->mask & LAYER_DIRTY)
+		BIT_SET(tmp,DIRTYFLAG);
+	if(st->mask & (LAYER_ENABLE|LAYER_FORMAT|LAYER_BLEND|LAYER_TRANSP|
+		       LAYER_DIRTY))
+		iowrite32(tmp,reg);
+	spin_unlock_irqrestore(mlc_lock, flags);
+	return 0;
+}
+
+int mlc_GetLayerState(struct layer_state_cmd *st)
+{
+	u8 layer = st->layer;
+	u32 tmp;
+	int val;
+
+	if(layer >= MLC_NUM_LAYERS)
 		return -EINVAL;
-	iowrite32(addr, mlcregs+MLCADDRESSCR);
+
+	tmp = mlc_layer_read(mlcregs, layer, MLC_REG_CONTROL);
+	st->enable = IS_SET(tmp,LAYERENB) ? 1 : 0;
+	st->blend = IS_SET(tmp,BLENDENB) ? 1 : 0;
+	mlc_GetAddress(layer, &val);
+	st->address = val;
+	st->vstride = mlc_GetVStride(layer);
+	mlc_GetPosition(layer, (struct mlc_layer_position *)&st->position);
+	/* the registers hold inclusive edges, the state exclusive ones */
+	st->position.right++;
+	st->position.bottom++;
+	st->alpha = mlc_GetTransparencyAlpha(layer);
+	st->mask = LAYER_ENABLE|LAYER_ADDRESS|LAYER_VSTRIDE|LAYER_POSITION|
+		   LAYER_ALPHA|LAYER_BLEND;
+
+	/* the video layer sizes aren't in the registers, see the ioctls */
+	if(layer == MLC_VIDEO_LAYER)
+		return 0;
+
+	st->format = (tmp & (0xFFFF<<FORMAT))>>FORMAT;
+	st->transp = IS_SET(tmp,TPENB) ? 1 : 0;
+	st->hstride = mlc_GetHStride(layer);
+	mlc_GetTransparencyColor(layer, &val);
+	st->tpcolor = val;
+	st->mask |= LAYER_RGB_ONLY;
+	return 0;
+}
+
+/* from the stored top left corner to the one the MLC starts at */
+s32 mlc_OrientOffset(struct orient_cmd *oc)
+{
+	return orient_offset(oc);
+}
+
+int mlc_SetOrientation(struct orient_cmd *oc)
+{
+	int ret = orient_check(oc);
+
+	if(ret < 0)
+		return ret;
+	mlc_layer_orient(mlcregs, oc);
+	mlc_SetDirtyFlag(oc->layer);
 	return 0;
 }
 
@@ -1626,6 +2239,16 @@ void dpc_SetDPCEnable(u8 en)
 	iowrite16(tmp,base+DPCCTRL0);
 }
 
+void dpc_SetInterruptEnable(u8 en)
+{
+	void *base = dpcregs;
+	u16 tmp = ioread16(base+DPCCTRL0);
+
+	BIT_CLR(tmp,_INTPEND);
+	en ? BIT_SET(tmp,_INTENB) : BIT_CLR(tmp,_INTENB);
+	iowrite16(tmp,base+DPCCTRL0);
+}
+
 int dpc_SetMode(u8 format,
 		u8 interlace,
 		u8 invert_field,
@@ -1734,6 +2357,27 @@ void dpc_SetVSyncOffset(u16 vss_off, u16 vse_off, u16 evss_off, u16 evse_off)
 	iowrite16(evss_off,dpcregs+DPCEVSSOFFSET);
 }
 
+/* sync totals from a precomputed image, see SYNC_IMAGE() */
+void dpc_SetSyncImage(const struct lf1000fb_sync_image *h,
+		      const struct lf1000fb_sync_image *v,
+		      const struct lf1000fb_sync_image *ev)
+{
+	void *base = dpcregs;
+
+	iowrite16(h->total,base+DPCHTOTAL);
+	iowrite16(h->swidth,base+DPCHSWIDTH);
+	iowrite16(h->astart,base+DPCHASTART);
+	iowrite16(h->aend,base+DPCHAEND);
+	iowrite16(v->total,base+DPCVTOTAL);
+	iowrite16(v->swidth,base+DPCVSWIDTH);
+	iowrite16(v->astart,base+DPCVASTART);
+	iowrite16(v->aend,base+DPCVAEND);
+	iowrite16(ev->total,base+DPCEVTOTAL);
+	iowrite16(ev->swidth,base+DPCEVSWIDTH);
+	iowrite16(ev->astart,base+DPCEVASTART);
+	iowrite16(ev->aend,base+DPCEVAEND);
+}
+
 int dpc_SetDelay(u8 rgb, u8 hs, u8 vs, u8 de, u8 lp, u8 sp, u8 rev)
 {
 	void *base = dpcregs;
@@ -1817,12 +2461,12 @@ void dpc_SetEncoderMode(u8 fmt, u8 ped)
 	void *base = dpcregs;
 	u16 tmp;
 
-	/* NTSC mode with pedestal */
+	/* video standard and pedestal */
 	tmp = ioread16(base+VENCCTRLA);
 	BIT_SET(tmp,6);
-	BIT_CLR(tmp,5);
-	BIT_CLR(tmp,4);
-	BIT_SET(tmp,3);
+	tmp &= ~(0x3<<VENCFMT);
+	tmp |= ((fmt & 0x3)<<VENCFMT);
+	ped ? BIT_SET(tmp,VENCPED) : BIT_CLR(tmp,VENCPED);
 	iowrite16(tmp,base+VENCCTRLA);
 }
 
@@ -1893,8 +2537,14 @@ void dpc_SetEncoderUpscaler(u16 src, u16 dst)
 
 static void enable_tvout_mlc(struct fb_info *info)
 {
-	int i, ret, format, hstride, vstride, locksize;	
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	struct fb_var_screeninfo *var = &info->var;
+	int i, ret, format, hstride, vstride, locksize, address;
 	
+	/* the TV framebuffer owns the TV layers, only the MLC is brought up */
+	if(fbi->tv_extended)
+		var = &fbi->tv->fb.var;
+	mlc_GetAddress(0, &address);
 	mlc_GetFormat(0, &format);
 	mlc_GetLockSize(0, &locksize);
 	hstride = mlc_GetHStride(0);
@@ -1902,12 +2552,14 @@ static void enable_tvout_mlc(struct fb_info *info)
 		/* 2nd MLC for 2nd DPC to TV out */
 	mlcregs += 0x400;
 	mlc_SetClockMode(PCLKMODE_ONLYWHENCPUACCESS, BCLKMODE_DYNAMIC);
-	mlc_SetScreenSize(info->var.xres, info->var.yres);
+	mlc_SetScreenSize(var->xres, var->yres);
 	ret = mlc_SetLayerPriority(DISPLAY_VID_LAYER_PRIORITY);
 	if(ret < 0)
 		printk(KERN_ALERT "mlc: failed to set layer priority %08X\n",
 			   DISPLAY_VID_LAYER_PRIORITY);
 	mlc_SetFieldEnable(0);
+	if(fbi->tv_extended)
+		goto mlc_enable;
 //printk(KERN_INFO "lf1000fb-TVOut: setting addresses\n");
 	for(i = 0; i < MLC_NUM_LAYERS; i++) {
 	//mlc_SetAddress(i, mlc_fb_addr+fboffset[i]);
@@ -1915,7 +2567,7 @@ static void enable_tvout_mlc(struct fb_info *info)
 //printk(KERN_INFO "lf1000fb-TVOut: setting addresses: layer: %d address %x\n", i, mlc_fb_addr);
 	}
 //msleep(4000);
-	//mlc_SetAddress(0, mlc_fb_addr);
+	mlc_SetAddress(0, address);
 //printk(KERN_INFO "lf1000fb-TVOut: set format to: %x\n", format);
 	mlc_SetFormat(0, format);
 //msleep(4000);
@@ -1932,16 +2584,100 @@ static void enable_tvout_mlc(struct fb_info *info)
 	mlc_SetDirtyFlag(0);
 //printk(KERN_INFO "lf1000fb-TVOut: layer 0 dirtyflag set \n");
 //msleep(4000);
+mlc_enable:
 	mlc_SetBackground(0xFFFFFF);
 	mlc_SetMLCEnable(1);
 	mlc_SetTopDirtyFlag();
 //printk(KERN_INFO "lf1000fb-TVOut: top dirtyflag set \n");
 //msleep(4000);
 	mlcregs -= 0x400;
+	if(fbi->tv_extended)
+		tv_program(fbi->tv);
 }
-static void enable_tvout_dpc(struct fb_info *info)
-{	
-		int i, ret, format, hstride, vstride;	
+/*
+ * TV out profiles.  The DPC runs at 13.5MHz (27MHz XTI / 2) for either
+ * standard; NTSC lines are 858 clocks, PAL lines 864.
+ */
+static const struct lf1000fb_tvout_profile tvout_profiles[TVOUT_NUM_STANDARDS] = {
+	[TVOUT_NTSC] = {
+		.name		= "NTSC",
+		.width		= 720,
+		.hsync		= SYNC_IMAGE(720, 33, 24, 81),
+		.vsync		= SYNC_IMAGE(240, 3, 3, 16),
+		.evsync		= SYNC_IMAGE(240, 3, 4, 16),
+		.venc_fmt	= VENC_FMT_NTSC,
+		.venc_ped	= 1,
+		.venc		= VENC_IMAGE(64, 1716, 0, 3),
+	},
+	[TVOUT_PAL] = {
+		.name		= "PAL",
+		.width		= 720,
+		.hsync		= SYNC_IMAGE(720, 63, 12, 69),
+		.vsync		= SYNC_IMAGE(288, 3, 2, 19),
+		.evsync		= SYNC_IMAGE(288, 3, 3, 19),
+		.venc_fmt	= VENC_FMT_PAL,
+		.venc_ped	= 0,
+		.venc		= VENC_IMAGE(64, 1728, 0, 3),
+	},
+};
+
+/* horizontal upscaler settings for the usual source widths */
+static const struct lf1000fb_upscale_image tvout_upscalers[] = {
+	UPSCALE_IMAGE(320, 720),
+	UPSCALE_IMAGE(360, 720),
+	UPSCALE_IMAGE(640, 720),
+	UPSCALE_IMAGE(720, 720),
+};
+
+static void tvout_write_sync(const struct lf1000fb_tvout_profile *p)
+{
+	void *base = dpcregs;
+	u16 tmp;
+
+	dpc_SetSyncImage(&p->hsync, &p->vsync, &p->evsync);
+
+	/* both syncs active low */
+	tmp = ioread16(base+DPCCTRL0);
+	BIT_CLR(tmp,_INTPEND);
+	BIT_CLR(tmp,POLHSYNC);
+	BIT_CLR(tmp,POLVSYNC);
+	iowrite16(tmp,base+DPCCTRL0);
+}
+
+static void tvout_write_encoder(const struct lf1000fb_tvout_profile *p)
+{
+	void *base = dpcregs;
+
+	dpc_SetEncoderMode(p->venc_fmt, p->venc_ped);
+	iowrite16(p->venc.hsvs0,base+VENCHSVS0);
+	iowrite16(p->venc.hsos,base+VENCHSOS);
+	iowrite16(p->venc.hsoe,base+VENCHSOE);
+	iowrite16(p->venc.vsos,base+VENCVSOS);
+	iowrite16(p->venc.vsoe,base+VENCVSOE);
+}
+
+static void tvout_write_upscaler(const struct lf1000fb_tvout_profile *p,
+				 u16 src)
+{
+	void *base = dpcregs;
+	int i;
+
+	for(i = 0; i < ARRAY_SIZE(tvout_upscalers); i++) {
+		if(tvout_upscalers[i].src == src && p->width == 720) {
+			iowrite16(tvout_upscalers[i].con2,base+DPUPSCALECON2);
+			iowrite16(tvout_upscalers[i].con1,base+DPUPSCALECON1);
+			iowrite16(tvout_upscalers[i].con0,base+DPUPSCALECON0);
+			return;
+		}
+	}
+	dpc_SetEncoderUpscaler(src, p->width);
+}
+
+static void tvout_dpc_setup(struct fb_info *info)
+{
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	int ret;
+
 	/* 2nd DPC register set for TV out */
 	dpcregs += 0x400;
 	dpc_SetClockPClkMode(PCLKMODE_ONLYWHENCPUACCESS);
@@ -1967,189 +2703,2511 @@ static void enable_tvout_dpc(struct fb_info *info)
 	if(ret < 0)
 		printk(KERN_ALERT "dpc: failed to set display mode\n");
 	dpc_SetDither(DITHER_BYPASS, DITHER_BYPASS, DITHER_BYPASS);
-	ret = dpc_SetHSync(720, /* active horizontal */
-	  		   33, 	/* sync width */
-			   24, 	/* front porch */
-		  	   81, 	/* back porch */
-		  	   0); 	/* polarity */
-	if(ret < 0)
-		printk(KERN_ALERT "dpc: failed to set HSync\n");
-	ret = dpc_SetVSync(240, /* active odd field */
-		  	   3, 	/* sync width */
-		  	   3, 	/* front porch */
-		  	   16, 	/* back porch */
-		  	   0, 	/* polarity */
-		  	   240, /* active even field */
-		  	   3, 	/* sync width */
-		  	   4, 	/* front porch */
-		  	   16); /* back porch */
-	if(ret < 0)
-		printk(KERN_ALERT "dpc: failed to set VSync\n");
+	tvout_write_sync(fbi->tvout_profile);
 	dpc_SetDelay(0, 4, 4, 4, 4, 4, 4);
 	dpc_SetVSyncOffset(0, 0, 0, 0);
+	dpcregs -= 0x400;
+}
+
+/* one step of dpc_ResetEncoder(), the caller sleeps between steps */
+static void tvout_encoder_reset_step(int step)
+{
+	dpcregs += 0x400;
+	switch(step) {
+		case 0:
+		dpc_SetEncoderEnable(1);
+		break;
+		case 1:
+		dpc_SetClockEnable(1);
+		break;
+		case 2:
+		dpc_SetEncoderEnable(0);
+		break;
+		case 3:
+		dpc_SetClockEnable(0);
+		break;
+		case 4:
+		dpc_SetEncoderEnable(1);
+		break;
+	}
+	dpcregs -= 0x400;
+}
+
+static void tvout_encoder_setup(struct fb_info *info)
+{
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+
+	/* Internal video encoder for TV out */
+	dpcregs += 0x400;
+	dpc_SetEncoderEnable(1);
+	dpc_SetEncoderPowerDown(1);
+	dpc_SetEncoderFSCAdjust(0);
+	dpc_SetEncoderBandwidth(0, 0);
+	dpc_SetEncoderColor(0, 0, 0, 0, 0);
+	tvout_write_encoder(fbi->tvout_profile);
+	tvout_write_upscaler(fbi->tvout_profile, info->var.xres);
+	dpc_SetEncoderPowerDown(0);
+	dpcregs -= 0x400;
+}
+
+static void tvout_dpc_start(struct fb_info *info)
+{
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	unsigned long flags;
+
+	/* 2nd DPC is master when running TV + LCD out */
+	dpcregs += 0x400;
+	dpc_SetDPCEnable(1);
+	dpc_SetClockEnable(1);
+	if(fbi->irq >= 0) {
+		/* interlaced, so one interrupt per field */
+		spin_lock_irqsave(&fbi->lock, flags);
+		fbi->field_count = 0;
+		fbi->field_time = ktime_set(0, 0);
+		fbi->field_miss = 0;
+		fbi->field_irq = 1;
+		spin_unlock_irqrestore(&fbi->lock, flags);
+		dpc_SetInterruptEnable(1);
+	}
+	dpcregs -= 0x400;
+}
+
+static void enable_tvout_dpc(struct fb_info *info)
+{
+	tvout_dpc_setup(info);
+	dpcregs += 0x400;
+	dpc_ResetEncoder();
+	dpcregs -= 0x400;
+	tvout_encoder_setup(info);
+	tvout_dpc_start(info);
+}
+
+static void disable_tvout()
+{
+	mlcregs += 0x400;
+	mlc_SetLayerEnable(0, false);
+	mlc_SetDirtyFlag(0);
+	mlc_SetMLCEnable(0);
+	mlc_SetTopDirtyFlag();
+	mlcregs -= 0x400;
+	dpcregs += 0x400;
+	dpc_SetEncoderPowerDown(1);
+	dpc_SetEncoderEnable(0);
+	dpc_SetClockEnable(0); // CLKENB : Provides internal operating clock.
+	dpc_SetDPCEnable(0);
+	dpcregs -= 0x400;
+}
+
+/*
+ * Framebuffer memory access
+ *
+ * The fb memory is mapped uncached, and memcpy_fromio()/memcpy_toio()
+ * move it a byte at a time on ARM.  These move aligned 32-byte blocks
+ * of words instead, which the compiler turns into ldm/stm bursts.
+ * Setting debugfs lf1000fb/rw_bytewise goes back to the byte copies,
+ * for tools/rwbench to compare.
+ */
+
+static u32 rw_bytewise;
+
+static void fb_copy_toio(void __iomem *dst, const void *src, size_t n)
+{
+	u8 __iomem *d = dst;
+	const u8 *s = src;
+
+	if(rw_bytewise || (((unsigned long)d ^ (unsigned long)s) & 3)) {
+		memcpy_toio(d, s, n);
+		return;
+	}
+	for(; n && ((unsigned long)d & 3); n--)
+		__raw_writeb(*s++, d++);
+	for(; n >= 32; n -= 32, d += 32, s += 32) {
+		u32 *dw = (u32 __force *)d;
+		const u32 *sw = (const u32 *)s;
+
+		dw[0] = sw[0]; dw[1] = sw[1]; dw[2] = sw[2]; dw[3] = sw[3];
+		dw[4] = sw[4]; dw[5] = sw[5]; dw[6] = sw[6]; dw[7] = sw[7];
+	}
+	for(; n >= 4; n -= 4, d += 4, s += 4)
+		__raw_writel(*(const u32 *)s, d);
+	for(; n; n--)
+		__raw_writeb(*s++, d++);
+}
+
+static void fb_copy_fromio(void *dst, const void __iomem *src, size_t n)
+{
+	const u8 __iomem *s = src;
+	u8 *d = dst;
+
+	if(rw_bytewise || (((unsigned long)d ^ (unsigned long)s) & 3)) {
+		memcpy_fromio(d, s, n);
+		return;
+	}
+	for(; n && ((unsigned long)s & 3); n--)
+		*d++ = __raw_readb(s++);
+	for(; n >= 32; n -= 32, d += 32, s += 32) {
+		const u32 *sw = (const u32 __force *)s;
+		u32 *dw = (u32 *)d;
+
+		dw[0] = sw[0]; dw[1] = sw[1]; dw[2] = sw[2]; dw[3] = sw[3];
+		dw[4] = sw[4]; dw[5] = sw[5]; dw[6] = sw[6]; dw[7] = sw[7];
+	}
+	for(; n >= 4; n -= 4, d += 4, s += 4)
+		*(u32 *)d = __raw_readl(s);
+	for(; n; n--)
+		*d++ = __raw_readb(s++);
+}
+
+static int rw_rect_fits(struct fb_var_screeninfo *var, struct rect_cmd *r)
+{
+	return r->width <= var->xres_virtual &&
+	       r->x <= var->xres_virtual - r->width &&
+	       r->height != 0 && r->height <= var->yres_virtual &&
+	       r->y <= var->yres_virtual - r->height;
+}
+
+/*
+ * The window can be changed by another opener while a read() or write()
+ * is in progress, so each call works on its own copy.  A window left
+ * behind by a mode change that shrank the screen falls back to linear.
+ */
+static void rw_window(struct lf1000fb_info *fbi, struct rect_cmd *r)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	*r = fbi->rw_rect;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	if(r->width && !rw_rect_fits(&fbi->fb.var, r))
+		r->width = 0;
+}
+
+/*
+ * Map a read()/write() file offset to fb memory.  Without a window the
+ * offset is linear; with one it indexes the window packed line after
+ * line, and *len is clipped to the end of the current line.
+ */
+static void __iomem *rw_addr(struct lf1000fb_info *fbi, struct rect_cmd *r,
+			     unsigned long p, size_t *len)
+{
+	struct fb_info *info = &fbi->fb;
+	unsigned long line;
+
+	if(r->width == 0)
+		return info->screen_base + p;
+
+	line = r->width*(info->var.bits_per_pixel/8);
+	*len = min_t(size_t, *len, line - p % line);
+	return info->screen_base + (r->y + p/line)*info->fix.line_length +
+	       r->x*(info->var.bits_per_pixel/8) + p % line;
+}
+
+static unsigned long rw_size(struct lf1000fb_info *fbi, struct rect_cmd *r)
+{
+	struct fb_info *info = &fbi->fb;
+
+	if(r->width == 0)
+		return info->screen_size;
+	return r->width*(info->var.bits_per_pixel/8)*r->height;
+}
+
+static int lf1000fb_set_rw_rect(struct lf1000fb_info *fbi, struct rect_cmd *r)
+{
+	unsigned long flags;
+
+	if(r->width && !rw_rect_fits(&fbi->fb.var, r))
+		return -EINVAL;
+	spin_lock_irqsave(&fbi->lock, flags);
+	fbi->rw_rect = *r;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+static ssize_t lf1000fb_read(struct fb_info *info, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	unsigned long p = *ppos;
+	unsigned long total;
+	struct rect_cmd r;
+	void __iomem *src;
+	ssize_t done = 0;
+	size_t n;
+	u8 *bounce;
+
+	rw_window(fbi, &r);
+	total = rw_size(fbi, &r);
+	if(p >= total)
+		return 0;
+	if(count > total - p)
+		count = total - p;
+
+	bounce = kmalloc(min_t(size_t, count, PAGE_SIZE), GFP_KERNEL);
+	if(bounce == NULL)
+		return -ENOMEM;
+
+	while(count) {
+		n = min_t(size_t, count, PAGE_SIZE);
+		src = rw_addr(fbi, &r, p, &n);
+		fb_copy_fromio(bounce, src, n);
+		if(copy_to_user(buf, bounce, n)) {
+			if(!done)
+				done = -EFAULT;
+			break;
+		}
+		buf += n;
+		p += n;
+		count -= n;
+		done += n;
+	}
+
+	*ppos = p;
+	kfree(bounce);
+	return done;
+}
+
+static ssize_t lf1000fb_write(struct fb_info *info, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	unsigned long p = *ppos;
+	unsigned long total;
+	struct rect_cmd r;
+	void __iomem *dst;
+	ssize_t done = 0;
+	int err = 0;
+	size_t n;
+	u8 *bounce;
+
+	/* the fb core doesn't hold the lock around write() */
+	if(!lock_fb_info(info))
+		return -ENODEV;
+	err = lf1000fb_access(fbi, ACCESS_GLOBAL);
+	unlock_fb_info(info);
+	if(err < 0)
+		return err;
+
+	rw_window(fbi, &r);
+	total = rw_size(fbi, &r);
+	if(p > total)
+		return -EFBIG;
+	if(count > total - p) {
+		err = -ENOSPC;
+		count = total - p;
+	}
+	if(count == 0)
+		return err;
+
+	bounce = kmalloc(min_t(size_t, count, PAGE_SIZE), GFP_KERNEL);
+	if(bounce == NULL)
+		return -ENOMEM;
+
+	while(count) {
+		n = min_t(size_t, count, PAGE_SIZE);
+		dst = rw_addr(fbi, &r, p, &n);
+		if(copy_from_user(bounce, buf, n)) {
+			err = -EFAULT;
+			break;
+		}
+		fb_copy_toio(dst, bounce, n);
+		buf += n;
+		p += n;
+		count -= n;
+		done += n;
+	}
+
+	*ppos = p;
+	kfree(bounce);
+	return done ? done : err;
+}
+
+/*
+ * Does a rectangle of height lines of len bytes fit in the fb memory.
+ * Lines may not overlap, which also bounds height by the fb size.
+ */
+static int rect_in_fb(u32 offset, u32 stride, u32 len, u32 height)
+{
+	u64 end;
+
+	if(len == 0 || height == 0 || (height > 1 && stride < len))
+		return 0;
+	end = (u64)offset + (u64)(height-1)*stride + len;
+	return end <= mlc_fb_size;
+}
+
+static int lf1000fb_convert_rect(struct lf1000fb_info *fbi,
+				 struct convert_cmd *c)
+{
+	struct lf1000fb_convert cv;
+	u8 *sbuf, *dbuf;
+	u32 slen, dlen;
+	int ret, y;
+
+	ret = convert_init(&cv, c->src_format, c->src_bpp, c->dst_format,
+			   c->dst_bpp, c->flags);
+	if(ret < 0)
+		return ret;
+	if(c->width == 0 || c->height == 0)
+		return 0;
+	if(c->width > CONVERT_MAX_WIDTH)
+		return -EINVAL;
+
+	slen = c->width*cv.sf->bpp;
+	dlen = c->width*cv.df->bpp;
+	if(!rect_in_fb(c->src_offset, c->src_stride, slen, c->height) ||
+	   !rect_in_fb(c->dst_offset, c->dst_stride, dlen, c->height))
+		return -EINVAL;
+
+	/* lines go through cached buffers so the uncached fb sees bursts */
+	sbuf = kmalloc(2*c->width*4, GFP_KERNEL);
+	if(sbuf == NULL)
+		return -ENOMEM;
+	dbuf = sbuf + c->width*4;
+
+	for(y = 0; y < c->height; y++) {
+		fb_copy_fromio(sbuf, fbi->fbmem + c->src_offset + y*c->src_stride,
+			       slen);
+		cv.row(&cv, sbuf, dbuf, c->width, y);
+		fb_copy_toio(fbi->fbmem + c->dst_offset + y*c->dst_stride, dbuf,
+			     dlen);
+		if((y & 15) == 15)
+			cond_resched();
+	}
+
+	kfree(sbuf);
+	return 0;
+}
+
+/*
+ * Pin the user pages under [start, end) and map them contiguously, so
+ * the converter reads the image where the application left it.
+ */
+static void *blit_pin(unsigned long start, unsigned long end,
+		      struct page ***pagesp, int *npagesp)
+{
+	unsigned long first = start & PAGE_MASK;
+	int npages = (PAGE_ALIGN(end) - first) >> PAGE_SHIFT;
+	struct page **pages;
+	void *vaddr;
+	int i, got;
+
+	if(npages > BLIT_MAX_PAGES)
+		return ERR_PTR(-E2BIG);
+	pages = kmalloc(npages*sizeof(struct page *), GFP_KERNEL);
+	if(pages == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	down_read(&current->mm->mmap_sem);
+	got = get_user_pages(current, current->mm, first, npages, 0, 0,
+			     pages, NULL);
+	up_read(&current->mm->mmap_sem);
+	if(got < npages) {
+		for(i = 0; i < got; i++)
+			put_page(pages[i]);
+		kfree(pages);
+		return ERR_PTR(got < 0 ? got : -EFAULT);
+	}
+
+	vaddr = vmap(pages, npages, VM_MAP, PAGE_KERNEL);
+	if(vaddr == NULL) {
+		for(i = 0; i < npages; i++)
+			put_page(pages[i]);
+		kfree(pages);
+		return ERR_PTR(-ENOMEM);
+	}
+	*pagesp = pages;
+	*npagesp = npages;
+	return vaddr + (start - first);
+}
+
+static void blit_unpin(void *vaddr, struct page **pages, int npages)
+{
+	int i;
+
+	vunmap((void *)((unsigned long)vaddr & PAGE_MASK));
+	for(i = 0; i < npages; i++)
+		put_page(pages[i]);
+	kfree(pages);
+}
+
+static int lf1000fb_user_blit(struct lf1000fb_info *fbi,
+			      struct user_blit_cmd *b)
+{
+	struct lf1000fb_convert cv;
+	struct blit_rect *r;
+	struct page **pages;
+	u64 lo = ~0ULL, hi = 0, start, end, doff;
+	u8 *src, *dbuf = NULL;
+	u32 slen, dlen;
+	int npages, ret, i, y;
+
+	ret = convert_init(&cv, b->src_format, b->src_bpp, b->dst_format,
+			   b->dst_bpp, b->flags);
+	if(ret < 0)
+		return ret;
+	if(b->count == 0)
+		return 0;
+	if(b->count > BLIT_MAX_RECTS)
+		return -EINVAL;
+
+	/*
+	 * Only the span the rectangles cover gets pinned.  Offsets are
+	 * worked out in 64 bits so that no rectangle can wrap back into
+	 * the span and have the row loop read outside the mapping.
+	 */
+	for(i = 0; i < b->count; i++) {
+		r = &b->rects[i];
+		if(r->width == 0 || r->height == 0)
+			continue;
+		if(r->width > CONVERT_MAX_WIDTH)
+			return -EINVAL;
+		slen = r->width*cv.sf->bpp;
+		dlen = r->width*cv.df->bpp;
+		if(r->height > 1 && b->src_stride < slen)
+			return -EINVAL;
+		doff = (u64)b->dst_offset + (u64)r->dy*b->dst_stride +
+		       (u64)r->dx*cv.df->bpp;
+		if(doff >= mlc_fb_size ||
+		   !rect_in_fb(doff, b->dst_stride, dlen, r->height))
+			return -EINVAL;
+		start = (u64)r->sy*b->src_stride + (u64)r->sx*cv.sf->bpp;
+		end = start + (u64)(r->height-1)*b->src_stride + slen;
+		lo = min(lo, start);
+		hi = max(hi, end);
+	}
+	if(hi == 0)
+		return 0;
+	if(hi - lo > (u64)(BLIT_MAX_PAGES-1)*PAGE_SIZE)
+		return -E2BIG;
+	if((u64)b->src + hi > ULONG_MAX ||
+	   !access_ok(VERIFY_READ, b->src + (unsigned long)lo,
+		      (unsigned long)(hi - lo)))
+		return -EFAULT;
+
+	src = blit_pin(b->src + (unsigned long)lo, b->src + (unsigned long)hi,
+		       &pages, &npages);
+	if(IS_ERR(src))
+		return PTR_ERR(src);
+	src -= (unsigned long)lo;
+
+	/* a straight copy goes from the pinned pages to the fb in one pass */
+	if(cv.row != convert_row_copy) {
+		dbuf = kmalloc(CONVERT_MAX_WIDTH*4, GFP_KERNEL);
+		if(dbuf == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if(b->flags & BLIT_VSYNC) {
+		ret = lf1000fb_wait_vsync(fbi);
+		if(ret < 0)
+			goto out;
+	}
+
+	for(i = 0; i < b->count; i++) {
+		r = &b->rects[i];
+		/* not checked above, so not inside the pinned span either */
+		if(r->width == 0 || r->height == 0)
+			continue;
+		slen = r->width*cv.sf->bpp;
+		dlen = r->width*cv.df->bpp;
+		for(y = 0; y < r->height; y++) {
+			u8 *s = src + (r->sy + y)*b->src_stride +
+				r->sx*cv.sf->bpp;
+			void *d = fbi->fbmem + b->dst_offset +
+				  (r->dy + y)*b->dst_stride + r->dx*cv.df->bpp;
+
+			if(dbuf == NULL) {
+				fb_copy_toio(d, s, slen);
+			}
+			else {
+				cv.row(&cv, s, dbuf, r->width, r->dy + y);
+				fb_copy_toio(d, dbuf, dlen);
+			}
+			if((y & 15) == 15)
+				cond_resched();
+		}
+	}
+	ret = 0;
+out:
+	kfree(dbuf);
+	blit_unpin(src + (unsigned long)lo, pages, npages);
+	return ret;
+}
+
+/*
+ * Blit batches.  Every line goes through a cached line buffer, so the
+ * uncached fb memory only sees word bursts.
+ */
+
+/*
+ * ARGB8888 over RGB565 with alpha rounded to 5 bits.  The 565 fields are
+ * spread over one word with gaps between them, so a single multiply
+ * blends all three channels.
+ */
+static void blend_row_8888_565(const u8 *src, u8 *dst, int width)
+{
+	const u32 *s = (const u32 *)src;
+	u16 *d = (u16 *)dst;
+	u32 fg, bg, a;
+	int x;
+
+	for(x = 0; x < width; x++) {
+		a = s[x] >> 24;
+		if(a == 0)
+			continue;
+		fg = ((s[x]>>8) & 0xF800) | ((s[x]>>5) & 0x07E0) |
+		     ((s[x]>>3) & 0x001F);
+		if(a == 0xFF) {
+			d[x] = fg;
+			continue;
+		}
+		a = (a + 4) >> 3;
+		bg = d[x];
+		bg = (bg | (bg << 16)) & 0x07E0F81F;
+		fg = (fg | (fg << 16)) & 0x07E0F81F;
+		bg += (fg - bg)*a >> 5;
+		bg &= 0x07E0F81F;
+		d[x] = bg | (bg >> 16);
+	}
+}
+
+static void fill_row(u8 *dst, u32 color, u32 bpp, int width)
+{
+	int x;
+
+	switch(bpp) {
+		case 1:
+		memset(dst, color, width);
+		break;
+		case 2:
+		for(x = 0; x < width; x++)
+			((u16 *)dst)[x] = color;
+		break;
+		case 3:
+		for(x = 0; x < width; x++, dst += 3) {
+			dst[0] = color;
+			dst[1] = color >> 8;
+			dst[2] = color >> 16;
+		}
+		break;
+		default:
+		for(x = 0; x < width; x++)
+			((u32 *)dst)[x] = color;
+		break;
+	}
+}
+
+static int blit_op_check(struct blit_op *op)
+{
+	const struct lf1000fb_pixfmt *sf, *df;
+	u32 sbpp = op->src_bpp, dbpp = op->dst_bpp;
+
+	if(op->width > CONVERT_MAX_WIDTH)
+		return -EINVAL;
+	switch(op->op) {
+		case BLIT_OP_COPY:
+		if(dbpp == 0 || dbpp > 4)
+			return -EINVAL;
+		sbpp = dbpp;
+		break;
+
+		case BLIT_OP_FILL:
+		if(dbpp == 0 || dbpp > 4)
+			return -EINVAL;
+		sbpp = 0;
+		break;
+
+		case BLIT_OP_BLEND:
+		sf = pixfmt_find(op->src_format, 4);
+		df = pixfmt_find(op->dst_format, 2);
+		if(sf == NULL || sf->a_len != 8 || sf->r_off != 16 ||
+		   df == NULL || df->code != 0x4432)
+			return -EINVAL;
+		sbpp = 4;
+		dbpp = 2;
+		break;
+
+		case BLIT_OP_CONVERT:
+		if(pixfmt_find(op->src_format, sbpp) == NULL ||
+		   pixfmt_find(op->dst_format, dbpp) == NULL)
+			return -EINVAL;
+		break;
+
+		default:
+		return -EINVAL;
+	}
+	if(op->width == 0 || op->height == 0)
+		return 0;
+	/* also rejects a stride shorter than a row, so height stays bounded */
+	if(sbpp && !rect_in_fb(op->src_offset, op->src_stride,
+			       op->width*sbpp, op->height))
+		return -EINVAL;
+	if(!rect_in_fb(op->dst_offset, op->dst_stride, op->width*dbpp,
+		       op->height))
+		return -EINVAL;
+	return 0;
+}
+
+static int blit_op_run(struct lf1000fb_info *fbi, struct blit_op *op,
+		       u8 *sbuf, u8 *dbuf)
+{
+	struct convert_cmd cc;
+	u32 slen = op->width*op->src_bpp;
+	u32 dlen = op->width*op->dst_bpp;
+	void *src = fbi->fbmem + op->src_offset;
+	void *dst = fbi->fbmem + op->dst_offset;
+	int y, yy;
+
+	if(op->width == 0 || op->height == 0)
+		return 0;
+
+	switch(op->op) {
+		case BLIT_OP_COPY:
+		/* bottom up when the destination overlaps below the source */
+		for(yy = 0; yy < op->height; yy++) {
+			y = op->dst_offset > op->src_offset ?
+				op->height-1 - yy : yy;
+			fb_copy_fromio(sbuf, src + y*op->src_stride, dlen);
+			fb_copy_toio(dst + y*op->dst_stride, sbuf, dlen);
+			if((yy & 15) == 15)
+				cond_resched();
+		}
+		break;
+
+		case BLIT_OP_FILL:
+		fill_row(dbuf, op->color, op->dst_bpp, op->width);
+		for(y = 0; y < op->height; y++) {
+			fb_copy_toio(dst + y*op->dst_stride, dbuf, dlen);
+			if((y & 15) == 15)
+				cond_resched();
+		}
+		break;
+
+		case BLIT_OP_BLEND:
+		slen = op->width*4;
+		dlen = op->width*2;
+		for(y = 0; y < op->height; y++) {
+			fb_copy_fromio(sbuf, src + y*op->src_stride, slen);
+			fb_copy_fromio(dbuf, dst + y*op->dst_stride, dlen);
+			blend_row_8888_565(sbuf, dbuf, op->width);
+			fb_copy_toio(dst + y*op->dst_stride, dbuf, dlen);
+			if((y & 15) == 15)
+				cond_resched();
+		}
+		break;
+
+		case BLIT_OP_CONVERT:
+		cc.src_offset = op->src_offset;
+		cc.src_stride = op->src_stride;
+		cc.src_format = op->src_format;
+		cc.src_bpp = op->src_bpp;
+		cc.dst_offset = op->dst_offset;
+		cc.dst_stride = op->dst_stride;
+		cc.dst_format = op->dst_format;
+		cc.dst_bpp = op->dst_bpp;
+		cc.width = op->width;
+		cc.height = op->height;
+		cc.flags = op->flags;
+		return lf1000fb_convert_rect(fbi, &cc);
+	}
+	return 0;
+}
+
+/* the whole batch is checked before anything is drawn */
+static int lf1000fb_blit_list(struct lf1000fb_info *fbi,
+			      struct blit_list_cmd *bl)
+{
+	struct blit_op *ops;
+	u8 *sbuf;
+	int i, ret = 0;
+
+	if(bl->count == 0)
+		return 0;
+	if(bl->count > BLIT_MAX_OPS)
+		return -EINVAL;
+
+	ops = kmalloc(bl->count*sizeof(struct blit_op), GFP_KERNEL);
+	sbuf = kmalloc(2*CONVERT_MAX_WIDTH*4, GFP_KERNEL);
+	if(ops == NULL || sbuf == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if(copy_from_user(ops, (void __user *)bl->ops,
+			  bl->count*sizeof(struct blit_op))) {
+		ret = -EFAULT;
+		goto out;
+	}
+	for(i = 0; i < bl->count; i++) {
+		ret = blit_op_check(&ops[i]);
+		if(ret < 0)
+			goto out;
+	}
+	for(i = 0; i < bl->count && ret == 0; i++) {
+		ret = blit_op_run(fbi, &ops[i], sbuf,
+				  sbuf + CONVERT_MAX_WIDTH*4);
+		cond_resched();
+	}
+out:
+	kfree(sbuf);
+	kfree(ops);
+	return ret;
+}
+
+#ifdef LF1000FB_CONVERT_SELFTEST
+/* check every fast path against the generic converter */
+static void convert_selftest(void)
+{
+	struct lf1000fb_convert cv, ref;
+	const struct lf1000fb_pixfmt *sf, *df;
+	u8 *src, *out, *exp;
+	u32 used, i, seed = 1;
+	int s, d, fails = 0;
+
+	src = kmalloc(3*256*4, GFP_KERNEL);
+	if(src == NULL)
+		return;
+	out = src + 256*4;
+	exp = out + 256*4;
+
+	for(s = 0; s < ARRAY_SIZE(lf1000fb_formats); s++)
+	for(d = 0; d < ARRAY_SIZE(lf1000fb_formats); d++) {
+		sf = &lf1000fb_formats[s];
+		df = &lf1000fb_formats[d];
+		convert_init(&cv, sf->code, sf->bpp, df->code, df->bpp, 0);
+		if(cv.row == convert_row_generic)
+			continue;
+		ref = cv;
+		ref.row = convert_row_generic;
+		used = (BIT_MASK_ONES(df->r_len)<<df->r_off) |
+		       (BIT_MASK_ONES(df->g_len)<<df->g_off) |
+		       (BIT_MASK_ONES(df->b_len)<<df->b_off) |
+		       (BIT_MASK_ONES(df->a_len)<<df->a_off);
+
+		for(i = 0; i < 256*4; i++) {
+			seed = seed*1103515245 + 12345;
+			src[i] = seed>>16;
+		}
+		cv.row(&cv, src, out, 255, 0);
+		ref.row(&ref, src, exp, 255, 0);
+		for(i = 0; i < 255; i++)
+			if((pix_load(out+i*df->bpp, df->bpp) ^
+			    pix_load(exp+i*df->bpp, df->bpp)) & used) {
+				printk(KERN_ERR "lf1000fb: convert %04X/%d to "
+				       "%04X/%d differs\n", sf->code, sf->bpp,
+				       df->code, df->bpp);
+				fails++;
+				break;
+			}
+	}
+	printk(KERN_INFO "lf1000fb: convert selftest, %d failures\n", fails);
+	kfree(src);
+}
+#endif
+
+/*
+ * Vsync interrupt and asynchronous TV out
+ */
+
+/* write a layer address and set its dirty flag, IRQ context */
+static void flip_latch(void *mlc, int layer, u32 address)
+{
+	u32 tmp;
+
+	mlc_layer_write(mlc, layer, MLC_REG_ADDRESS, address);
+	tmp = mlc_layer_read(mlc, layer, MLC_REG_CONTROL);
+	BIT_SET(tmp,DIRTYFLAG);
+	mlc_layer_write(mlc, layer, MLC_REG_CONTROL, tmp);
+}
+
+static int flip_is_dirty(void *mlc, int layer)
+{
+	return IS_SET(mlc_layer_read(mlc, layer, MLC_REG_CONTROL),
+		      DIRTYFLAG) ? 1 : 0;
+}
+
+/*
+ * Called with fbi->lock held from the vsync interrupt, field 0, or from
+ * the TV field interrupt with the FLIP_FIELD_* about to be scanned.
+ */
+static void lf1000fb_service_flips(struct lf1000fb_info *fbi, int layer,
+				   u32 field)
+{
+	struct lf1000fb_flipq *q = &fbi->flipq[layer];
+	int tvout = tv_mirror(fbi);
+	struct lf1000fb_flip *f;
+	struct flip_done_cmd *d;
+	struct timeval tv;
+
+	if(q->inflight) {
+		/* the MLC clears the dirty flag once the address is in use */
+		if(flip_is_dirty(fbi->mlc_base, layer) ||
+		   (tvout && flip_is_dirty(fbi->mlc_base+0x400, layer)))
+			return;
+
+		f = &q->pending[q->head];
+		if(q->done_count == FLIP_DONE_LEN) { /* drop the oldest */
+			q->done_head = (q->done_head+1) % FLIP_DONE_LEN;
+			q->done_count--;
+		}
+		d = &q->done[(q->done_head+q->done_count) % FLIP_DONE_LEN];
+		tv = ktime_to_timeval(fbi->vblank_time);
+		d->layer = layer;
+		d->cookie = f->cookie;
+		d->address = f->address;
+		d->sequence = fbi->vblank_count & MLC_VBLANK_MASK;
+		d->sec = tv.tv_sec;
+		d->usec = tv.tv_usec;
+		q->done_count++;
+
+		q->retired_seq = f->seq;
+		q->head = (q->head+1) % FLIP_QUEUE_LEN;
+		q->count--;
+		q->inflight = 0;
+	}
+
+	if(q->count == 0)
+		return;
+
+	/* latch one vsync early, the MLC picks it up on the target vsync */
+	f = &q->pending[q->head];
+	/* targets are MLC_VBLANK_MASK counts, compared modulo 2^31 */
+	if((s32)((fbi->vblank_count+1 - f->target)<<1) < 0)
+		return;
+	/* field flips wait for their field while TV out runs */
+	if(tvout && fbi->field_irq && f->field) {
+		if(f->field != field)
+			return;
+	}
+	else if(field)
+		return;
+
+	flip_latch(fbi->mlc_base, layer, f->address);
+	if(tvout)
+		flip_latch(fbi->mlc_base+0x400, layer, f->address);
+	q->inflight = 1;
+}
+
+/*
+ * Move the sprite layer, clipping it to the screen.  Clipping at the left
+ * or top moves the start address into the image; a sprite that is fully
+ * off screen just has its layer switched off.
+ */
+static void sprite_latch(struct lf1000fb_info *fbi, void *mlc)
+{
+	struct lf1000fb_sprite *sp = &fbi->sprite;
+	int left = max(sp->x, 0);
+	int top = max(sp->y, 0);
+	int right = min(sp->x + sp->width, (int)fbi->fb.var.xres);
+	int bottom = min(sp->y + sp->height, (int)fbi->fb.var.yres);
+	u32 tmp = mlc_layer_read(mlc, SPRITE_LAYER, MLC_REG_CONTROL);
+
+	if(left >= right || top >= bottom) {
+		BIT_CLR(tmp,LAYERENB);
+	}
+	else {
+		/* palette power first, as in mlc_SetLayerEnable() */
+		if(IS_CLR(tmp,LAYERENB)) {
+			BIT_SET(tmp,PALETTEPWD);
+			mlc_layer_write(mlc, SPRITE_LAYER, MLC_REG_CONTROL, tmp);
+			BIT_SET(tmp,PALETTESLD);
+			mlc_layer_write(mlc, SPRITE_LAYER, MLC_REG_CONTROL, tmp);
+		}
+		BIT_SET(tmp,LAYERENB);
+		mlc_layer_write(mlc, SPRITE_LAYER, MLC_REG_ADDRESS,
+				sp->address + (top - sp->y)*sp->width*sp->bpp +
+				(left - sp->x)*sp->bpp);
+		mlc_layer_write(mlc, SPRITE_LAYER, MLC_REG_LEFTRIGHT,
+				(left<<LEFT)|((right-1)<<RIGHT));
+		mlc_layer_write(mlc, SPRITE_LAYER, MLC_REG_TOPBOTTOM,
+				(top<<TOP)|((bottom-1)<<BOTTOM));
+	}
+	BIT_SET(tmp,DIRTYFLAG);
+	mlc_layer_write(mlc, SPRITE_LAYER, MLC_REG_CONTROL, tmp);
+}
+
+/* called with fbi->lock held from the vsync interrupt */
+static void lf1000fb_service_anim(struct lf1000fb_info *fbi, int layer)
+{
+	struct lf1000fb_anim *a = &fbi->anim[layer];
+	struct anim_key k;
+
+	if(!a->running)
+		return;
+
+	if(anim_key_at(&a->track, fbi->vblank_count - a->start, &k))
+		a->running = 0;
+	if(a->track.flags & ANIM_SCALE) {
+		fbi->overlaysize.srcwidth = a->track.srcwidth;
+		fbi->overlaysize.srcheight = a->track.srcheight;
+		fbi->overlaysize.dstwidth = max_t(int, k.width, 2);
+		fbi->overlaysize.dstheight = max_t(int, k.height, 2);
+	}
+
+	anim_write(fbi->mlc_base, layer, &a->track, a->width, a->height, &k);
+	if(tv_mirror(fbi))
+		anim_write(fbi->mlc_base+0x400, layer, &a->track, a->width,
+			   a->height, &k);
+}
+
+/* new pixel clock divider after a PLL1 change, see lf1000fb_freq_transition */
+static void lcd_latch_divider(struct lf1000fb_info *fbi)
+{
+	u32 tmp = ioread32(fbi->dpc_base+DPCCLKGEN0);
+
+	tmp &= ~(0x3F<<CLKDIV0);
+	tmp |= ((fbi->lcd_div_pending & 0x3F)<<CLKDIV0);
+	iowrite32(tmp, fbi->dpc_base+DPCCLKGEN0);
+	fbi->lcd_div_pending = -1;
+}
+
+/* program one control page slot, IRQ context */
+static void ctl_apply(void *mlc, u32 layers, struct ctl_slot *slot)
+{
+	struct ctl_layer *l;
+	u32 tmp;
+	int i;
+
+	for(i = 0; i < MLC_NUM_LAYERS; i++) {
+		l = &slot->layer[i];
+		if(!(layers & (1<<i)) || !l->mask)
+			continue;
+		if(l->mask & CTL_ADDRESS)
+			mlc_layer_write(mlc, i, MLC_REG_ADDRESS, l->address);
+		if(l->mask & CTL_POSITION) {
+			mlc_layer_write(mlc, i, MLC_REG_LEFTRIGHT,
+					((l->left & 0x7FF)<<LEFT)|
+					(((l->right-1) & 0x7FF)<<RIGHT));
+			mlc_layer_write(mlc, i, MLC_REG_TOPBOTTOM,
+					((l->top & 0x7FF)<<TOP)|
+					(((l->bottom-1) & 0x7FF)<<BOTTOM));
+		}
+		if(l->mask & (CTL_ALPHA|CTL_TPCOLOR)) {
+			tmp = mlc_layer_read(mlc, i, MLC_REG_TPCOLOR);
+			if(l->mask & CTL_ALPHA) {
+				tmp &= ~(0xF<<ALPHA);
+				tmp |= (l->alpha & 0xF)<<ALPHA;
+			}
+			if((l->mask & CTL_TPCOLOR) && i != MLC_VIDEO_LAYER) {
+				tmp &= ~(0xFFFFFF<<TPCOLOR);
+				tmp |= (l->tpcolor & 0xFFFFFF)<<TPCOLOR;
+			}
+			mlc_layer_write(mlc, i, MLC_REG_TPCOLOR, tmp);
+		}
+		tmp = mlc_layer_read(mlc, i, MLC_REG_CONTROL);
+		BIT_SET(tmp,DIRTYFLAG);
+		mlc_layer_write(mlc, i, MLC_REG_CONTROL, tmp);
+	}
+}
+
+/*
+ * Pick up the newest complete slot of each control page, called with
+ * fbi->lock held from the vsync interrupt.  A slot whose seq doesn't
+ * match the published one is still being written and waits a frame.
+ * Layers the creator has since lost to another process are skipped.
+ */
+static void lf1000fb_service_ctl(struct lf1000fb_info *fbi)
+{
+	struct lf1000fb_ctl *c;
+	struct ctl_slot slot;
+	u32 seq, layers;
+	int i;
+
+	for(i = 0; i < CTL_MAX_PAGES; i++) {
+		c = fbi->ctl[i];
+		if(c == NULL)
+			continue;
+		seq = ACCESS_ONCE(c->page->seq);
+		if(seq == c->applied)
+			continue;
+		rmb();
+		memcpy(&slot, &c->page->slot[seq & 1], sizeof(slot));
+		rmb();
+		if(slot.seq != seq)
+			continue;
+		layers = c->layers & access_mask(fbi, c->tgid);
+		ctl_apply(fbi->mlc_base, layers, &slot);
+		if(tv_mirror(fbi))
+			ctl_apply(fbi->mlc_base+0x400, layers, &slot);
+		c->applied = seq;
+		ACCESS_ONCE(c->page->applied) = seq;
+	}
+}
+
+/*
+ * TV field interrupt, called with fbi->lock held.  Fields are counted
+ * from TV out start, which begins with an odd field; whatever is
+ * latched now is scanned in the next one.
+ */
+/*
+ * We have no documented DPC field status bit, but the two fields differ
+ * by a line (262 and 263 lines in NTSC, 312 and 313 in PAL), so the time
+ * since the last field interrupt tells which one has just ended.  After
+ * two such measurements in a row against the count, e.g. when an
+ * interrupt was lost, the count is stepped back into phase.  Intervals
+ * that match neither field, from a missed interrupt or long latency, are
+ * ignored.
+ */
+static void field_resync(struct lf1000fb_info *fbi)
+{
+	const struct lf1000fb_tvout_profile *p = fbi->tvout_profile;
+	ktime_t now = ktime_get();
+	s64 period = ktime_to_ns(ktime_sub(now, fbi->field_time));
+	int first = ktime_to_ns(fbi->field_time) == 0;
+	u32 line, odd, even;
+	int ended_odd;
+
+	fbi->field_time = now;
+	if(first)
+		return;
+	/* ns per line, the DPC runs at 13.5MHz */
+	line = (p->hsync.total+1)*2000/27;
+	odd = (p->vsync.total+1)*line;
+	even = (p->evsync.total+1)*line;
+	if(odd == even)
+		return;
+	if(period > odd - line/3 && period < odd + line/3)
+		ended_odd = 1;
+	else if(period > even - line/3 && period < even + line/3)
+		ended_odd = 0;
+	else
+		return;
+
+	/* an odd field ends on odd counts, then the even one is next */
+	if(ended_odd == (fbi->field_count & 1)) {
+		fbi->field_miss = 0;
+		return;
+	}
+	if(++fbi->field_miss < 2)
+		return;
+	fbi->field_count++;
+	fbi->field_miss = 0;
+}
+
+static void lf1000fb_service_field(struct lf1000fb_info *fbi)
+{
+	struct lf1000fb_field_pair *fp;
+	u32 next;
+	int i;
+
+	fbi->field_count++;
+	field_resync(fbi);
+	if(fbi->tv_extended) {
+		if(fbi->tv->pan_pending) {
+			flip_latch(fbi->mlc_base+0x400, 0, fbi->tv->pan_address);
+			fbi->tv->pan_pending = 0;
+		}
+		return;
+	}
+	next = (fbi->field_count & 1) ? FLIP_FIELD_EVEN : FLIP_FIELD_ODD;
+	for(i = 0; i < MLC_NUM_LAYERS; i++) {
+		fp = &fbi->field_pair[i];
+		if(fp->odd || fp->even)
+			flip_latch(fbi->mlc_base+0x400, i,
+				   next == FLIP_FIELD_ODD ? fp->odd : fp->even);
+		else
+			lf1000fb_service_flips(fbi, i, next);
+	}
+}
+
+static irqreturn_t lf1000fb_vsync_irq(int irq, void *dev_id)
+{
+	struct lf1000fb_info *fbi = dev_id;
+	u16 tmp = ioread16(fbi->dpc_base+DPCCTRL0);
+	u16 tv = fbi->field_irq ? ioread16(fbi->dpc_base+0x400+DPCCTRL0) : 0;
+	int i;
+
+	if(IS_CLR(tmp,_INTPEND) && IS_CLR(tv,_INTPEND))
+		return IRQ_NONE;
+
+	if(IS_SET(tv,_INTPEND)) {
+		iowrite16(tv, fbi->dpc_base+0x400+DPCCTRL0);
+		spin_lock(&fbi->lock);
+		lf1000fb_service_field(fbi);
+		spin_unlock(&fbi->lock);
+		if(IS_CLR(tmp,_INTPEND)) {
+			wake_up_interruptible_all(&fbi->vsync_wait);
+			return IRQ_HANDLED;
+		}
+	}
+	iowrite16(tmp, fbi->dpc_base+DPCCTRL0); /* write 1 to clear pending */
+
+	spin_lock(&fbi->lock);
+	fbi->vblank_count++;
+	fbi->vblank_time = ktime_get();
+	if(fbi->lcd_div_pending >= 0)
+		lcd_latch_divider(fbi);
+	for(i = 0; i < MLC_NUM_LAYERS; i++) {
+		lf1000fb_service_flips(fbi, i, 0);
+		lf1000fb_service_anim(fbi, i);
+	}
+	lf1000fb_service_ctl(fbi);
+	if(fbi->pan_pending) {
+		flip_latch(fbi->mlc_base, 0, fbi->pan_address);
+		if(tv_mirror(fbi))
+			flip_latch(fbi->mlc_base+0x400, 0, fbi->pan_address);
+		fbi->pan_pending = 0;
+	}
+	if(fbi->sprite.pending) {
+		sprite_latch(fbi, fbi->mlc_base);
+		if(tv_mirror(fbi))
+			sprite_latch(fbi, fbi->mlc_base+0x400);
+		fbi->sprite.pending = 0;
+	}
+	spin_unlock(&fbi->lock);
+
+	wake_up_interruptible_all(&fbi->vsync_wait);
+	return IRQ_HANDLED;
+}
+
+/* sleep until the next LCD vsync, or about a frame if we have no IRQ */
+static int lf1000fb_wait_vsync(struct lf1000fb_info *fbi)
+{
+	u32 count = fbi->vblank_count;
+
+	if(fbi->irq < 0) {
+		msleep(LF1000FB_FRAME_MS);
+		return 0;
+	}
+	if(!wait_event_timeout(fbi->vsync_wait, fbi->vblank_count != count,
+			       msecs_to_jiffies(4*LF1000FB_FRAME_MS)))
+		return -ETIMEDOUT;
+	return 0;
+}
+
+static void lf1000fb_tvout_work(struct work_struct *work)
+{
+	struct lf1000fb_info *fbi = container_of(to_delayed_work(work),
+					struct lf1000fb_info, tvout_work);
+	struct fb_info *info = &fbi->fb;
+	unsigned long delay = 0;
+
+	if(!lock_fb_info(info))
+		return;
+
+	/*
+	 * Both switch-overs happen on a frame boundary of the LCD.  The wait
+	 * is under the fb lock, so an ioctl can't slip in between the vsync
+	 * and the switch and push it out of the blanking interval.
+	 */
+	if(fbi->tvout_step == TVOUT_SWITCH || fbi->tvout_step == TVOUT_SHUTDOWN)
+		if(lf1000fb_wait_vsync(fbi) < 0)
+			printk(KERN_WARNING "lf1000fb: no vsync for TV out switch\n");
+
+	switch(fbi->tvout_step) {
+		case TVOUT_DPC_SETUP:
+		tvout_dpc_setup(info);
+		fbi->tvout_reset_step = 0;
+		fbi->tvout_step = TVOUT_ENC_RESET;
+		break;
+
+		case TVOUT_ENC_RESET:
+		/* replaces the udelay(100) calls of dpc_ResetEncoder() */
+		tvout_encoder_reset_step(fbi->tvout_reset_step);
+		if(++fbi->tvout_reset_step == TVOUT_ENC_RESET_STEPS)
+			fbi->tvout_step = TVOUT_ENC_SETUP;
+		delay = 1;
+		break;
+
+		case TVOUT_ENC_SETUP:
+		tvout_encoder_setup(info);
+		fbi->tvout_step = TVOUT_SWITCH;
+		break;
+
+		case TVOUT_SWITCH:
+		tvout_dpc_start(info);
+		enable_tvout_mlc(info);
+		info->var.reserved[0] = 1;
+		fbi->tvout_step = TVOUT_IDLE;
+		fbi->tvout_status = TVOUT_STATUS_ON;
+		break;
+
+		case TVOUT_SHUTDOWN:
+		disable_tvout();
+		spin_lock_irq(&fbi->lock);
+		fbi->field_irq = 0;
+		memset(fbi->field_pair, 0, sizeof(fbi->field_pair));
+		spin_unlock_irq(&fbi->lock);
+		fbi->tvout_step = TVOUT_IDLE;
+		fbi->tvout_status = TVOUT_STATUS_OFF;
+		break;
+
+		default:
+		break;
+	}
+
+	if(fbi->tvout_step != TVOUT_IDLE)
+		queue_delayed_work(fbi->wq, &fbi->tvout_work, delay);
+	unlock_fb_info(info);
+}
+
+/* static sprite setup, on the MLC currently selected by mlcregs */
+static void sprite_program(struct sprite_cmd *sc)
+{
+	u8 layer = SPRITE_LAYER;
+
+	mlc_SetFormat(layer, sc->format);
+	mlc_SetHStride(layer, sc->bpp);
+	mlc_SetVStride(layer, sc->width*sc->bpp);
+	mlc_SetTransparencyColor(layer, sc->tpcolor);
+	mlc_SetTransparencyEnable(layer, (sc->flags & SPRITE_COLORKEY) ? 1 : 0);
+	mlc_SetTransparencyAlpha(layer, sc->alpha);
+	mlc_SetBlendEnable(layer, (sc->flags & SPRITE_ALPHA) ? 1 : 0);
+	/* LAYERENB is left to sprite_latch(), with address and position */
+}
+
+static int lf1000fb_set_sprite(struct lf1000fb_info *fbi, struct sprite_cmd *sc)
+{
+	struct lf1000fb_sprite *sp = &fbi->sprite;
+	int tvout_enable = tv_mirror(fbi);
+	const struct lf1000fb_pixfmt *pf;
+	unsigned long flags;
+
+	if(!(sc->flags & SPRITE_ENABLE)) {
+		spin_lock_irqsave(&fbi->lock, flags);
+		sp->enabled = 0;
+		sp->pending = 0;
+		spin_unlock_irqrestore(&fbi->lock, flags);
+		mlc_SetLayerEnable(SPRITE_LAYER, 0);
+		mlc_SetDirtyFlag(SPRITE_LAYER);
+		if(tvout_enable) {
+			mlcregs += 0x400;
+			mlc_SetLayerEnable(SPRITE_LAYER, 0);
+			mlc_SetDirtyFlag(SPRITE_LAYER);
+			mlcregs -= 0x400;
+		}
+		return 0;
+	}
+
+	pf = pixfmt_find(sc->format, sc->bpp);
+	if(pf == NULL || sc->width == 0 || sc->height == 0 ||
+	   sc->width > fbi->fb.var.xres || sc->height > fbi->fb.var.yres)
+		return -EINVAL;
+	if(sc->x < -SPRITE_POS_MAX || sc->x > SPRITE_POS_MAX ||
+	   sc->y < -SPRITE_POS_MAX || sc->y > SPRITE_POS_MAX)
+		return -EINVAL;
+	if(fbi->irq < 0)
+		return -ENODEV;
+	sc->bpp = pf->bpp;
+
+	sprite_program(sc);
+	if(tvout_enable) {
+		mlcregs += 0x400;
+		sprite_program(sc);
+		mlcregs -= 0x400;
+	}
+
+	/* address and position go out with the next vsync */
+	spin_lock_irqsave(&fbi->lock, flags);
+	sp->address = sc->address;
+	sp->width = sc->width;
+	sp->height = sc->height;
+	sp->bpp = sc->bpp;
+	sp->x = sc->x;
+	sp->y = sc->y;
+	sp->enabled = 1;
+	sp->pending = 1;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+/* just record the new position, moves within a frame are coalesced */
+static int lf1000fb_move_sprite(struct lf1000fb_info *fbi,
+				struct sprite_pos_cmd *pos)
+{
+	struct lf1000fb_sprite *sp = &fbi->sprite;
+	unsigned long flags;
+
+	if(!sp->enabled)
+		return -EINVAL;
+	/* keeps x + width and y + height in sprite_latch() from overflowing */
+	if(pos->x < -SPRITE_POS_MAX || pos->x > SPRITE_POS_MAX ||
+	   pos->y < -SPRITE_POS_MAX || pos->y > SPRITE_POS_MAX)
+		return -EINVAL;
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	sp->x = pos->x;
+	sp->y = pos->y;
+	sp->pending = 1;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+static int lf1000fb_set_anim(struct lf1000fb_info *fbi, struct anim_cmd *ac)
+{
+	struct lf1000fb_anim *a;
+	struct mlc_layer_position pos;
+	unsigned long flags;
+	int i;
+
+	if(ac->layer >= MLC_NUM_LAYERS || ac->count > ANIM_MAX_KEYS)
+		return -EINVAL;
+	if(fbi->irq < 0)
+		return -ENODEV;
+	if(ac->layer == SPRITE_LAYER && fbi->sprite.enabled)
+		return -EBUSY;
+	a = &fbi->anim[ac->layer];
+
+	if(ac->count == 0) {
+		spin_lock_irqsave(&fbi->lock, flags);
+		a->running = 0;
+		spin_unlock_irqrestore(&fbi->lock, flags);
+		wake_up_interruptible_all(&fbi->vsync_wait);
+		return 0;
+	}
+
+	if(ac->flags & ANIM_SCALE) {
+		if(ac->layer != MLC_VIDEO_LAYER || ac->srcwidth < 2 ||
+		   ac->srcheight < 2)
+			return -EINVAL;
+	}
+	for(i = 1; i < ac->count; i++)
+		if(ac->keys[i].frame <= ac->keys[i-1].frame)
+			return -EINVAL;
+
+	/* without scaling the layer keeps its current size */
+	mlc_GetPosition(ac->layer, &pos);
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	a->track = *ac;
+	a->width = pos.right - pos.left + 1;
+	a->height = pos.bottom - pos.top + 1;
+	a->start = fbi->vblank_count + 1;
+	a->running = 1;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+static void compose_read(void *mlc, struct compose_cmd *cc)
+{
+	u8 layer = cc->layer;
+	u32 ctl = mlc_layer_read(mlc, layer, MLC_REG_CONTROL);
+	u32 tp = mlc_layer_read(mlc, layer, MLC_REG_TPCOLOR);
+
+	cc->mode = IS_SET(ctl,BLENDENB) ? COMPOSE_BLEND : COMPOSE_OPAQUE;
+	cc->alpha = (tp>>ALPHA) & 0xF;
+	cc->tpcolor = 0;
+	if(layer != MLC_VIDEO_LAYER) {
+		if(IS_SET(ctl,TPENB))
+			cc->mode |= COMPOSE_COLORKEY;
+		cc->tpcolor = (tp>>TPCOLOR) & 0xFFFFFF;
+	}
+}
+
+/*
+ * Program blend, alpha and colour key of a layer on every active MLC
+ * with the vsync interrupt held off, so one frame never mixes old and
+ * new settings.  The dirty flag goes out last on each MLC.
+ */
+static int lf1000fb_set_compose(struct lf1000fb_info *fbi,
+				struct compose_cmd *cc)
+{
+	unsigned long flags;
+
+	if(cc->layer >= MLC_NUM_LAYERS || cc->alpha > 15 ||
+	   (cc->mode & ~(COMPOSE_BLEND|COMPOSE_COLORKEY)))
+		return -EINVAL;
+	if(cc->layer == MLC_VIDEO_LAYER && (cc->mode & COMPOSE_COLORKEY))
+		return -EINVAL;
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	compose_write(fbi->mlc_base, cc);
+	if(tv_mirror(fbi))
+		compose_write(fbi->mlc_base+0x400, cc);
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+static int lf1000fb_get_compose(struct lf1000fb_info *fbi,
+				struct compose_cmd *cc)
+{
+	struct compose_cmd tv;
+
+	if(cc->layer >= MLC_NUM_LAYERS)
+		return -EINVAL;
+
+	compose_read(fbi->mlc_base, cc);
+	cc->mismatch = 0;
+	if(tv_mirror(fbi)) {
+		tv.layer = cc->layer;
+		compose_read(fbi->mlc_base+0x400, &tv);
+		cc->mismatch = tv.mode != cc->mode || tv.alpha != cc->alpha ||
+			       tv.tpcolor != cc->tpcolor;
+	}
+	return 0;
+}
+
+/*
+ * Fb memory allocator.  The visible framebuffer owns the bottom of the
+ * carveout; extra buffers are handed out top down, first fit.
+ */
+static u32 carveout_reserved(struct lf1000fb_info *fbi)
+{
+	return PAGE_ALIGN(fbi->fb.fix.line_length*fbi->fb.var.yres_virtual);
+}
+
+static int carveout_alloc(struct lf1000fb_info *fbi, u32 size, u32 *offset)
+{
+	u32 top = mlc_fb_size & PAGE_MASK;
+	u32 end;
+	int i;
+
+	size = PAGE_ALIGN(size);
+	if(size == 0 || fbi->nregions == CARVEOUT_MAX_REGIONS)
+		return -ENOMEM;
+
+	for(i = 0; i <= fbi->nregions; i++) {
+		end = i < fbi->nregions ? fbi->regions[i].offset +
+					  fbi->regions[i].size :
+					  carveout_reserved(fbi);
+		if(top >= end && top - end >= size)
+			break;
+		if(i == fbi->nregions)
+			return -ENOMEM;
+		top = fbi->regions[i].offset;
+	}
+
+	memmove(&fbi->regions[i+1], &fbi->regions[i],
+		(fbi->nregions - i)*sizeof(fbi->regions[0]));
+	fbi->regions[i].offset = top - size;
+	fbi->regions[i].size = size;
+	fbi->nregions++;
+	*offset = top - size;
+	return 0;
+}
+
+static void carveout_free(struct lf1000fb_info *fbi, u32 offset)
+{
+	int i;
+
+	for(i = 0; i < fbi->nregions; i++)
+		if(fbi->regions[i].offset == offset)
+			break;
+	if(i == fbi->nregions)
+		return;
+	fbi->nregions--;
+	memmove(&fbi->regions[i], &fbi->regions[i+1],
+		(fbi->nregions - i)*sizeof(fbi->regions[0]));
+}
+
+/* layer setup for 3D scanout, on the MLC currently selected by mlcregs */
+static void scanout3d_program(struct scanout3d_cmd *sc, u32 address)
+{
+	u8 layer = sc->layer;
+
+	if(!sc->enable) {
+		mlc_SetLayerEnable(layer, 0);
+		mlc_Set3DEnable(layer, 0);
+		mlc_SetDirtyFlag(layer);
+		return;
+	}
+	mlc_SetFormat(layer, sc->format);
+	mlc_SetHStride(layer, sc->bpp);
+	mlc_SetVStride(layer, sc->width*sc->bpp);
+	mlc_SetPosition(layer, 0, 0, sc->width, sc->height);
+	mlc_SetAddress(layer, address);
+	mlc_Set3DEnable(layer, 1);
+	mlc_SetLayerEnable(layer, 1);
+	mlc_SetDirtyFlag(layer);
+}
+
+static void scanout3d_release(struct lf1000fb_info *fbi)
+{
+	struct lf1000fb_scanout3d *s3d = &fbi->scanout3d;
+
+	carveout_free(fbi, s3d->offset[1]);
+	carveout_free(fbi, s3d->offset[0]);
+	s3d->enabled = 0;
+}
+
+/*
+ * The owner closed the fb with 3D scanout still on.  Flips still queued
+ * would point the layer back into the freed buffers, so they are dropped
+ * before GRP3DENB is cleared and the buffers go.  fb_release path.
+ */
+static void scanout3d_teardown(struct lf1000fb_info *fbi)
+{
+	struct lf1000fb_scanout3d *s3d = &fbi->scanout3d;
+	struct lf1000fb_flipq *q = &fbi->flipq[s3d->layer];
+	struct scanout3d_cmd sc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	q->head = (q->head+q->count) % FLIP_QUEUE_LEN;
+	q->count = 0;
+	q->inflight = 0;
+	q->retired_seq = q->queued_seq;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	wake_up_interruptible(&fbi->vsync_wait);
+
+	memset(&sc, 0, sizeof(sc));
+	sc.layer = s3d->layer;
+	scanout3d_program(&sc, 0);
+	if(tv_mirror(fbi)) {
+		mlcregs += 0x400;
+		scanout3d_program(&sc, 0);
+		mlcregs -= 0x400;
+	}
+	scanout3d_release(fbi);
+}
+
+/*
+ * Allocate two colour buffers for the 3D core from the fb memory and put
+ * the layer in GRP3DENB mode showing buffer 0.  The 3D core renders into
+ * the back buffer, MLC_IOCT3DFLIP queues it and swaps.  tools/prod3d
+ * stands in for the 3D core, rendering with the CPU.
+ */
+static int lf1000fb_set_scanout3d(struct lf1000fb_info *fbi,
+				  struct scanout3d_cmd *sc)
+{
+	struct lf1000fb_scanout3d *s3d = &fbi->scanout3d;
+	int tvout_enable = tv_mirror(fbi);
+	const struct lf1000fb_pixfmt *pf;
+	int i, ret;
+
+	if(sc->layer >= MLC_VIDEO_LAYER)
+		return -EINVAL;
+
+	if(!sc->enable) {
+		if(!s3d->enabled || s3d->layer != sc->layer)
+			return -EINVAL;
+		if(fbi->flipq[sc->layer].count)
+			return -EBUSY;
+		scanout3d_program(sc, 0);
+		if(tvout_enable) {
+			mlcregs += 0x400;
+			scanout3d_program(sc, 0);
+			mlcregs -= 0x400;
+		}
+		scanout3d_release(fbi);
+		return 0;
+	}
+
+	if(s3d->enabled)
+		return -EBUSY;
+	if(sc->layer == SPRITE_LAYER && fbi->sprite.enabled)
+		return -EBUSY;
+	/* only tracked processes, so the buffers are dropped on close */
+	if(find_client(fbi, current->tgid) == NULL)
+		return -EBUSY;
+	pf = pixfmt_find(sc->format, sc->bpp);
+	if(pf == NULL || sc->width == 0 || sc->height == 0 ||
+	   sc->width > fbi->fb.var.xres || sc->height > fbi->fb.var.yres)
+		return -EINVAL;
+	sc->bpp = pf->bpp;
+
+	s3d->size = sc->width*sc->height*sc->bpp;
+	ret = carveout_alloc(fbi, s3d->size, &s3d->offset[0]);
+	if(ret < 0)
+		return ret;
+	ret = carveout_alloc(fbi, s3d->size, &s3d->offset[1]);
+	if(ret < 0) {
+		carveout_free(fbi, s3d->offset[0]);
+		return ret;
+	}
+	for(i = 0; i < 2; i++) {
+		sc->offset[i] = s3d->offset[i];
+		sc->address[i] = mlc_fb_addr + s3d->offset[i];
+	}
+
+	s3d->layer = sc->layer;
+	s3d->back = 1;
+	s3d->pending = 0;
+	s3d->tgid = current->tgid;
+	s3d->enabled = 1;
+
+	scanout3d_program(sc, sc->address[0]);
+	if(tvout_enable) {
+		mlcregs += 0x400;
+		scanout3d_program(sc, sc->address[0]);
+		mlcregs -= 0x400;
+	}
+	return 0;
+}
+
+static int flip_retired(struct lf1000fb_info *fbi, int layer, u32 seq)
+{
+	return (s32)(fbi->flipq[layer].retired_seq - seq) >= 0;
+}
+
+/*
+ * Queue the back buffer for the next vsync and return the new back
+ * buffer.  That one stays on screen until the MLC has taken the flip, so
+ * we only return once it has.  The wait is interruptible: a flip still
+ * pending from an interrupted or timed out call is waited for again
+ * rather than queued a second time, and the back buffer only changes
+ * once it is taken, so a restarted call returns what the first would
+ * have.
+ */
+static int lf1000fb_flip_scanout3d(struct lf1000fb_info *fbi)
+{
+	struct lf1000fb_scanout3d *s3d = &fbi->scanout3d;
+	struct flip_cmd f;
+	long ret;
+	int layer;
+
+	if(!s3d->enabled)
+		return -EINVAL;
+
+	layer = s3d->layer;
+	if(!s3d->pending) {
+		memset(&f, 0, sizeof(f));
+		f.layer = layer;
+		f.address = mlc_fb_addr + s3d->offset[s3d->back];
+		f.cookie = s3d->back;
+		ret = lf1000fb_queue_flip(fbi, &f, NULL);
+		if(ret < 0)
+			return ret;
+		s3d->seq = fbi->flipq[layer].queued_seq;
+		s3d->pending = 1;
+	}
+
+	ret = wait_vsync_unlocked_timeout(fbi,
+			flip_retired(fbi, layer, s3d->seq),
+			msecs_to_jiffies(4*LF1000FB_FRAME_MS));
+	if(ret < 0)
+		return ret;
+	/* torn down while we slept */
+	if(!s3d->enabled || s3d->layer != layer)
+		return -EINVAL;
+	/* still queued, s3d->back is still the buffer the MLC is to take */
+	if(ret == 0)
+		return -ETIMEDOUT;
+	s3d->pending = 0;
+	s3d->back ^= 1;
+	return s3d->back;
+}
+
+/* a fence whose device went away counts as signaled */
+static int fence_signaled(struct lf1000fb_fence *fence)
+{
+	struct lf1000fb_flipq *q = &fence->fbi->flipq[fence->layer];
+
+	return fence->fbi->removed || (s32)(q->retired_seq - fence->seq) >= 0;
+}
+
+static unsigned int lf1000fb_fence_poll(struct file *file, poll_table *wait)
+{
+	struct lf1000fb_fence *fence = file->private_data;
+
+	poll_wait(file, &fence->fbi->vsync_wait, wait);
+	return fence_signaled(fence) ? (POLLIN | POLLRDNORM) : 0;
+}
+
+static int lf1000fb_fence_release(struct inode *inode, struct file *file)
+{
+	struct lf1000fb_fence *fence = file->private_data;
+
+	kref_put(&fence->fbi->ref, lf1000fb_free);
+	kfree(fence);
+	return 0;
+}
+
+static const struct file_operations lf1000fb_fence_fops = {
+	.owner		= THIS_MODULE,
+	.poll		= lf1000fb_fence_poll,
+	.release	= lf1000fb_fence_release,
+};
+
+/*
+ * With FLIP_FENCE the fence fd is reserved before the flip is queued and
+ * handed back through fence_file; the caller installs it once the fd
+ * number has reached userspace, or puts both back.
+ */
+static int lf1000fb_queue_flip(struct lf1000fb_info *fbi, struct flip_cmd *f,
+			       struct file **fence_file)
+{
+	struct lf1000fb_fence *fence = NULL;
+	struct file *file = NULL;
+	struct lf1000fb_flipq *q;
+	struct lf1000fb_flip *p;
+	unsigned long flags;
+	int fd = -1;
+
+	f->fence = -1;
+	if(fence_file)
+		*fence_file = NULL;
+	else
+		f->flags &= ~FLIP_FENCE;
+	if(f->layer >= MLC_NUM_LAYERS)
+		return -EINVAL;
+	if(fbi->irq < 0)
+		return -ENODEV;
+	if(f->layer == SPRITE_LAYER && fbi->sprite.enabled)
+		return -EBUSY;
+	if((f->flags & FLIP_FIELD_ODD) && (f->flags & FLIP_FIELD_EVEN))
+		return -EINVAL;
+	if(fbi->field_pair[f->layer].odd || fbi->field_pair[f->layer].even)
+		return -EBUSY;
+
+	if(f->flags & FLIP_FENCE) {
+		fence = kmalloc(sizeof(*fence), GFP_KERNEL);
+		if(fence == NULL)
+			return -ENOMEM;
+		fence->fbi = fbi;
+		fence->layer = f->layer;
+		fd = get_unused_fd();
+		if(fd < 0) {
+			kfree(fence);
+			return fd;
+		}
+		file = anon_inode_getfile("lf1000fb-fence",
+					  &lf1000fb_fence_fops, fence, O_RDWR);
+		if(IS_ERR(file)) {
+			put_unused_fd(fd);
+			kfree(fence);
+			return PTR_ERR(file);
+		}
+		/* released with the file, the fence reads fbi until then */
+		kref_get(&fbi->ref);
+	}
+
+	q = &fbi->flipq[f->layer];
+	spin_lock_irqsave(&fbi->lock, flags);
+	if(q->count == FLIP_QUEUE_LEN) {
+		spin_unlock_irqrestore(&fbi->lock, flags);
+		if(file) {
+			put_unused_fd(fd);
+			fput(file);
+		}
+		return -EBUSY;
+	}
+	p = &q->pending[(q->head+q->count) % FLIP_QUEUE_LEN];
+	p->address = f->address + fbi->orient_offset[f->layer];
+	p->target = f->target ? f->target : fbi->vblank_count+1;
+	p->cookie = f->cookie;
+	p->seq = ++q->queued_seq;
+	p->field = f->flags & (FLIP_FIELD_ODD|FLIP_FIELD_EVEN);
+	q->count++;
+	if(fence)
+		fence->seq = p->seq;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+
+	if(file) {
+		f->fence = fd;
+		*fence_file = file;
+	}
+	return 0;
+}
+
+static int flip_done_ready(struct lf1000fb_info *fbi, int layer)
+{
+	struct lf1000fb_flipq *q = &fbi->flipq[layer];
+
+	return q->done_count || !q->count;
+}
+
+/* 
+ * Collect the oldest completion of a layer.  Blocks while flips are still
+ * queued, returns -EAGAIN if there is nothing queued or completed.
+ */
+static int lf1000fb_flip_done(struct lf1000fb_info *fbi,
+			      struct flip_done_cmd *d)
+{
+	struct lf1000fb_flipq *q;
+	unsigned long flags;
+	int ret;
+
+	if(d->layer >= MLC_NUM_LAYERS)
+		return -EINVAL;
+	q = &fbi->flipq[d->layer];
+
+	ret = wait_vsync_unlocked(fbi, flip_done_ready(fbi, d->layer));
+	if(ret < 0)
+		return ret;
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	if(q->done_count == 0) {
+		spin_unlock_irqrestore(&fbi->lock, flags);
+		return -EAGAIN;
+	}
+	*d = q->done[q->done_head];
+	q->done_head = (q->done_head+1) % FLIP_DONE_LEN;
+	q->done_count--;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+/* called with the fb_info lock held (ioctl path) */
+static int lf1000fb_set_field_pair(struct lf1000fb_info *fbi,
+				   struct field_pair_cmd *fc)
+{
+	struct lf1000fb_field_pair *fp;
+	unsigned long flags;
+
+	if(fc->layer >= MLC_NUM_LAYERS)
+		return -EINVAL;
+	if(fbi->tvout_status != TVOUT_STATUS_ON || !fbi->field_irq)
+		return -ENODEV;
+	if(fbi->tv_extended)
+		return -EBUSY;
+	if(fbi->flipq[fc->layer].count)
+		return -EBUSY;
+	if((fc->odd == 0) != (fc->even == 0))
+		return -EINVAL;
+
+	fp = &fbi->field_pair[fc->layer];
+	spin_lock_irqsave(&fbi->lock, flags);
+	if(fc->odd == 0 && (fp->odd || fp->even)) {
+		/* back to the same picture on both outputs */
+		flip_latch(fbi->mlc_base+0x400, fc->layer, fp->odd);
+	}
+	fp->odd = fc->odd;
+	fp->even = fc->even;
+	if(fc->odd)
+		flip_latch(fbi->mlc_base, fc->layer, fc->odd);
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+/* called with the fb_info lock held (ioctl path) */
+static int lf1000fb_set_tvout_standard(struct lf1000fb_info *fbi, int std)
+{
+	if(std < 0 || std >= TVOUT_NUM_STANDARDS)
+		return -EINVAL;
+	if(fbi->tvout_step != TVOUT_IDLE ||
+	   fbi->tvout_status != TVOUT_STATUS_OFF)
+		return -EBUSY;
+	fbi->tvout_profile = &tvout_profiles[std];
+	return 0;
+}
+
+/* called with the fb_info lock held (ioctl path) */
+static int lf1000fb_tvout_request(struct lf1000fb_info *fbi, int enable)
+{
+	if(fbi->tvout_step != TVOUT_IDLE)
+		return -EBUSY;
+
+	if(enable) {
+		if(fbi->tvout_status == TVOUT_STATUS_ON)
+			return -EFAULT;
+		fbi->tvout_status = TVOUT_STATUS_ENABLING;
+		fbi->tvout_step = TVOUT_DPC_SETUP;
+	}
+	else {
+		if(fbi->tvout_status == TVOUT_STATUS_OFF)
+			return -EFAULT;
+		/* stop mirroring ioctls to the 2nd MLC right away */
+		fbi->fb.var.reserved[0] = 0;
+		fbi->tvout_status = TVOUT_STATUS_DISABLING;
+		fbi->tvout_step = TVOUT_SHUTDOWN;
+	}
+
+	queue_delayed_work(fbi->wq, &fbi->tvout_work, 0);
+	return 0;
+}
+
+
+/*
+ * Layer ownership
+ *
+ * fb_ioctl() has no struct file, so claims are held per process (tgid)
+ * and counted over its opens of the fb.  The writable layers of the
+ * last caller are cached, which keeps the check on per-frame ioctls to
+ * a compare and a mask test.
+ */
+
+enum {
+	ACCESS_NONE = 0,	/* queries, or checked by the ioctl itself */
+	ACCESS_LAYER,		/* legacy ioctls acting on layerID */
+	ACCESS_MLC,		/* MLC/DPC wide */
+	ACCESS_VIDEO,		/* legacy ioctls on video layer registers */
+};
+
+static const u8 ioctl_access[] = {
+	[_IOC_NR(MLC_IOCTENABLE)]	= ACCESS_MLC,
+	[_IOC_NR(MLC_IOCTBACKGND)]	= ACCESS_MLC,
+	[_IOC_NR(MLC_IOCTPRIORITY)]	= ACCESS_MLC,
+	[_IOC_NR(MLC_IOCTTOPDIRTY)]	= ACCESS_MLC,
+	[_IOC_NR(MLC_IOCSSCREENSIZE)]	= ACCESS_MLC,
+	[_IOC_NR(MLC_IOCTLAYEREN)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTADDRESS)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTHSTRIDE)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTVSTRIDE)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTLOCKSIZE)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCSPOSITION)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTFORMAT)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTDIRTY)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCT3DENB)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTALPHA)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTTPCOLOR)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTBLEND)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTTRANSP)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTINVERT)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTINVCOLOR)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCSOVERLAYSIZE)]	= ACCESS_VIDEO,
+	[_IOC_NR(MLC_IOCTINVISIBLE)]	= ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCSINVISIBLEAREA)] = ACCESS_LAYER,
+	[_IOC_NR(MLC_IOCTADDRESSCB)]	= ACCESS_VIDEO,
+	[_IOC_NR(MLC_IOCTADDRESSCR)]	= ACCESS_VIDEO,
+	[_IOC_NR(FBIO_ENABLE_TVOUT)]	= ACCESS_MLC,
+	[_IOC_NR(FBIO_DISABLE_TVOUT)]	= ACCESS_MLC,
+	[_IOC_NR(MLC_IOCSTVSTANDARD)]	= ACCESS_MLC,
+	/* fb memory writers, guarded like the screen itself */
+	[_IOC_NR(MLC_IOCSCONVERT)]	= ACCESS_MLC,
+	[_IOC_NR(MLC_IOCSUSERBLIT)]	= ACCESS_MLC,
+	[_IOC_NR(MLC_IOCSBLITLIST)]	= ACCESS_MLC,
+};
+
+static u32 access_mask(struct lf1000fb_info *fbi, pid_t tgid)
+{
+	u32 mask = 0;
+	int i;
+
+	for(i = 0; i < MLC_NUM_LAYERS; i++)
+		if(fbi->layer_owner[i] == 0 || fbi->layer_owner[i] == tgid ||
+		   fbi->layer_lessee[i] == tgid)
+			mask |= (1<<i);
+	if(mask & 1)
+		mask |= ACCESS_GLOBAL;
+	return mask;
+}
+
+/* 0 if the calling process may change everything in need */
+static int lf1000fb_access(struct lf1000fb_info *fbi, u32 need)
+{
+	if(fbi->access_tgid != current->tgid) {
+		fbi->access_mask = access_mask(fbi, current->tgid);
+		fbi->access_tgid = current->tgid;
+	}
+	return (fbi->access_mask & need) == need ? 0 : -EPERM;
+}
+
+static int lf1000fb_ioctl_access(struct lf1000fb_info *fbi, unsigned int cmd,
+				 int layer)
+{
+	unsigned int nr = _IOC_NR(cmd);
+
+	if(nr >= ARRAY_SIZE(ioctl_access))
+		return 0;
+	switch(ioctl_access[nr]) {
+		case ACCESS_LAYER:
+		return lf1000fb_access(fbi, 1<<layer);
+		case ACCESS_VIDEO:
+		return lf1000fb_access(fbi, 1<<MLC_VIDEO_LAYER);
+		case ACCESS_MLC:
+		return lf1000fb_access(fbi, ACCESS_GLOBAL);
+	}
+	return 0;
+}
+
+static struct lf1000fb_client *find_client(struct lf1000fb_info *fbi,
+					   pid_t tgid)
+{
+	int i;
+
+	for(i = 0; i < LAYER_MAX_CLIENTS; i++)
+		if(fbi->clients[i].opens && fbi->clients[i].tgid == tgid)
+			return &fbi->clients[i];
+	return NULL;
+}
+
+static int lf1000fb_claim(struct lf1000fb_info *fbi, unsigned int layer)
+{
+	pid_t tgid = current->tgid;
+
+	if(layer >= MLC_NUM_LAYERS)
+		return -EINVAL;
+	/* only tracked processes, so the claim is dropped on close */
+	if(find_client(fbi, tgid) == NULL)
+		return -EBUSY;
+	if(fbi->layer_owner[layer] && fbi->layer_owner[layer] != tgid)
+		return -EBUSY;
+	fbi->layer_owner[layer] = tgid;
+	fbi->access_tgid = 0;
+	return 0;
+}
+
+static int lf1000fb_release_layer(struct lf1000fb_info *fbi,
+				  unsigned int layer)
+{
+	if(layer >= MLC_NUM_LAYERS)
+		return -EINVAL;
+	if(fbi->layer_owner[layer] != current->tgid)
+		return -EPERM;
+	fbi->layer_owner[layer] = 0;
+	fbi->layer_lessee[layer] = 0;
+	fbi->access_tgid = 0;
+	return 0;
+}
+
+static int lf1000fb_lease(struct lf1000fb_info *fbi, struct lease_cmd *lc)
+{
+	if(lc->layer >= MLC_NUM_LAYERS || lc->pid < 0)
+		return -EINVAL;
+	if(fbi->layer_owner[lc->layer] != current->tgid)
+		return -EPERM;
+	fbi->layer_lessee[lc->layer] = lc->pid;
+	fbi->access_tgid = 0;
+	return 0;
+}
+
+/* a client is gone, drop its claims, leases and 3D buffers */
+static void client_drop(struct lf1000fb_info *fbi, struct lf1000fb_client *cl)
+{
+	int i;
+
+	if(fbi->scanout3d.enabled && fbi->scanout3d.tgid == cl->tgid)
+		scanout3d_teardown(fbi);
+
+	for(i = 0; i < MLC_NUM_LAYERS; i++) {
+		if(fbi->layer_owner[i] == cl->tgid) {
+			fbi->layer_owner[i] = 0;
+			fbi->layer_lessee[i] = 0;
+		}
+		if(fbi->layer_lessee[i] == cl->tgid)
+			fbi->layer_lessee[i] = 0;
+	}
+	cl->opens = 0;
+	fbi->access_tgid = 0;
+}
+
+static int client_alive(pid_t tgid)
+{
+	struct task_struct *p;
+	int alive;
+
+	rcu_read_lock();
+	p = pid_task(find_pid_ns(tgid, &init_pid_ns), PIDTYPE_PID);
+	alive = p != NULL && !(p->flags & PF_EXITING);
+	rcu_read_unlock();
+	return alive;
+}
+
+/*
+ * fb_release runs in whichever process drops the last reference, which
+ * needn't be the one that opened the fb: a child can inherit the fd and
+ * outlive its parent.  Clients whose process is gone are dropped here.
+ */
+static void reap_clients(struct lf1000fb_info *fbi)
+{
+	int i;
+
+	for(i = 0; i < LAYER_MAX_CLIENTS; i++)
+		if(fbi->clients[i].opens && !client_alive(fbi->clients[i].tgid))
+			client_drop(fbi, &fbi->clients[i]);
+}
+
+static int lf1000fb_open(struct fb_info *info, int user)
+{
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	struct lf1000fb_client *cl;
+	int i;
+
+	if(!user)
+		return 0;
+	reap_clients(fbi);
+	cl = find_client(fbi, current->tgid);
+	if(cl == NULL) {
+		/* untracked processes can still use unclaimed layers */
+		for(i = 0; i < LAYER_MAX_CLIENTS; i++)
+			if(fbi->clients[i].opens == 0)
+				break;
+		if(i == LAYER_MAX_CLIENTS)
+			return 0;
+		cl = &fbi->clients[i];
+		cl->tgid = current->tgid;
+	}
+	cl->opens++;
+	return 0;
+}
+
+static int lf1000fb_release(struct fb_info *info, int user)
+{
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	struct lf1000fb_client *cl;
 
-	/* Internal video encoder for TV out */
-	dpc_ResetEncoder();
-	dpc_SetEncoderEnable(1);
-	dpc_SetEncoderPowerDown(1);
-	dpc_SetEncoderMode(0, 1);
-	dpc_SetEncoderFSCAdjust(0);
-	dpc_SetEncoderBandwidth(0, 0);
-	dpc_SetEncoderColor(0, 0, 0, 0, 0);
-	dpc_SetEncoderTiming(64, 1716, 0, 3);
-	//dpc_SetEncoderUpscaler(320, 720);
-	dpc_SetEncoderUpscaler(info->var.xres, 720);
-	dpc_SetEncoderPowerDown(0);
+	if(!user)
+		return 0;
+	cl = find_client(fbi, current->tgid);
+	if(cl != NULL && --cl->opens == 0)
+		client_drop(fbi, cl);
+	reap_clients(fbi);
+	return 0;
+}
 
-	/* 2nd DPC is master when running TV + LCD out */
-	dpc_SetDPCEnable(1);
-	dpc_SetClockEnable(1);
+/* the canvas must stay below any buffer handed out of the carveout */
+static u32 canvas_limit(struct lf1000fb_info *fbi)
+{
+	u32 limit = mlc_fb_size & PAGE_MASK;
+	int i;
 
-	/* To support IOCTLS Switch back to 1st DPC register set for LCD out */
-	dpcregs -= 0x400;
+	for(i = 0; i < fbi->nregions; i++)
+		if(fbi->regions[i].offset < limit)
+			limit = fbi->regions[i].offset;
+	return limit;
 }
 
-static void disable_tvout()
+/* bus address of the viewport's top left pixel */
+static u32 canvas_address(struct fb_info *info, u32 xoffset, u32 yoffset)
 {
-	mlcregs += 0x400;
-	mlc_SetLayerEnable(0, false);
-	mlc_SetDirtyFlag(0);
-	mlc_SetMLCEnable(0);
-	mlc_SetTopDirtyFlag();
-	mlcregs -= 0x400;
-	dpcregs += 0x400;
-	dpc_SetEncoderPowerDown(1);
-	dpc_SetEncoderEnable(0);
-	dpc_SetClockEnable(0); // CLKENB : Provides internal operating clock.
-	dpc_SetDPCEnable(0);
-	dpcregs -= 0x400;
+	return mlc_fb_addr + yoffset*info->fix.line_length +
+		xoffset*(info->var.bits_per_pixel/8);
 }
 
+static int lf1000fb_ctl_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct lf1000fb_ctl *c = file->private_data;
 
-static void set_mode(struct lf1000fb_info *fbi)
+	if(vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	return dma_mmap_coherent(c->fbi->fb.device, vma, c->page, c->dma,
+				 PAGE_SIZE);
+}
+
+static void ctl_free(struct lf1000fb_ctl *c)
 {
-	/*Set Mode*/
-	/* we have a static mode: 320x240, 16-bit */
+	struct lf1000fb_info *fbi = c->fbi;
 
-	fbi->fb.var.xres		= X_RESOLUTION;
-	fbi->fb.var.yres		= Y_RESOLUTION;
-	fbi->fb.var.xres_virtual	= fbi->fb.var.xres;
-	fbi->fb.var.yres_virtual	= fbi->fb.var.yres;
-	fbi->fb.var.xoffset		= 0;
-	fbi->fb.var.yoffset		= 0;
+	dma_free_coherent(fbi->fb.device, PAGE_SIZE, c->page, c->dma);
+	kfree(c);
+	kref_put(&fbi->ref, lf1000fb_free);
+}
+
+/* needs no fb lock, so it is safe after the fb has been unregistered */
+static int lf1000fb_ctl_release(struct inode *inode, struct file *file)
+{
+	struct lf1000fb_ctl *c = file->private_data;
+	struct lf1000fb_info *fbi = c->fbi;
+	int i;
+
+	spin_lock_irq(&fbi->lock);
+	for(i = 0; i < CTL_MAX_PAGES; i++)
+		if(fbi->ctl[i] == c)
+			fbi->ctl[i] = NULL;
+	spin_unlock_irq(&fbi->lock);
+	ctl_free(c);
+	return 0;
+}
+
+static const struct file_operations lf1000fb_ctl_fops = {
+	.owner		= THIS_MODULE,
+	.mmap		= lf1000fb_ctl_mmap,
+	.release	= lf1000fb_ctl_release,
+};
+
+/*
+ * New control page for the calling process.  It may drive the layers
+ * it could use when the page was made.  Called with the fb_info lock
+ * held (ioctl path).
+ */
+static int lf1000fb_ctl_page(struct lf1000fb_info *fbi)
+{
+	struct lf1000fb_ctl *c;
+	int i, fd;
+
+	if(fbi->irq < 0)
+		return -ENODEV;
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if(c == NULL)
+		return -ENOMEM;
+	c->page = dma_alloc_coherent(fbi->fb.device, PAGE_SIZE, &c->dma,
+				     GFP_KERNEL);
+	if(c->page == NULL) {
+		kfree(c);
+		return -ENOMEM;
+	}
+	memset(c->page, 0, PAGE_SIZE);
+	c->fbi = fbi;
+	kref_get(&fbi->ref);
+	c->tgid = current->tgid;
+	c->layers = access_mask(fbi, current->tgid) &
+		    ((1<<MLC_NUM_LAYERS)-1);
+
+	spin_lock_irq(&fbi->lock);
+	for(i = 0; i < CTL_MAX_PAGES; i++)
+		if(fbi->ctl[i] == NULL)
+			break;
+	if(i < CTL_MAX_PAGES)
+		fbi->ctl[i] = c;
+	spin_unlock_irq(&fbi->lock);
+	if(i == CTL_MAX_PAGES) {
+		ctl_free(c);
+		return -EBUSY;
+	}
 
-	switch(fbi->fb.var.bits_per_pixel) {
+	fd = anon_inode_getfd("lf1000fb-ctl", &lf1000fb_ctl_fops, c, O_RDWR);
+	if(fd < 0) {
+		spin_lock_irq(&fbi->lock);
+		fbi->ctl[i] = NULL;
+		spin_unlock_irq(&fbi->lock);
+		ctl_free(c);
+	}
+	return fd;
+}
+
+/* colour layout of var for its depth, returns the MLC format code */
+static int mode_format(struct fb_var_screeninfo *var)
+{
+	switch(var->bits_per_pixel) {
 		case 8:
 		/*565 - 8 bits*/
 			
-			fbi->fb.var.red.offset		= 0;
-			fbi->fb.var.red.length		= 8;
-			fbi->fb.var.green.offset	= 0;
-			fbi->fb.var.green.length	= 8;
-			fbi->fb.var.blue.offset		= 0;
-			fbi->fb.var.blue.length		= 8;
-			fbi->fb.var.transp.offset	= 0;
-			fbi->fb.var.transp.length	= 0;
-			fbi->pix_fmt				= 0x443A;
-			break;
+			var->red.offset		= 0;
+			var->red.length		= 8;
+			var->green.offset	= 0;
+			var->green.length	= 8;
+			var->blue.offset	= 0;
+			var->blue.length	= 8;
+			var->transp.offset	= 0;
+			var->transp.length	= 0;
+			return 0x443A;
 		case 16:
 		/*565 - 16 bits*/
 			
-			fbi->fb.var.red.offset		= 5;//was 11
-			fbi->fb.var.red.length		= 5;
-			fbi->fb.var.green.offset	= 5;
-			fbi->fb.var.green.length	= 6;
-			fbi->fb.var.blue.offset		= 0;
-			fbi->fb.var.blue.length		= 5;
-			fbi->fb.var.transp.offset	= 0;
-			fbi->fb.var.transp.length	= 0;
-			fbi->pix_fmt				= 0x4432;
-			break;
+			var->red.offset		= 5;//was 11
+			var->red.length		= 5;
+			var->green.offset	= 5;
+			var->green.length	= 6;
+			var->blue.offset	= 0;
+			var->blue.length	= 5;
+			var->transp.offset	= 0;
+			var->transp.length	= 0;
+			return 0x4432;
 		case 24:
 		/*888 24bits*/
 			
-			fbi->fb.var.red.offset		= 0;//0 for bgr. 16 for rgb
-			fbi->fb.var.red.length		= 8;
-			fbi->fb.var.green.offset	= 8;
-			fbi->fb.var.green.length	= 8;
-			fbi->fb.var.blue.offset		= 16;//16 for bgr. 0 for rgb
-			fbi->fb.var.blue.length		= 8;
-			fbi->fb.var.transp.offset	= 0;
-			fbi->fb.var.transp.length	= 0;
-			fbi->pix_fmt				= 0x4653;
-			break;
+			var->red.offset		= 0;//0 for bgr. 16 for rgb
+			var->red.length		= 8;
+			var->green.offset	= 8;
+			var->green.length	= 8;
+			var->blue.offset	= 16;//16 for bgr. 0 for rgb
+			var->blue.length	= 8;
+			var->transp.offset	= 0;
+			var->transp.length	= 0;
+			return 0x4653;
 		case 32:
 		/* 8888 32bits*/
 			
-			fbi->fb.var.red.offset		= 16;
-			fbi->fb.var.red.length		= 8;
-			fbi->fb.var.green.offset	= 8;
-			fbi->fb.var.green.length	= 8;
-			fbi->fb.var.blue.offset		= 0;
-			fbi->fb.var.blue.length		= 8;
-			fbi->fb.var.transp.offset	= 0;
-			fbi->fb.var.transp.length	= 0;
-			fbi->pix_fmt				= 0x8653;
-			break;
+			var->red.offset		= 16;
+			var->red.length		= 8;
+			var->green.offset	= 8;
+			var->green.length	= 8;
+			var->blue.offset	= 0;
+			var->blue.length	= 8;
+			var->transp.offset	= 0;
+			var->transp.length	= 0;
+			return 0x8653;
 		default:
 		return -EINVAL;
 	}
-		fbi->fb.var.vmode		= FB_VMODE_NONINTERLACED;
 }
 
+static void set_mode(struct lf1000fb_info *fbi)
+{
+	struct fb_var_screeninfo *var = &fbi->fb.var;
+	u32 bytespp = var->bits_per_pixel/8;
+	int ret;
+
+	/*Set Mode*/
+	/* we have a static mode: 320x240, 16-bit, on a canvas at least as big */
+
+	fbi->fb.var.xres		= X_RESOLUTION;
+	fbi->fb.var.yres		= Y_RESOLUTION;
+	if(var->xres_virtual < var->xres)
+		var->xres_virtual = var->xres;
+	if(var->yres_virtual < var->yres)
+		var->yres_virtual = var->yres;
+	if(bytespp == 0 || (u64)var->xres_virtual*bytespp*var->yres_virtual >
+			   canvas_limit(fbi)) {
+		var->xres_virtual = var->xres;
+		var->yres_virtual = var->yres;
+	}
+	if(var->xoffset + var->xres > var->xres_virtual)
+		var->xoffset = 0;
+	if(var->yoffset + var->yres > var->yres_virtual)
+		var->yoffset = 0;
+	fbi->fb.fix.line_length		= var->xres_virtual*bytespp;
+
+	ret = mode_format(var);
+	if(ret >= 0)
+		fbi->pix_fmt = ret;
+	fbi->fb.var.vmode		= FB_VMODE_NONINTERLACED;
+}
+
+
+/*
+ * LCD modes.  The images are checked against the DPC field limits by the
+ * *_IMAGE() macros, so a bad entry fails the build instead of set_par.
+ */
+static const struct lf1000fb_lcd_mode lf1000fb_lcd_modes[] = {
+	{
+		.name		= "lf1000 320x240",
+		.pixclock	= DPC_DESIRED_CLOCK_HZ,
+		.xres		= DISPLAY_VID_PRI_MAX_X_RESOLUTION,
+		.yres		= DISPLAY_VID_PRI_MAX_Y_RESOLUTION,
+		.clkgen0	= DPC_CLKGEN0_IMAGE(DISPLAY_VID_PRI_VCLK_SOURCE,
+					DISPLAY_VID_PRI_VCLK_DELAY,
+					DISPLAY_VID_PRI_VCLK_INV,
+					DISPLAY_VID_PRI_VCLK_OUT_ENB),
+		.clkgen1	= DPC_CLKGEN1_IMAGE(DISPLAY_VID_PRI_VCLK2_SOURCE,
+					DISPLAY_VID_PRI_VCLK2_DIV,
+					0,	/* outclk delay */
+					1),	/* outclk inv */
+		.ctrl0		= DPC_CTRL0_IMAGE(0,	/* interlace */
+					0,	/* invert field */
+					1,	/* RGB mode */
+					0,	/* embedded sync */
+					0,	/* RGB delay */
+					DISPLAY_VID_PRI_VSYNC_ACTIVEHIGH,
+					DISPLAY_VID_PRI_HSYNC_ACTIVEHIGH),
+		.ctrl1		= DPC_CTRL1_IMAGE(DISPLAY_VID_PRI_OUTPUT_FORMAT,
+					DISPLAY_VID_PRI_OUTORDER,
+					0,	/* clip YC */
+					DISPLAY_VID_PRI_SWAP_RGB,
+					DITHER_BYPASS, DITHER_BYPASS,
+					DITHER_BYPASS),
+		.ctrl2		= DPC_CTRL2_IMAGE(DISPLAY_VID_PRI_PAD_VCLK),
+		.delay0		= DPC_DELAY_IMAGE(7, 7, 7),
+		.hsync		= SYNC_IMAGE(DISPLAY_VID_PRI_MAX_X_RESOLUTION,
+					DISPLAY_VID_PRI_HSYNC_SWIDTH,
+					DISPLAY_VID_PRI_HSYNC_FRONT_PORCH,
+					DISPLAY_VID_PRI_HSYNC_BACK_PORCH),
+		.vsync		= SYNC_IMAGE(DISPLAY_VID_PRI_MAX_Y_RESOLUTION,
+					DISPLAY_VID_PRI_VSYNC_SWIDTH,
+					DISPLAY_VID_PRI_VSYNC_FRONT_PORCH,
+					DISPLAY_VID_PRI_VSYNC_BACK_PORCH),
+		.evsync		= SYNC_IMAGE(1, 1, 1, 1),
+		.vsync_offset	= 1,
+	},
+};
+
+/* divider field for a mode's pixel clock from a PLL1 rate in Hz, or -1 */
+static int lcd_mode_divider(const struct lf1000fb_lcd_mode *mode, u32 pll)
+{
+	int div = lf1000_CalcDivider(pll, mode->pixclock);
+
+	if(div < 0)
+		return div;
+	return div > 0 ? (div-1) : 0;
+}
+
+/* refresh rate in mHz for a mode run at PLL1/(div+1), or the nominal rate */
+static u32 lcd_mode_refresh(const struct lf1000fb_lcd_mode *mode, int div)
+{
+	u64 clk = div < 0 ? mode->pixclock : get_pll_freq(PLL1)/(div+1);
+
+	clk *= 1000;
+	do_div(clk, (mode->hsync.total+1)*(mode->vsync.total+1));
+	return (u32)clk;
+}
+
+/* load a mode image into the primary DPC, leaves DPCENB alone */
+static void lf1000fb_load_lcd_mode(const struct lf1000fb_lcd_mode *mode,
+				   int div)
+{
+	void *base = dpcregs;
+	u32 tmp;
+
+	dpc_SetClockPClkMode(PCLKMODE_ONLYWHENCPUACCESS);
+	tmp = ioread32(base+DPCCLKGEN0) & ~DPC_CLKGEN0_MASK;
+	iowrite32(tmp|mode->clkgen0|((div & 0x3F)<<CLKDIV0),base+DPCCLKGEN0);
+	tmp = ioread32(base+DPCCLKGEN1) & ~DPC_CLKGEN1_MASK;
+	iowrite32(tmp|mode->clkgen1,base+DPCCLKGEN1);
+	dpc_SetClockEnable(1);
+
+	tmp = ioread16(base+DPCCTRL0) & ~(DPC_CTRL0_MASK|(1<<_INTPEND));
+	iowrite16(tmp|mode->ctrl0,base+DPCCTRL0);
+	tmp = ioread16(base+DPCCTRL1) & ~DPC_CTRL1_MASK;
+	iowrite16(tmp|mode->ctrl1,base+DPCCTRL1);
+	tmp = ioread16(base+DPCCTRL2) & ~DPC_CTRL2_MASK;
+	iowrite16(tmp|mode->ctrl2,base+DPCCTRL2);
+
+	dpc_SetSyncImage(&mode->hsync, &mode->vsync, &mode->evsync);
+	iowrite16(mode->delay0,base+DPCDELAY0);
+	dpc_SetVSyncOffset(mode->vsync_offset, mode->vsync_offset,
+			   mode->vsync_offset, mode->vsync_offset);
+}
+
+#ifdef CONFIG_CPU_FREQ
+/*
+ * PLL1 feeds the pixel clock and is retuned for CPU scaling.  Work out
+ * the divider for the new rate once it has settled and have the vsync
+ * interrupt load it, so the panel only sees whole frames at either rate.
+ */
+static int lf1000fb_freq_transition(struct notifier_block *nb,
+				    unsigned long val, void *data)
+{
+	struct lf1000fb_info *fbi = container_of(nb, struct lf1000fb_info,
+						 freq_transition);
+	const struct lf1000fb_lcd_mode *mode = fbi->lcd_mode;
+	struct cpufreq_freqs *freqs = data;
+	unsigned long flags;
+	u64 pll;
+	u32 nominal;
+	int div, dev;
+
+	/*
+	 * PLL1 follows the CPU clock.  When it is about to rise, switch to
+	 * the divider for the new rate right away: a frame or two slow is
+	 * harmless, overclocking the panel until the next vsync is not.
+	 */
+	if(val == CPUFREQ_PRECHANGE) {
+		if(freqs->new <= freqs->old)
+			return NOTIFY_DONE;
+		pll = (u64)get_pll_freq(PLL1)*freqs->new;
+		do_div(pll, freqs->old);
+		div = lcd_mode_divider(mode, (u32)pll);
+		spin_lock_irqsave(&fbi->lock, flags);
+		if(div > fbi->lcd_div) {
+			fbi->lcd_div = div;
+			fbi->lcd_div_pending = div;
+			lcd_latch_divider(fbi);
+		}
+		spin_unlock_irqrestore(&fbi->lock, flags);
+		return NOTIFY_OK;
+	}
+	if(val != CPUFREQ_POSTCHANGE && val != CPUFREQ_RESUMECHANGE)
+		return NOTIFY_DONE;
+
+	div = lcd_mode_divider(mode, get_pll_freq(PLL1));
+	if(div < 0) {
+		printk(KERN_WARNING "lf1000fb: no pixel clock divider for "
+		       "PLL1 at %u Hz\n", get_pll_freq(PLL1));
+		return NOTIFY_DONE;
+	}
+
+	spin_lock_irqsave(&fbi->lock, flags);
+	if(div != fbi->lcd_div) {
+		fbi->lcd_div = div;
+		fbi->lcd_div_pending = div;
+		if(fbi->irq < 0)
+			lcd_latch_divider(fbi);
+	}
+	fbi->refresh = lcd_mode_refresh(mode, div);
+	spin_unlock_irqrestore(&fbi->lock, flags);
+
+	/* report anything more than 1% off the panel's nominal rate */
+	nominal = lcd_mode_refresh(mode, -1);
+	dev = ((int)fbi->refresh - (int)nominal)*1000/(int)nominal;
+	if(abs(dev) > 10)
+		printk(KERN_WARNING "lf1000fb: refresh %u.%03u Hz, "
+		       "%d.%d%% off nominal\n", fbi->refresh/1000,
+		       fbi->refresh%1000, dev/10, abs(dev)%10);
+	return NOTIFY_OK;
+}
+#endif
 
 static void lf1000fb_set_par(struct lf1000fb_info *fbi)
 {
 	int tvout_enable = fbi->fb.var.reserved[0];
 	int i, ret, div;
-	div = lf1000_CalcDivider(get_pll_freq(PLL1), DPC_DESIRED_CLOCK_HZ);
+	div = lcd_mode_divider(fbi->lcd_mode, get_pll_freq(PLL1));
 	if(div < 0) {
 		printk(KERN_ERR "dpc: failed to get a clock divider!\n");
 		return -EFAULT;
 	}	
-	dpc_SetClockPClkMode(PCLKMODE_ONLYWHENCPUACCESS);
-	dpc_SetClock0(DISPLAY_VID_PRI_VCLK_SOURCE, 
-		      div > 0 ? (div-1) : 0, 
-		      DISPLAY_VID_PRI_VCLK_DELAY,
-		      DISPLAY_VID_PRI_VCLK_INV,	
-		      DISPLAY_VID_PRI_VCLK_OUT_ENB);
-	dpc_SetClock1(DISPLAY_VID_PRI_VCLK2_SOURCE,
-		      DISPLAY_VID_PRI_VCLK2_DIV,
-		      0,	/* outclk delay */
-		      1);	/* outclk inv */
-	dpc_SetClockEnable(1);
-	ret = dpc_SetMode(DISPLAY_VID_PRI_OUTPUT_FORMAT,
-			  0, 	/* interlace */
-			  0, 	/* invert field */
-			  1,	/* RGB mode */
-			  DISPLAY_VID_PRI_SWAP_RGB,
-			  DISPLAY_VID_PRI_OUTORDER,
-			  0,	/* clip YC */
-			  0,	/* embedded sync */
-			  DISPLAY_VID_PRI_PAD_VCLK);
-	if(ret < 0)
-		printk(KERN_ALERT "dpc: failed to set display mode\n");
-	dpc_SetDither(DITHER_BYPASS, DITHER_BYPASS, DITHER_BYPASS);
-	ret = dpc_SetHSync(DISPLAY_VID_PRI_MAX_X_RESOLUTION,
-	  		   DISPLAY_VID_PRI_HSYNC_SWIDTH,
-			   DISPLAY_VID_PRI_HSYNC_FRONT_PORCH,
-		  	   DISPLAY_VID_PRI_HSYNC_BACK_PORCH,
-		  	   DISPLAY_VID_PRI_HSYNC_ACTIVEHIGH );
-	if(ret < 0)
-		printk(KERN_ALERT "dpc: failed to set HSync\n");
-	ret = dpc_SetVSync(DISPLAY_VID_PRI_MAX_Y_RESOLUTION,
-		  	   DISPLAY_VID_PRI_VSYNC_SWIDTH,
-		  	   DISPLAY_VID_PRI_VSYNC_FRONT_PORCH,
-		  	   DISPLAY_VID_PRI_VSYNC_BACK_PORCH,
-		  	   DISPLAY_VID_PRI_VSYNC_ACTIVEHIGH,
-		  	   1, 1, 1, 1);
-	if(ret < 0)
-		printk(KERN_ALERT "dpc: failed to set VSync\n");
-
-	dpc_SetDelay(0, 7, 7, 7, 4, 4, 4);
-	dpc_SetVSyncOffset(1, 1, 1, 1);
+	spin_lock_irq(&fbi->lock);
+	fbi->lcd_div = div;
+	fbi->lcd_div_pending = -1;
+	fbi->refresh = lcd_mode_refresh(fbi->lcd_mode, div);
+	spin_unlock_irq(&fbi->lock);
+	lf1000fb_load_lcd_mode(fbi->lcd_mode, div);
 	
 	dpc_SetDPCEnable(1);
+	if (fbi->irq >= 0)
+		dpc_SetInterruptEnable(1);
 	//END DPC PRI SETUP	
 	if (tvout_enable) {
 		enable_tvout_dpc(fbi);
@@ -2168,6 +5226,7 @@ static void lf1000fb_set_par(struct lf1000fb_info *fbi)
 	mlc_SetAddress(i, mlc_fb_addr);
 	}
 	set_mode(fbi);
+	fbi->orient_offset[0] = 0;	/* strides are reset below */
 	u32 hstride;
 	u32 vstride;
 	mlc_SetFormat(0, fbi->pix_fmt);
@@ -2175,8 +5234,13 @@ static void lf1000fb_set_par(struct lf1000fb_info *fbi)
 	hstride = fbi->fb.var.bits_per_pixel/8;
 	mlc_SetHStride(0, hstride);
 	printk(KERN_INFO "lf1000fb: New MLC0 HStride: %d\n", (ioread32(mlcregs + MLCHSTRIDE0)));
-	vstride = hstride*fbi->fb.var.xres;
+	vstride = fbi->fb.fix.line_length;
 	mlc_SetVStride(0, vstride);
+	spin_lock_irq(&fbi->lock);
+	fbi->pan_pending = 0;
+	spin_unlock_irq(&fbi->lock);
+	mlc_SetAddress(0, canvas_address(&fbi->fb, fbi->fb.var.xoffset,
+				     fbi->fb.var.yoffset));
 	printk(KERN_INFO "lf1000fb: New VStride: %d\n", (ioread32(mlcregs + MLCVSTRIDE0)));
 	mlc_SetLayerEnable(0, true);	
 	mlc_SetDirtyFlag(0);
@@ -2189,9 +5253,335 @@ static void lf1000fb_set_par(struct lf1000fb_info *fbi)
 }
 
 
+/*
+ * Move the layer 0 viewport.  Only the start address changes, and with
+ * the vsync IRQ it is latched in the next vblank so a scroll never tears.
+ */
+static int lf1000fb_pan_display(struct fb_var_screeninfo *var,
+				struct fb_info *info)
+{
+	struct lf1000fb_info *fbi = container_of(info, struct lf1000fb_info, fb);
+	u32 address;
+	unsigned long flags;
+
+	if(var->xoffset + info->var.xres > info->var.xres_virtual ||
+	   var->yoffset + info->var.yres > info->var.yres_virtual)
+		return -EINVAL;
+
+	address = canvas_address(info, var->xoffset, var->yoffset) +
+		  fbi->orient_offset[0];
+	if(fbi->irq < 0) {
+		flip_latch(fbi->mlc_base, 0, address);
+		if(tv_mirror(fbi))
+			flip_latch(fbi->mlc_base+0x400, 0, address);
+		return 0;
+	}
+	spin_lock_irqsave(&fbi->lock, flags);
+	fbi->pan_address = address;
+	fbi->pan_pending = 1;
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+/*
+ * TV framebuffer.  Its canvas comes out of the carveout and layer 0 of
+ * the TV MLC scans it; the other TV layers are set through its ioctls.
+ * The MLC helpers work on the shared mlcregs, so register access takes
+ * the LCD fb lock as well (always TV fb lock first).
+ */
+static u32 tv_address(struct lf1000fb_tv *tv, u32 xoffset, u32 yoffset)
+{
+	return mlc_fb_addr + tv->offset + yoffset*tv->fb.fix.line_length +
+		xoffset*(tv->fb.var.bits_per_pixel/8);
+}
+
+/* called with the LCD fb lock held */
+static void tv_program(struct lf1000fb_tv *tv)
+{
+	struct fb_var_screeninfo *var = &tv->fb.var;
+
+	mlcregs += 0x400;
+	mlc_SetFormat(0, tv->pix_fmt);
+	mlc_SetHStride(0, var->bits_per_pixel/8);
+	mlc_SetVStride(0, tv->fb.fix.line_length);
+	mlc_SetAddress(0, tv_address(tv, var->xoffset, var->yoffset));
+	mlc_SetPosition(0, 0, 0, var->xres, var->yres);
+	mlc_SetLayerEnable(0, 1);
+	mlc_SetDirtyFlag(0);
+	mlcregs -= 0x400;
+}
+
+static int lf1000fb_tv_set_par(struct fb_info *info)
+{
+	struct lf1000fb_tv *tv = container_of(info, struct lf1000fb_tv, fb);
+	struct fb_var_screeninfo *var = &info->var;
+	u32 bytespp;
+	int fmt;
+
+	/* same screen as the LCD, the upscaler stretches it to the TV */
+	var->xres = X_RESOLUTION;
+	var->yres = Y_RESOLUTION;
+	if(var->bits_per_pixel < 16)
+		var->bits_per_pixel = BITSPP;
+	fmt = mode_format(var);
+	if(fmt < 0) {
+		var->bits_per_pixel = BITSPP;
+		fmt = mode_format(var);
+	}
+	bytespp = var->bits_per_pixel/8;
+	if(var->xres_virtual < var->xres)
+		var->xres_virtual = var->xres;
+	if(var->yres_virtual < var->yres)
+		var->yres_virtual = var->yres;
+	if((u64)var->xres_virtual*bytespp*var->yres_virtual > tv->size) {
+		var->xres_virtual = var->xres;
+		var->yres_virtual = var->yres;
+	}
+	if(var->xres*bytespp*var->yres > tv->size) {
+		var->bits_per_pixel = BITSPP;
+		fmt = mode_format(var);
+		bytespp = BYTESPP;
+	}
+	if(var->xoffset + var->xres > var->xres_virtual)
+		var->xoffset = 0;
+	if(var->yoffset + var->yres > var->yres_virtual)
+		var->yoffset = 0;
+	var->vmode = FB_VMODE_NONINTERLACED;
+	info->fix.line_length = var->xres_virtual*bytespp;
+	tv->pix_fmt = fmt;
+
+	if(tv->parent->tv_extended) {
+		if(!lock_fb_info(&tv->parent->fb))
+			return -ENODEV;
+		tv_program(tv);
+		unlock_fb_info(&tv->parent->fb);
+	}
+	return 0;
+}
+
+static int lf1000fb_tv_pan_display(struct fb_var_screeninfo *var,
+				   struct fb_info *info)
+{
+	struct lf1000fb_tv *tv = container_of(info, struct lf1000fb_tv, fb);
+	struct lf1000fb_info *fbi = tv->parent;
+	unsigned long flags;
+	u32 address;
+
+	if(var->xoffset + info->var.xres > info->var.xres_virtual ||
+	   var->yoffset + info->var.yres > info->var.yres_virtual)
+		return -EINVAL;
+
+	address = tv_address(tv, var->xoffset, var->yoffset);
+	spin_lock_irqsave(&fbi->lock, flags);
+	if(fbi->tv_extended && fbi->field_irq) {
+		tv->pan_address = address;
+		tv->pan_pending = 1;
+	}
+	else if(fbi->tv_extended)
+		flip_latch(fbi->mlc_base+0x400, 0, address);
+	spin_unlock_irqrestore(&fbi->lock, flags);
+	return 0;
+}
+
+static int lf1000fb_tv_setcolreg(unsigned regno,
+		unsigned red, unsigned green, unsigned blue,
+		unsigned transp, struct fb_info *info)
+{
+	struct lf1000fb_tv *tv = container_of(info, struct lf1000fb_tv, fb);
+
+	if(regno >= 16)
+		return 1;
+	tv->pseudo_pal[regno] = chan_to_field(red, &info->var.red) |
+				chan_to_field(green, &info->var.green) |
+				chan_to_field(blue, &info->var.blue);
+	return 0;
+}
+
+/* TV layer properties, same commands as on the LCD fb */
+static int lf1000fb_tv_ioctl(struct fb_info *info, unsigned int cmd,
+			     unsigned long arg)
+{
+	struct lf1000fb_tv *tv = container_of(info, struct lf1000fb_tv, fb);
+	void __user *argp = (void __user *)arg;
+	union mlc_cmd c;
+	int result;
+
+	switch(cmd) {
+		case MLC_IOCSLAYERSTATE:
+		case MLC_IOCGLAYERSTATE:
+		if(copy_from_user((void *)&c, argp,
+				  sizeof(struct layer_state_cmd)))
+			return -EFAULT;
+		break;
+
+		case MLC_IOCSORIENT:
+		if(copy_from_user((void *)&c, argp, sizeof(struct orient_cmd)))
+			return -EFAULT;
+		break;
+
+		default:
+		return -ENOTTY;
+	}
+
+	if(!lock_fb_info(&tv->parent->fb))
+		return -ENODEV;
+	mlcregs += 0x400;
+	switch(cmd) {
+		case MLC_IOCSLAYERSTATE:
+		result = mlc_SetLayerState(&c.layer_state);
+		if(result == 0 && (c.layer_state.mask & LAYER_OVERLAYSIZE))
+			overlaysize_save(tv->parent, &tv->overlaysize,
+					 &c.layer_state.overlaysize);
+		break;
+
+		case MLC_IOCGLAYERSTATE:
+		result = mlc_GetLayerState(&c.layer_state);
+		if(result == 0 && c.layer_state.layer == MLC_VIDEO_LAYER &&
+		   overlaysize_load(tv->parent, &tv->overlaysize,
+				    &c.layer_state.overlaysize))
+			c.layer_state.mask |= LAYER_OVERLAYSIZE;
+		break;
+
+		default:
+		result = mlc_SetOrientation(&c.orient);
+		break;
+	}
+	mlcregs -= 0x400;
+	unlock_fb_info(&tv->parent->fb);
+
+	if(result == 0 && cmd == MLC_IOCGLAYERSTATE &&
+	   copy_to_user(argp, (void *)&c, sizeof(struct layer_state_cmd)))
+		return -EFAULT;
+	return result;
+}
+
+/* the first open takes the TV over from the LCD mirror */
+static int lf1000fb_tv_open(struct fb_info *info, int user)
+{
+	struct lf1000fb_tv *tv = container_of(info, struct lf1000fb_tv, fb);
+	struct lf1000fb_info *fbi = tv->parent;
+	int i;
+
+	if(tv->opens++)
+		return 0;
+	if(!lock_fb_info(&fbi->fb)) {
+		tv->opens--;
+		return -ENODEV;
+	}
+	spin_lock_irq(&fbi->lock);
+	fbi->tv_extended = 1;
+	memset(fbi->field_pair, 0, sizeof(fbi->field_pair));
+	tv->overlaysize = fbi->overlaysize;
+	spin_unlock_irq(&fbi->lock);
+	mlcregs += 0x400;
+	for(i = 1; i < MLC_NUM_LAYERS; i++) {
+		mlc_SetLayerEnable(i, 0);
+		mlc_SetDirtyFlag(i);
+	}
+	mlcregs -= 0x400;
+	tv_program(tv);
+	unlock_fb_info(&fbi->fb);
+	return 0;
+}
+
+/* and the last close hands it back */
+static int lf1000fb_tv_release(struct fb_info *info, int user)
+{
+	struct lf1000fb_tv *tv = container_of(info, struct lf1000fb_tv, fb);
+	struct lf1000fb_info *fbi = tv->parent;
+
+	if(--tv->opens)
+		return 0;
+	lock_fb_info(&fbi->fb);
+	spin_lock_irq(&fbi->lock);
+	fbi->tv_extended = 0;
+	tv->pan_pending = 0;
+	spin_unlock_irq(&fbi->lock);
+	if(fbi->fb.var.reserved[0])
+		enable_tvout_mlc(&fbi->fb);
+	unlock_fb_info(&fbi->fb);
+	return 0;
+}
+
+static struct fb_ops lf1000fb_tv_ops = {
+	.owner		= THIS_MODULE,
+	.fb_open	= lf1000fb_tv_open,
+	.fb_release	= lf1000fb_tv_release,
+	.fb_setcolreg	= lf1000fb_tv_setcolreg,
+	.fb_pan_display	= lf1000fb_tv_pan_display,
+	.fb_fillrect	= cfb_fillrect,
+	.fb_copyarea	= cfb_copyarea,
+	.fb_imageblit	= cfb_imageblit,
+	.fb_ioctl	= lf1000fb_tv_ioctl,
+	.fb_set_par	= lf1000fb_tv_set_par,
+};
+
+/* double buffered 16-bit canvas; not fatal if the carveout is full */
+static void lf1000fb_tv_probe(struct lf1000fb_info *fbi)
+{
+	struct lf1000fb_tv *tv;
+	u32 size = PAGE_ALIGN(X_RESOLUTION*Y_RESOLUTION*BYTESPP*2);
+
+	tv = kzalloc(sizeof(struct lf1000fb_tv), GFP_KERNEL);
+	if(!tv)
+		return;
+	if(carveout_alloc(fbi, size, &tv->offset) < 0) {
+		printk(KERN_WARNING "lf1000fb: no room for a TV framebuffer\n");
+		kfree(tv);
+		return;
+	}
+	tv->parent = fbi;
+	tv->size = size;
+
+	tv->fb.fix = fbi->fb.fix;
+	strcpy(tv->fb.fix.id, "lf1000-tv");
+	tv->fb.fix.smem_start = mlc_fb_addr + tv->offset;
+	tv->fb.fix.smem_len = size;
+	tv->fb.fix.ywrapstep = 0;
+	tv->fb.screen_base = fbi->fbmem + tv->offset;
+	tv->fb.var.bits_per_pixel = BITSPP;
+	tv->fb.var.yres_virtual = Y_RESOLUTION*2;
+	tv->fb.var.activate = FB_ACTIVATE_NOW;
+	tv->fb.var.height = -1;
+	tv->fb.var.width = -1;
+	tv->fb.flags = FBINFO_DEFAULT | FBINFO_HWACCEL_YPAN;
+	tv->fb.fbops = &lf1000fb_tv_ops;
+	tv->fb.pseudo_palette = tv->pseudo_pal;
+	tv->fb.node = -1;
+	lf1000fb_tv_set_par(&tv->fb);
+	fb_alloc_cmap(&tv->fb.cmap, 16, 0);
+
+	if(register_framebuffer(&tv->fb) < 0) {
+		printk(KERN_WARNING "lf1000fb: can't register TV framebuffer\n");
+		fb_dealloc_cmap(&tv->fb.cmap);
+		carveout_free(fbi, tv->offset);
+		kfree(tv);
+		return;
+	}
+	fbi->tv = tv;
+}
+
+static void lf1000fb_tv_remove(struct lf1000fb_info *fbi)
+{
+	struct lf1000fb_tv *tv = fbi->tv;
+
+	if(!tv)
+		return;
+	unregister_framebuffer(&tv->fb);
+	fb_dealloc_cmap(&tv->fb.cmap);
+	carveout_free(fbi, tv->offset);
+	fbi->tv = NULL;
+	kfree(tv);
+}
+
 struct fb_ops lf1000fb_ops = {
 	.owner		= THIS_MODULE,
+	.fb_open	= lf1000fb_open,
+	.fb_release	= lf1000fb_release,
+	.fb_read	= lf1000fb_read,
+	.fb_write	= lf1000fb_write,
 	.fb_setcolreg	= lf1000fb_setcolreg,
+	.fb_pan_display	= lf1000fb_pan_display,
 	.fb_fillrect	= cfb_fillrect,
 	.fb_copyarea	= cfb_copyarea,
 	.fb_imageblit	= cfb_imageblit,
@@ -2252,6 +5642,57 @@ static int __init lf1000fb_probe(struct platform_device *pdev)
 	if(!dpcregs) {
 		printk(KERN_INFO "lf1000fb: **************can't remap dpcregs\n");
 	}
+	fbi->mlc_base = mlcregs;
+	mlc_lock = &fbi->lock;
+	fbi->dpc_base = dpcregs;
+
+	fbi->debugfs = debugfs_create_dir("lf1000fb", NULL);
+	if(fbi->debugfs) {
+		debugfs_create_file("registers", S_IRUGO, fbi->debugfs, fbi,
+				    &snapshot_fops);
+		debugfs_create_bool("rw_bytewise", S_IRUGO|S_IWUSR,
+				    fbi->debugfs, &rw_bytewise);
+	}
+#ifdef LF1000FB_MMIO_TRACE
+	mmio_trace_mlc = mlcregs;
+	mmio_trace_dpc = dpcregs;
+	if(fbi->debugfs) {
+		debugfs_create_file("mmio_trace", S_IRUGO|S_IWUSR,
+				    fbi->debugfs, NULL, &mmio_trace_fops);
+		debugfs_create_bool("mmio_trace_enable", S_IRUGO|S_IWUSR,
+				    fbi->debugfs, &mmio_trace_enable);
+	}
+#endif
+
+	/* vsync interrupt and TV out worker */
+	spin_lock_init(&fbi->lock);
+	kref_init(&fbi->ref);
+	init_waitqueue_head(&fbi->vsync_wait);
+	fbi->wq = create_singlethread_workqueue("lf1000fb");
+	if(fbi->wq == NULL) {
+		ret = -ENOMEM;
+		goto fail_wq;
+	}
+	INIT_DELAYED_WORK(&fbi->tvout_work, lf1000fb_tvout_work);
+	fbi->tvout_step = TVOUT_IDLE;
+	fbi->tvout_status = TVOUT_ENABLE ? TVOUT_STATUS_ON : TVOUT_STATUS_OFF;
+	fbi->tvout_profile = &tvout_profiles[tvout_standard];
+	fbi->lcd_mode = &lf1000fb_lcd_modes[0];
+	fbi->lcd_div_pending = -1;
+
+	fbi->irq = platform_get_irq(pdev, 0);
+	if(fbi->irq >= 0 && request_irq(fbi->irq, lf1000fb_vsync_irq,
+				IRQF_DISABLED, "lf1000-fb", fbi)) {
+		printk(KERN_WARNING "lf1000fb: can't get vsync IRQ %d\n",
+		       fbi->irq);
+		fbi->irq = -1;
+	}
+	/* the TV DPC may raise its field interrupt on a line of its own */
+	fbi->tv_irq = platform_get_irq(pdev, 1);
+	if(fbi->tv_irq >= 0 && (fbi->irq < 0 || fbi->tv_irq == fbi->irq ||
+	   request_irq(fbi->tv_irq, lf1000fb_vsync_irq, IRQF_DISABLED,
+		       "lf1000-fb-tv", fbi)))
+		fbi->tv_irq = -1;
 	
 	
 	
@@ -2261,12 +5702,17 @@ static int __init lf1000fb_probe(struct platform_device *pdev)
 
 
 	fbi->fb.var.bits_per_pixel=BITSPP;
+	fbi->fb.var.yres_virtual=CONSOLE_YRES_VIRTUAL;
 	fbi->fb.var.reserved[0]=TVOUT_ENABLE; 
 
 	
 	
 	//Do check var here
 
+#ifdef LF1000FB_CONVERT_SELFTEST
+	convert_selftest();
+#endif
+
 	/*Set Mode*/
 	/*Set MLC*/
 	lf1000fb_set_par(fbi);
@@ -2276,7 +5722,8 @@ static int __init lf1000fb_probe(struct platform_device *pdev)
 /*
  * Initialise other static fb parameters.
  */
-	fbi->fb.flags			= FBINFO_DEFAULT;
+	/* no YWRAP: the MLC scans linearly and can't wrap at the canvas end */
+	fbi->fb.flags			= FBINFO_DEFAULT | FBINFO_HWACCEL_YPAN;
 	fbi->fb.node			= -1;
 	fbi->fb.var.nonstd		= 0;
 	fbi->fb.var.activate		= FB_ACTIVATE_NOW;
@@ -2309,9 +5756,28 @@ static int __init lf1000fb_probe(struct platform_device *pdev)
 		goto fail_register;
 	}
 
+	lf1000fb_tv_probe(fbi);
+
+#ifdef CONFIG_CPU_FREQ
+	fbi->freq_transition.notifier_call = lf1000fb_freq_transition;
+	cpufreq_register_notifier(&fbi->freq_transition,
+				  CPUFREQ_TRANSITION_NOTIFIER);
+#endif
 	return 0;
 
 fail_register:
+	if(fbi->irq >= 0) {
+		dpc_SetInterruptEnable(0);
+		dpcregs += 0x400;
+		dpc_SetInterruptEnable(0);
+		dpcregs -= 0x400;
+		free_irq(fbi->irq, fbi);
+	}
+	if(fbi->tv_irq >= 0)
+		free_irq(fbi->tv_irq, fbi);
+	destroy_workqueue(fbi->wq);
+fail_wq:
+	debugfs_remove_recursive(fbi->debugfs);
 	iounmap(fbi->fbmem);
 	fb_dealloc_cmap(&fbi->fb.cmap);
 	framebuffer_release(&fbi->fb);
@@ -2321,19 +5787,48 @@ fail_fbmem:
 	return ret;
 }
 
+/* last reference gone: the device and every fence or control page */
+static void lf1000fb_free(struct kref *ref)
+{
+	struct lf1000fb_info *fbi = container_of(ref, struct lf1000fb_info, ref);
+
+	fb_dealloc_cmap(&fbi->fb.cmap);
+	framebuffer_release(&fbi->fb);
+
+	kfree(fbi);
+}
+
 static int lf1000fb_remove(struct platform_device *pdev)
 {
 	struct lf1000fb_info *fbi = platform_get_drvdata(pdev);
 	
 	printk(KERN_INFO "lf1000fb: unloading\n");
 
+#ifdef CONFIG_CPU_FREQ
+	cpufreq_unregister_notifier(&fbi->freq_transition,
+				    CPUFREQ_TRANSITION_NOTIFIER);
+#endif
+	cancel_delayed_work_sync(&fbi->tvout_work);
+	destroy_workqueue(fbi->wq);
+	if(fbi->irq >= 0) {
+		dpc_SetInterruptEnable(0);
+		dpcregs += 0x400;
+		dpc_SetInterruptEnable(0);
+		dpcregs -= 0x400;
+		free_irq(fbi->irq, fbi);
+	}
+	if(fbi->tv_irq >= 0)
+		free_irq(fbi->tv_irq, fbi);
+	lf1000fb_tv_remove(fbi);
+	debugfs_remove_recursive(fbi->debugfs);
 	iounmap(fbi->fbmem);
 
 	unregister_framebuffer(&fbi->fb);
-	fb_dealloc_cmap(&fbi->fb.cmap);
-	framebuffer_release(&fbi->fb);
 
-	kfree(fbi);
+	/* wake fence pollers, they see removed and stop touching fbi */
+	fbi->removed = 1;
+	wake_up_interruptible_all(&fbi->vsync_wait);
+	kref_put(&fbi->ref, lf1000fb_free);
 	return 0;
 }
 
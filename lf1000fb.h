@@ -20,6 +20,8 @@
  */
 #define X_RESOLUTION		320
 #define Y_RESOLUTION		240
+/* boot canvas height, so fbcon can scroll by panning */
+#define CONSOLE_YRES_VIRTUAL	(Y_RESOLUTION*4)
 
 #define PALETTE_CLEAR		0x80000000
 #define MLCCONTROL0			0x24 //0x4024
@@ -101,12 +103,11 @@
 #define MLCTPCOLOR1				0x64
 #define MLCTPCOLOR0				0x30
 
-#define MLCINVCOLOR0			0x24
-#define MLCINVCOLOR1			0x44
-#define MLCINVCOLOR2			0x64
+#define MLCINVCOLOR0			0x34
+#define MLCINVCOLOR1			0x68	/* the video layer has none */
 
-#define MLCHSCALE				0x9C
-#define MLCVSCALE				0xA0
+#define MLCHSCALE				0xA0
+#define MLCVSCALE				0xA4
 
 
 #define MLCLEFTRIGHT0_0			0x14
@@ -115,8 +116,8 @@
 #define MLCTOPBOTTOM0_0			0x18
 #define MLCTOPBOTTOM1_0			0x4C
 
-#define MLCADDRESSCB			0x8C
-#define MLCADDRESSCR			0x90
+#define MLCADDRESSCB			0x90
+#define MLCADDRESSCR			0x94
 
 /* MLC RGB Layer n Control Register (MLCCONTROLn) */
 #define GRP3DENB                8       /* set layer as output of 3D core */
@@ -264,15 +265,349 @@ struct overlaysize_cmd {
 	unsigned int dstheight;
 };
 
+/*
+ * Vblank counts, from MLC_IOCQVBLANK, in flip targets and in completion
+ * records, are the low 31 bits of the driver's vsync counter, so the
+ * ioctl result is never mistaken for an error.  They wrap to 0 after 2^31
+ * vsyncs, over a year at 60 Hz: compare them modulo 2^31.  The TV field
+ * count from MLC_IOCQFIELD is kept to 31 bits the same way; its low bit
+ * still tells odd from even fields.
+ */
+#define MLC_VBLANK_MASK		0x7FFFFFFF
+
+/* queue a flip of layer to address, latched for vsync target */
+struct flip_cmd {
+	unsigned int layer;
+	unsigned int address;
+	unsigned int target;	/* vblank count to show on, 0 = next vsync */
+	unsigned int cookie;	/* returned in the completion record */
+	unsigned int flags;	/* FLIP_FENCE, FLIP_FIELD_* */
+	int fence;		/* out: fence fd, -1 if none was asked for */
+};
+
+/* return a fence fd that polls readable once the previous buffer is free */
+#define FLIP_FENCE		(1<<0)
+/* with TV out on, latch only for the start of that interlaced field */
+#define FLIP_FIELD_ODD		(1<<1)
+#define FLIP_FIELD_EVEN		(1<<2)
+
+/*
+ * 480i from two half-height buffers: with TV out on, the TV MLC shows
+ * odd on odd fields and even on even fields; the LCD shows odd.  Both
+ * addresses 0 turns it off.
+ */
+struct field_pair_cmd {
+	unsigned int layer;
+	unsigned int odd;
+	unsigned int even;
+};
+
+/* completion of a queued flip */
+struct flip_done_cmd {
+	unsigned int layer;	/* in: layer to collect from */
+	unsigned int cookie;
+	unsigned int address;
+	unsigned int sequence;	/* vblank count the buffer was first shown on */
+	unsigned int sec;	/* timestamp of that vsync */
+	unsigned int usec;
+};
+
+/* all per-layer properties, set or fetched in one ioctl */
+struct layer_state_cmd {
+	unsigned int layer;
+	unsigned int mask;		/* LAYER_* fields to apply / valid */
+	unsigned int enable;
+	unsigned int address;
+	unsigned int format;		/* RGB layers only */
+	unsigned int hstride;		/* RGB layers only */
+	unsigned int vstride;
+	struct position_cmd position;	/* right, bottom exclusive */
+	struct overlaysize_cmd overlaysize; /* video layer only */
+	unsigned int alpha;
+	unsigned int tpcolor;		/* RGB layers only */
+	unsigned int blend;
+	unsigned int transp;		/* RGB layers only */
+};
+
+#define LAYER_ENABLE		(1<<0)
+#define LAYER_ADDRESS		(1<<1)
+#define LAYER_FORMAT		(1<<2)
+#define LAYER_HSTRIDE		(1<<3)
+#define LAYER_VSTRIDE		(1<<4)
+#define LAYER_POSITION		(1<<5)
+#define LAYER_OVERLAYSIZE	(1<<6)
+#define LAYER_ALPHA		(1<<7)
+#define LAYER_TPCOLOR		(1<<8)
+#define LAYER_BLEND		(1<<9)
+#define LAYER_TRANSP		(1<<10)
+#define LAYER_DIRTY		(1<<31)	/* set the dirty flag when done */
+
+#define LAYER_RGB_ONLY		(LAYER_FORMAT|LAYER_HSTRIDE|LAYER_TPCOLOR| \
+				 LAYER_TRANSP)
+
+/*
+ * Mirror an RGB layer during scanout.  address and the positive strides
+ * describe the image as stored; the MLC is given the opposite corner
+ * and negated strides.  Flips queued afterwards are offset the same way.
+ */
+struct orient_cmd {
+	unsigned int layer;
+	unsigned int flags;		/* ORIENT_* */
+	unsigned int address;
+	unsigned int hstride;		/* bytes per pixel */
+	unsigned int vstride;		/* bytes per line */
+	unsigned int width;		/* pixels */
+	unsigned int height;
+};
+
+#define ORIENT_MIRROR_X		(1<<0)	/* right to left */
+#define ORIENT_FLIP_Y		(1<<1)	/* bottom to top */
+
+/* convert a rectangle between two buffers in the framebuffer memory */
+struct convert_cmd {
+	unsigned int src_offset;	/* byte offset into the fb memory */
+	unsigned int src_stride;	/* bytes per line */
+	unsigned int src_format;	/* MLC format code, see Formats above */
+	unsigned int src_bpp;		/* bytes per pixel, tells 888 from 8888 */
+	unsigned int dst_offset;
+	unsigned int dst_stride;
+	unsigned int dst_format;
+	unsigned int dst_bpp;
+	unsigned int width;
+	unsigned int height;
+	unsigned int flags;		/* CONVERT_DITHER */
+};
+
+/* ordered dither when a channel loses depth */
+#define CONVERT_DITHER		(1<<0)
+
+/*
+ * Copy or convert rectangles of an image in user memory straight into
+ * the fb memory.  The source pages are pinned for the call, so there is
+ * no staging copy.
+ */
+#define BLIT_MAX_RECTS		8
+#define BLIT_MAX_PAGES		512	/* 2MB of source per call */
+
+struct blit_rect {
+	unsigned int sx;
+	unsigned int sy;
+	unsigned int dx;
+	unsigned int dy;
+	unsigned int width;
+	unsigned int height;
+};
+
+struct user_blit_cmd {
+	unsigned long src;		/* user address of the source image */
+	unsigned int src_stride;
+	unsigned int src_format;
+	unsigned int src_bpp;
+	unsigned int dst_offset;	/* byte offset into the fb memory */
+	unsigned int dst_stride;
+	unsigned int dst_format;
+	unsigned int dst_bpp;
+	unsigned int flags;		/* CONVERT_DITHER, BLIT_VSYNC */
+	unsigned int count;
+	struct blit_rect rects[BLIT_MAX_RECTS];
+};
+
+/* start writing on the next vblank */
+#define BLIT_VSYNC		(1<<1)
+
+/*
+ * One operation of a blit batch.  Both buffers are in the fb memory;
+ * a batch runs in order, so later operations see earlier results.
+ */
+struct blit_op {
+	unsigned int op;		/* BLIT_OP_* */
+	unsigned int src_offset;	/* byte offset into the fb memory */
+	unsigned int src_stride;
+	unsigned int src_format;	/* BLIT_OP_CONVERT only */
+	unsigned int src_bpp;
+	unsigned int dst_offset;
+	unsigned int dst_stride;
+	unsigned int dst_format;	/* BLIT_OP_CONVERT only */
+	unsigned int dst_bpp;		/* copy and fill: 1 to 4 */
+	unsigned int width;		/* pixels */
+	unsigned int height;
+	unsigned int color;		/* fill: pixel in the dst format */
+	unsigned int flags;		/* CONVERT_DITHER */
+};
+
+#define BLIT_OP_COPY		0	/* same format, may overlap */
+#define BLIT_OP_FILL		1
+#define BLIT_OP_BLEND		2	/* ARGB8888 src over RGB565 dst */
+#define BLIT_OP_CONVERT		3
+
+#define BLIT_MAX_OPS		64
+
+struct blit_list_cmd {
+	unsigned long ops;		/* user address of the blit_op array */
+	unsigned int count;
+};
+
+/*
+ * Control page, mmap()ed from the fd MLC_IOCGCTLPAGE returns.  To update,
+ * fill slot[(seq+1) & 1], set that slot's seq to seq+1, then store seq+1
+ * in ctl_page.seq.  At each vblank the driver applies the slot named by
+ * the newest seq, once, and echoes it in applied.
+ */
+struct ctl_layer {
+	unsigned int mask;		/* CTL_* fields to apply */
+	unsigned int address;
+	int left;
+	int top;
+	int right;			/* exclusive */
+	int bottom;			/* exclusive */
+	unsigned int alpha;
+	unsigned int tpcolor;		/* RGB layers only */
+};
+
+#define CTL_ADDRESS		(1<<0)
+#define CTL_POSITION		(1<<1)
+#define CTL_ALPHA		(1<<2)
+#define CTL_TPCOLOR		(1<<3)
+
+struct ctl_slot {
+	unsigned int seq;
+	struct ctl_layer layer[MLC_NUM_LAYERS];
+};
+
+struct ctl_page {
+	unsigned int seq;		/* written by the application */
+	unsigned int applied;		/* written by the driver */
+	struct ctl_slot slot[2];
+};
+
+/* rectangle in pixels of the visible framebuffer */
+struct rect_cmd {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+/* hardware sprite / cursor on layer 1 */
+struct sprite_cmd {
+	unsigned int address;	/* image in fb memory (physical address) */
+	unsigned int width;
+	unsigned int height;
+	unsigned int format;	/* MLC RGB format code */
+	unsigned int bpp;	/* bytes per pixel */
+	unsigned int flags;	/* SPRITE_* */
+	unsigned int tpcolor;	/* colour key for SPRITE_COLORKEY */
+	unsigned int alpha;	/* 0-15 for SPRITE_ALPHA */
+	int x;			/* may be partly or fully off screen, */
+	int y;			/* within +-SPRITE_POS_MAX */
+};
+
+#define SPRITE_ENABLE		(1<<0)
+#define SPRITE_COLORKEY		(1<<1)
+#define SPRITE_ALPHA		(1<<2)
+
+#define SPRITE_POS_MAX		0x10000
+
+struct sprite_pos_cmd {
+	int x;
+	int y;
+};
+
+/* layer animation track, interpolated by the driver on every vsync */
+#define ANIM_MAX_KEYS		8
+
+struct anim_key {
+	unsigned int frame;	/* vsyncs after the start of the track */
+	int x;			/* top left corner of the layer */
+	int y;
+	unsigned int alpha;	/* 0-15 */
+	unsigned int width;	/* on screen size, ANIM_SCALE only */
+	unsigned int height;
+};
+
+struct anim_cmd {
+	unsigned int layer;
+	unsigned int flags;	/* ANIM_* */
+	unsigned int count;	/* keys used, 0 stops the running track */
+	unsigned int srcwidth;	/* video source size for ANIM_SCALE */
+	unsigned int srcheight;
+	struct anim_key keys[ANIM_MAX_KEYS];
+};
+
+#define ANIM_POSITION		(1<<0)
+#define ANIM_ALPHA		(1<<1)
+#define ANIM_SCALE		(1<<2)	/* video layer only */
+
+/*
+ * Layer composition profile.  With COMPOSE_BLEND the MLC mixes a layer
+ * over what is below it with weight alpha/15, with COMPOSE_COLORKEY it
+ * drops layer pixels equal to tpcolor (RGB888).  Colour key is not
+ * available on the video layer.
+ */
+struct compose_cmd {
+	unsigned int layer;
+	unsigned int mode;	/* COMPOSE_* */
+	unsigned int alpha;	/* 0-15 */
+	unsigned int tpcolor;	/* colour key, RGB888 */
+	unsigned int mismatch;	/* out: TV MLC differs from the LCD MLC */
+};
+
+#define COMPOSE_OPAQUE		0
+#define COMPOSE_BLEND		(1<<0)
+#define COMPOSE_COLORKEY	(1<<1)
+
+/* double-buffered scanout of 3D core colour buffers on an RGB layer */
+struct scanout3d_cmd {
+	unsigned int layer;	/* 0 or 1 */
+	unsigned int enable;	/* 0 tears the buffers down again */
+	unsigned int width;
+	unsigned int height;
+	unsigned int format;	/* MLC RGB format code */
+	unsigned int bpp;	/* bytes per pixel */
+	unsigned int offset[2];	/* out: buffer offsets for mmap */
+	unsigned int address[2];/* out: physical addresses for the 3D core */
+};
+
+/*
+ * Layer ownership.  Once a process claims a layer, only it and the
+ * process it leases the layer to may change that layer; claiming layer 0
+ * also guards the MLC/DPC wide settings.  Claims go away on last close.
+ */
+struct lease_cmd {
+	unsigned int layer;
+	int pid;		/* lessee, 0 ends the lease */
+};
+
 union mlc_cmd {
 	struct position_cmd position;
 	struct screensize_cmd screensize;
 	struct overlaysize_cmd overlaysize;
+	struct flip_cmd flip;
+	struct flip_done_cmd flip_done;
+	struct layer_state_cmd layer_state;
+	struct convert_cmd convert;
+	struct rect_cmd rect;
+	struct sprite_cmd sprite;
+	struct sprite_pos_cmd sprite_pos;
+	struct anim_cmd anim;
+	struct compose_cmd compose;
+	struct scanout3d_cmd scanout3d;
+	struct lease_cmd lease;
+	struct field_pair_cmd field_pair;
+	struct orient_cmd orient;
+	struct user_blit_cmd user_blit;
+	struct blit_list_cmd blit_list;
 };
 
+#ifdef __KERNEL__
 //normally in arch/arm/lf1000/mach/mlc.h
 int mlc_GetAddressCb(u8 layer, int *addr);
 int mlc_GetAddressCr(u8 layer, int *addr);
+int mlc_SetLayerState(struct layer_state_cmd *st);
+int mlc_GetLayerState(struct layer_state_cmd *st);
+s32 mlc_OrientOffset(struct orient_cmd *oc);
+int mlc_SetOrientation(struct orient_cmd *oc);
+#endif /* __KERNEL__ */
 
 
 //normally in include/linux/lf1000
@@ -344,6 +679,52 @@ int mlc_GetAddressCr(u8 layer, int *addr);
 
 #define FBIO_ENABLE_TVOUT	_IO(MLC_IOC_MAGIC,  48) //PATCH
 #define FBIO_DISABLE_TVOUT	_IO(MLC_IOC_MAGIC,  49) //PATCH
+#define FBIO_QTVOUT_STATUS	_IO(MLC_IOC_MAGIC,  50)
+
+#define MLC_IOCSFLIP		_IOWR(MLC_IOC_MAGIC, 51, struct flip_cmd *)
+#define MLC_IOCGFLIPDONE	_IOWR(MLC_IOC_MAGIC, 52, struct flip_done_cmd *)
+#define MLC_IOCQVBLANK		_IO(MLC_IOC_MAGIC,  53)	/* vsyncs so far */
+#define MLC_IOCSLAYERSTATE	_IOW(MLC_IOC_MAGIC, 54, struct layer_state_cmd *)
+#define MLC_IOCGLAYERSTATE	_IOWR(MLC_IOC_MAGIC, 55, struct layer_state_cmd *)
+#define MLC_IOCSCONVERT		_IOW(MLC_IOC_MAGIC, 56, struct convert_cmd *)
+/* read()/write() window, file offsets then index the packed rectangle */
+#define MLC_IOCSRWRECT		_IOW(MLC_IOC_MAGIC, 57, struct rect_cmd *)
+#define MLC_IOCSSPRITE		_IOW(MLC_IOC_MAGIC, 58, struct sprite_cmd *)
+#define MLC_IOCSSPRITEPOS	_IOW(MLC_IOC_MAGIC, 59, struct sprite_pos_cmd *)
+#define MLC_IOCSANIM		_IOW(MLC_IOC_MAGIC, 60, struct anim_cmd *)
+#define MLC_IOCQANIM		_IO(MLC_IOC_MAGIC,  61)	/* 1 while running */
+#define MLC_IOCTANIMWAIT	_IO(MLC_IOC_MAGIC,  62)	/* sleep until done */
+#define MLC_IOCSCOMPOSE		_IOW(MLC_IOC_MAGIC, 63, struct compose_cmd *)
+#define MLC_IOCGCOMPOSE		_IOWR(MLC_IOC_MAGIC, 64, struct compose_cmd *)
+#define MLC_IOCS3DSCANOUT	_IOWR(MLC_IOC_MAGIC, 65, struct scanout3d_cmd *)
+#define MLC_IOCT3DFLIP		_IO(MLC_IOC_MAGIC,  66)	/* back buffer, once free */
+#define MLC_IOCSTVSTANDARD	_IO(MLC_IOC_MAGIC,  67)	/* while TV out is off */
+#define MLC_IOCQREFRESH		_IO(MLC_IOC_MAGIC,  68)	/* LCD refresh in mHz */
+#define MLC_IOCTCLAIM		_IO(MLC_IOC_MAGIC,  69)
+#define MLC_IOCTRELEASE		_IO(MLC_IOC_MAGIC,  70)
+#define MLC_IOCSLEASE		_IOW(MLC_IOC_MAGIC, 71, struct lease_cmd *)
+#define MLC_IOCQOWNER		_IO(MLC_IOC_MAGIC,  72)	/* owner pid or 0 */
+#define MLC_IOCSFIELDPAIR	_IOW(MLC_IOC_MAGIC, 73, struct field_pair_cmd *)
+#define MLC_IOCQFIELD		_IO(MLC_IOC_MAGIC,  74)	/* TV fields, 31 bits */
+#define MLC_IOCSORIENT		_IOW(MLC_IOC_MAGIC, 75, struct orient_cmd *)
+#define MLC_IOCSUSERBLIT	_IOW(MLC_IOC_MAGIC, 76, struct user_blit_cmd *)
+#define MLC_IOCSBLITLIST	_IOW(MLC_IOC_MAGIC, 77, struct blit_list_cmd *)
+#define MLC_IOCGCTLPAGE		_IO(MLC_IOC_MAGIC,  78)	/* returns an fd */
+
+/* TV out status as returned by FBIO_QTVOUT_STATUS */
+enum {
+	TVOUT_STATUS_OFF	= 0,
+	TVOUT_STATUS_ON		= 1,
+	TVOUT_STATUS_ENABLING	= 2,	/* bring-up queued or in progress */
+	TVOUT_STATUS_DISABLING	= 3,
+};
+
+/* TV out video standards, MLC_IOCSTVSTANDARD or lf1000fb_tv=ntsc|pal */
+enum {
+	TVOUT_NTSC		= 0,
+	TVOUT_PAL		= 1,
+	TVOUT_NUM_STANDARDS,
+};
 
 
 
@@ -435,6 +816,10 @@ int mlc_GetAddressCr(u8 layer, int *addr);
 /* registers (offsets from DPCBASE) for internal video encoder */
 
 #define VENCCTRLA		0x002 
+#define VENCFMT		4	/* video standard, 2 bits */
+#define VENCPED		3	/* 7.5 IRE pedestal */
+#define VENC_FMT_NTSC	0
+#define VENC_FMT_PAL	1	/* B/D/G/H/I */
 #define VENCCTRLB		0x004 
 #define VENCSCH 		0x008 
 #define VENCHUE 		0x00A 
@@ -536,6 +921,242 @@ enum {
 	#define DISPLAY_VID_PRI_VSYNC_BACK_PORCH	17
 	#define DISPLAY_VID_PRI_VSYNC_ACTIVEHIGH	0
 
+/*
+ * Driver internals.  Everything above is register layout and ioctl ABI,
+ * which the host tools in tools/ include as well.
+ */
+#ifdef __KERNEL__
+
+/* TV out bring-up state machine steps, run from tvout_work */
+enum tvout_step {
+	TVOUT_IDLE = 0,
+	TVOUT_DPC_SETUP,	/* clocks, sync and mode of the 2nd DPC */
+	TVOUT_ENC_RESET,	/* encoder reset sequence, one step per tick */
+	TVOUT_ENC_SETUP,	/* encoder mode, color, timing, upscaler */
+	TVOUT_SWITCH,		/* start 2nd MLC/DPC on an LCD vsync */
+	TVOUT_SHUTDOWN,		/* stop 2nd MLC/DPC on an LCD vsync */
+};
+
+#define TVOUT_ENC_RESET_STEPS	5
+
+/*
+ * TV out profiles: register images for the 2nd DPC sync generator and
+ * the internal encoder, built at compile time from the timing numbers.
+ */
+struct lf1000fb_sync_image {
+	u16 total;
+	u16 swidth;
+	u16 astart;
+	u16 aend;
+};
+
+/* same limits as dpc_SetHSync()/dpc_SetVSync(), checked at build time */
+#define SYNC_IMAGE(active, sw, fp, bp) \
+	{ (sw)+(bp)+(fp)+(active)-1 + \
+	  BUILD_BUG_ON_ZERO((active)+(sw)+(fp)+(bp) > 65536 || (sw) == 0), \
+	  (sw)-1, (sw)+(bp)-1, (sw)+(bp)+(active)-1 }
+
+struct lf1000fb_venc_image {
+	u16 hsvs0;
+	u16 hsos;
+	u16 hsoe;
+	u16 vsos;
+	u16 vsoe;
+};
+
+#define VENC_IMAGE(hs, he, vs, ve) \
+	{ (((he)-1)>>8)&0x7, (hs)-1, (he)-1, (vs), (ve) }
+
+struct lf1000fb_upscale_image {
+	u16 src;
+	u16 con0;
+	u16 con1;
+	u16 con2;
+};
+
+#define UPSCALE_RATIO(src, dst)	((((src)-1)<<11)/((dst)-1))
+#define UPSCALE_IMAGE(src, dst) \
+	{ (src), ((UPSCALE_RATIO(src, dst) & 0xFF)<<8)|1, \
+	  UPSCALE_RATIO(src, dst)>>8, (src)-1 }
+
+struct lf1000fb_tvout_profile {
+	const char			*name;
+	u16				width;	/* active pixels per line */
+	struct lf1000fb_sync_image	hsync;
+	struct lf1000fb_sync_image	vsync;	/* odd field */
+	struct lf1000fb_sync_image	evsync;	/* even field */
+	u8				venc_fmt;
+	u8				venc_ped;
+	struct lf1000fb_venc_image	venc;
+};
+
+/*
+ * LCD mode database.  Each mode is a register image for the primary DPC
+ * built from its timing at compile time; only the PLL1 divider for the
+ * pixel clock is worked out when the mode is applied.
+ */
+#define DPC_CTRL0_MASK	((1<<RGBMODE)|(1<<SCANMODE)|(1<<SEAVENB)|\
+			 (0xF<<DELAYRGB)|(1<<POLFIELD)|(1<<POLVSYNC)|\
+			 (1<<POLHSYNC))
+#define DPC_CTRL0_IMAGE(interlace, inv_field, rgb_mode, embedded_sync, \
+			delay_rgb, inv_vsync, inv_hsync) \
+	((((interlace)<<SCANMODE)|((inv_field)<<POLFIELD)| \
+	  ((rgb_mode)<<RGBMODE)|((embedded_sync)<<SEAVENB)| \
+	  ((delay_rgb)<<DELAYRGB)|((inv_vsync)<<POLVSYNC)| \
+	  ((inv_hsync)<<POLHSYNC)) + \
+	 BUILD_BUG_ON_ZERO((delay_rgb) >= 16))
+
+#define DPC_CTRL1_MASK	0xAFFF
+#define DPC_CTRL1_IMAGE(format, ycorder, clip_yc, swap_rb, r, g, b) \
+	((((format)<<FORMAT1)|((ycorder)<<YCORDER)| \
+	  ((clip_yc) ? 0 : (1<<YCRANGE))|((swap_rb)<<SWAPRB)| \
+	  ((r)<<RDITHER)|((g)<<GDITHER)|((b)<<BDITHER)) + \
+	 BUILD_BUG_ON_ZERO((format) >= 14 || (ycorder) > 3 || \
+			   (r) >= 4 || (g) >= 4 || (b) >= 4))
+
+#define DPC_CTRL2_MASK	(3<<PADCLKSEL)
+#define DPC_CTRL2_IMAGE(clock) \
+	(((clock)<<PADCLKSEL) + BUILD_BUG_ON_ZERO((clock) > 3))
+
+#define DPC_DELAY_IMAGE(hs, vs, de) \
+	((((de)<<DELAYDE)|((vs)<<DELAYVS)|((hs)<<DELAYHS)) + \
+	 BUILD_BUG_ON_ZERO((hs) >= 16 || (vs) >= 16 || (de) >= 16))
+
+/* the divider field is filled in from PLL1 when the mode is applied */
+#define DPC_CLKGEN0_MASK	((7<<CLKSRCSEL0)|(0x3F<<CLKDIV0)|\
+				 (3<<OUTCLKDELAY0)|(1<<OUTCLKINV0)|\
+				 (1<<OUTCLKENB))
+#define DPC_CLKGEN0_IMAGE(source, delay, out_inv, out_en) \
+	((((source)<<CLKSRCSEL0)|((delay)<<OUTCLKDELAY0)| \
+	  ((out_inv)<<OUTCLKINV0)|((out_en)<<OUTCLKENB)) + \
+	 BUILD_BUG_ON_ZERO((source) > 7 || (delay) > 6))
+
+#define DPC_CLKGEN1_MASK	((7<<CLKSRCSEL1)|(0x3F<<CLKDIV1)|\
+				 (3<<OUTCLKDELAY1)|(1<<OUTCLKINV1))
+#define DPC_CLKGEN1_IMAGE(source, div, delay, out_inv) \
+	((((source)<<CLKSRCSEL1)|((div)<<CLKDIV1)| \
+	  ((delay)<<OUTCLKDELAY1)|((out_inv)<<OUTCLKINV1)) + \
+	 BUILD_BUG_ON_ZERO((source) > 7 || (div) > 0x3F || (delay) > 6))
+
+struct lf1000fb_lcd_mode {
+	const char			*name;
+	u32				pixclock;	/* Hz */
+	u16				xres;
+	u16				yres;
+	u32				clkgen0;
+	u32				clkgen1;
+	u16				ctrl0;
+	u16				ctrl1;
+	u16				ctrl2;
+	u16				delay0;
+	struct lf1000fb_sync_image	hsync;
+	struct lf1000fb_sync_image	vsync;
+	struct lf1000fb_sync_image	evsync;
+	u16				vsync_offset;	/* all four offsets */
+};
+
+/* processes with the fb open, for layer ownership */
+#define LAYER_MAX_CLIENTS	8
+#define ACCESS_GLOBAL		(1<<31)	/* MLC/DPC wide settings */
+
+struct lf1000fb_client {
+	pid_t	tgid;
+	int	opens;
+};
+
+/* per-layer flip queue, serviced by the vsync interrupt */
+#define FLIP_QUEUE_LEN		4
+#define FLIP_DONE_LEN		8
+
+struct lf1000fb_flip {
+	u32 address;
+	u32 target;
+	u32 cookie;
+	u32 seq;
+	u32 field;	/* FLIP_FIELD_* or 0 */
+};
+
+struct lf1000fb_field_pair {
+	u32 odd;
+	u32 even;
+};
+
+struct lf1000fb_flipq {
+	struct lf1000fb_flip	pending[FLIP_QUEUE_LEN];
+	int			head;
+	int			count;
+	int			inflight; /* head written, waiting for the MLC */
+	struct flip_done_cmd	done[FLIP_DONE_LEN];
+	int			done_head;
+	int			done_count;
+	u32			queued_seq;	/* seq of the last queued flip */
+	u32			retired_seq;	/* seq of the last completed flip */
+};
+
+/* flip fence, signaled when its flip has been latched by every MLC */
+struct lf1000fb_fence {
+	struct lf1000fb_info	*fbi;
+	int			layer;
+	u32			seq;
+};
+#define LF1000FB_FRAME_MS	17	/* fallback vsync wait without an IRQ */
+
+/*
+ * A client's control page.  It lives in uncached system memory rather
+ * than the carveout, so that nobody with the fb mmap()ed can rewrite it.
+ */
+#define CTL_MAX_PAGES		LAYER_MAX_CLIENTS
+
+struct lf1000fb_ctl {
+	struct lf1000fb_info	*fbi;
+	struct ctl_page		*page;
+	dma_addr_t		dma;
+	pid_t			tgid;		/* creator, rechecked per frame */
+	u32			layers;		/* layers it may drive */
+	u32			applied;	/* last seq programmed */
+};
+
+/* sprite state, position changes are latched by the vsync interrupt */
+#define SPRITE_LAYER		1
+
+struct lf1000fb_sprite {
+	int	enabled;
+	int	pending;	/* position changed since the last vsync */
+	u32	address;
+	int	width;
+	int	height;
+	int	bpp;
+	int	x;
+	int	y;
+};
+
+struct lf1000fb_anim {
+	int		running;
+	u32		start;		/* vblank count of key frame 0 */
+	int		width;		/* layer size when not scaling */
+	int		height;
+	struct anim_cmd	track;
+};
+
+/* buffers carved out of the fb memory above the visible framebuffer */
+#define CARVEOUT_MAX_REGIONS	8
+
+struct lf1000fb_region {
+	u32	offset;
+	u32	size;
+};
+
+struct lf1000fb_scanout3d {
+	int	enabled;
+	int	layer;
+	int	back;		/* buffer the 3D core renders into next */
+	int	pending;	/* back is queued, the MLC hasn't taken it */
+	u32	seq;		/* its flipq sequence number */
+	u32	offset[2];
+	u32	size;
+	pid_t	tgid;		/* torn down when it last closes the fb */
+};
+
 /*
  * driver private data
  */
@@ -543,17 +1164,102 @@ enum {
 struct lf1000fb_info {
 	struct fb_info			fb;
 	struct device			*dev;
+	/* fences and control pages keep it until their files close */
+	struct kref			ref;
+	int				removed;
 
 	void				*fbmem;
 
 	int pseudo_pal[16];
 	int palette_buf[256];
 	int                     pix_fmt;
+
+	/* unshifted register bases, safe to use outside the ioctl path */
+	void				*mlc_base;
+	void				*dpc_base;
+
+	/* vsync interrupt of the primary DPC */
+	int				irq;
+	int				tv_irq;	/* 2nd DPC, if separate */
+	int				field_irq;	/* TV field irq on */
+	u32				field_count;	/* since TV out start */
+	ktime_t				field_time;	/* of the last field IRQ */
+	int				field_miss;	/* parity misses in a row */
+	struct lf1000fb_field_pair	field_pair[MLC_NUM_LAYERS];
+	s32				orient_offset[MLC_NUM_LAYERS];
+	/* layer 0 viewport into the virtual canvas, latched at vblank */
+	u32				pan_address;
+	int				pan_pending;
+	spinlock_t			lock;
+	u32				vblank_count;
+	ktime_t				vblank_time;
+	wait_queue_head_t		vsync_wait;
+	struct lf1000fb_flipq		flipq[MLC_NUM_LAYERS];
+
+	/* asynchronous TV out enable/disable */
+	struct workqueue_struct		*wq;
+	struct delayed_work		tvout_work;
+	enum tvout_step			tvout_step;
+	int				tvout_reset_step;
+	int				tvout_status;
+	const struct lf1000fb_tvout_profile *tvout_profile;
+	const struct lf1000fb_lcd_mode	*lcd_mode;
+	int				lcd_div;	/* PLL1 divider in use */
+	int				lcd_div_pending; /* latched at vsync, or -1 */
+	u32				refresh;	/* LCD refresh, mHz */
+#ifdef CONFIG_CPU_FREQ
+	struct notifier_block		freq_transition;
+#endif
+	struct dentry			*debugfs;
+
+	/* layer ownership, all under the fb_info lock */
+	struct lf1000fb_client		clients[LAYER_MAX_CLIENTS];
+	pid_t				layer_owner[MLC_NUM_LAYERS];
+	pid_t				layer_lessee[MLC_NUM_LAYERS];
+	pid_t				access_tgid;	/* access_mask is for */
+	u32				access_mask;
+
+	struct lf1000fb_sprite		sprite;
+	struct lf1000fb_anim		anim[MLC_NUM_LAYERS];
+	/* video layer sizes last set, the scaler only keeps their ratio */
+	struct overlaysize_cmd		overlaysize;
+
+	/* allocations in the fb memory, sorted by descending offset */
+	struct lf1000fb_region		regions[CARVEOUT_MAX_REGIONS];
+	int				nregions;
+	struct lf1000fb_scanout3d	scanout3d;
+
+	/* damage rectangle for read()/write(), width 0 = whole fb */
+	struct rect_cmd			rw_rect;
+
+	/* TV MLC framebuffer, drives the TV instead of mirroring while open */
+	struct lf1000fb_tv		*tv;
+	int				tv_extended;
+
+	/* control pages read at vblank */
+	struct lf1000fb_ctl		*ctl[CTL_MAX_PAGES];
+};
+
+struct lf1000fb_tv {
+	struct fb_info			fb;
+	struct lf1000fb_info		*parent;
+	u32				offset;	/* canvas in the carveout */
+	u32				size;
+	int				opens;
+	int				pix_fmt;
+	/* layer 0 start address, latched at the next TV field */
+	u32				pan_address;
+	int				pan_pending;
+	u32				pseudo_pal[16];
+	struct overlaysize_cmd		overlaysize;	/* as in fbi */
 };
 static void *mlcregs;
 static void *dpcregs;
+/* fbi->lock, held by the vsync IRQ while it sets DIRTYFLAG */
+static spinlock_t *mlc_lock;
 
 static void enable_tvout_dpc(struct fb_info *info);
 static void enable_tvout_mlc(struct fb_info *info);
 static void disable_tvout();
 
+#endif /* __KERNEL__ */
@@ -0,0 +1,292 @@
+/*
+ * drivers/video/lf1000fb_convert.h
+ *
+ * Pixel format conversion for the LF1000/Pollux framebuffer, shared by
+ * lf1000fb.c and the host tools in tools/, which check the fast paths
+ * against the generic converter and time them.  Include after
+ * lf1000fb.h, with the u8/u16/u32 types, ARRAY_SIZE(), max(), memcpy()
+ * and EINVAL defined.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef LF1000FB_CONVERT_H
+#define LF1000FB_CONVERT_H
+
+/*
+ * Pixel format conversion
+ *
+ * The generic converter widens every channel to 8 bits by bit replication
+ * and narrows it again by truncation, optionally adding a 4x4 ordered
+ * dither threshold to channels that lose depth.  The fast paths below
+ * give bit-exact results to it; unused X bits are undefined.  There is
+ * no SIMD unit on the ARM926, so the fast paths work on 32-bit words.
+ */
+
+/* MLC RGB pixel format layout, (length, offset) per channel */
+struct lf1000fb_pixfmt {
+	u16 code;
+	u8 bpp;		/* bytes per pixel */
+	u8 a_len, a_off;
+	u8 r_len, r_off;
+	u8 g_len, g_off;
+	u8 b_len, b_off;
+};
+
+/* line converter between two formats, see convert_init() */
+struct lf1000fb_convert {
+	const struct lf1000fb_pixfmt	*sf;
+	const struct lf1000fb_pixfmt	*df;
+	u8				dither[4]; /* a, r, g, b: 1 = dither it */
+	void (*row)(struct lf1000fb_convert *cv, const u8 *src, u8 *dst,
+		    int width, int y);
+};
+
+#define CONVERT_MAX_WIDTH	2048
+
+static const struct lf1000fb_pixfmt lf1000fb_formats[] = {
+	/* code  Bpp  a       r       g      b */
+	{ 0x4432, 2,  0,  0,  5, 11,  6, 5,  5, 0  },	/* RGB565 */
+	{ 0xC432, 2,  0,  0,  5, 0,   6, 5,  5, 11 },	/* BGR565 */
+	{ 0x4342, 2,  0,  0,  5, 10,  5, 5,  5, 0  },	/* XRGB1555 */
+	{ 0xC342, 2,  0,  0,  5, 0,   5, 5,  5, 10 },	/* XBGR1555 */
+	{ 0x3342, 2,  1, 15,  5, 10,  5, 5,  5, 0  },	/* ARGB1555 */
+	{ 0xB342, 2,  1, 15,  5, 0,   5, 5,  5, 10 },	/* ABGR1555 */
+	{ 0x4211, 2,  0,  0,  4, 8,   4, 4,  4, 0  },	/* XRGB4444 */
+	{ 0xC211, 2,  0,  0,  4, 0,   4, 4,  4, 8  },	/* XBGR4444 */
+	{ 0x2211, 2,  4, 12,  4, 8,   4, 4,  4, 0  },	/* ARGB4444 */
+	{ 0xA211, 2,  4, 12,  4, 0,   4, 4,  4, 8  },	/* ABGR4444 */
+	{ 0x4120, 2,  0,  0,  3, 5,   3, 2,  2, 0  },	/* XRGB8332 */
+	{ 0xC120, 2,  0,  0,  2, 0,   3, 2,  3, 5  },	/* XBGR8332 */
+	{ 0x1120, 2,  8,  8,  3, 5,   3, 2,  2, 0  },	/* ARGB8332 */
+	{ 0x9120, 2,  8,  8,  2, 0,   3, 2,  3, 5  },	/* ABGR8332 */
+	{ 0x4653, 3,  0,  0,  8, 16,  8, 8,  8, 0  },	/* RGB888 */
+	{ 0xC653, 3,  0,  0,  8, 0,   8, 8,  8, 16 },	/* BGR888 */
+	{ 0x4653, 4,  0,  0,  8, 16,  8, 8,  8, 0  },	/* XRGB8888 */
+	{ 0xC653, 4,  0,  0,  8, 0,   8, 8,  8, 16 },	/* XBGR8888 */
+	{ 0x0653, 4,  8, 24,  8, 16,  8, 8,  8, 0  },	/* ARGB8888 */
+	{ 0x8653, 4,  8, 24,  8, 0,   8, 8,  8, 16 },	/* ABGR8888 */
+};
+
+static const u8 bayer4[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+/* bpp 0 picks the first match, i.e. 24bpp for the shared 888 codes */
+static const struct lf1000fb_pixfmt *pixfmt_find(u32 code, u32 bpp)
+{
+	int i;
+
+	for(i = 0; i < ARRAY_SIZE(lf1000fb_formats); i++)
+		if(lf1000fb_formats[i].code == code &&
+		   (bpp == 0 || lf1000fb_formats[i].bpp == bpp))
+			return &lf1000fb_formats[i];
+	return NULL;
+}
+
+static inline u32 pix_load(const u8 *p, int bpp)
+{
+	switch(bpp) {
+		case 2:
+		return *(const u16 *)p;
+		case 3:
+		return p[0] | (p[1]<<8) | (p[2]<<16);
+		default:
+		return *(const u32 *)p;
+	}
+}
+
+static inline void pix_store(u8 *p, int bpp, u32 v)
+{
+	switch(bpp) {
+		case 2:
+		*(u16 *)p = v;
+		break;
+		case 3:
+		p[0] = v;
+		p[1] = v>>8;
+		p[2] = v>>16;
+		break;
+		default:
+		*(u32 *)p = v;
+		break;
+	}
+}
+
+/* widen a channel to 8 bits by repeating its bits */
+static inline u32 chan_expand(u32 v, int len)
+{
+	u32 r = 0;
+	int shift;
+
+	if(len >= 8)
+		return v;
+	for(shift = 8-len; shift > -len; shift -= len)
+		r |= shift >= 0 ? v<<shift : v>>-shift;
+	return r & 0xFF;
+}
+
+/* narrow an 8 bit channel, adding the ordered dither threshold if asked */
+static inline u32 chan_reduce(u32 v, int len, int dither, int x, int y)
+{
+	if(dither) {
+		v += (bayer4[y&3][x&3]<<(8-len))>>4;
+		if(v > 0xFF)
+			v = 0xFF;
+	}
+	return v>>(8-len);
+}
+
+#define CHAN_GET(p,f,c) \
+	chan_expand(((p)>>(f)->c##_off) & BIT_MASK_ONES((f)->c##_len), (f)->c##_len)
+
+static void convert_row_generic(struct lf1000fb_convert *cv, const u8 *src,
+				u8 *dst, int width, int y)
+{
+	const struct lf1000fb_pixfmt *sf = cv->sf;
+	const struct lf1000fb_pixfmt *df = cv->df;
+	u32 p, a, out;
+	int x;
+
+	for(x = 0; x < width; x++) {
+		p = pix_load(src, sf->bpp);
+		a = sf->a_len ? CHAN_GET(p, sf, a) : 0xFF;
+		out = chan_reduce(CHAN_GET(p, sf, r), df->r_len,
+				  cv->dither[1], x, y)<<df->r_off;
+		out |= chan_reduce(CHAN_GET(p, sf, g), df->g_len,
+				   cv->dither[2], x, y)<<df->g_off;
+		out |= chan_reduce(CHAN_GET(p, sf, b), df->b_len,
+				   cv->dither[3], x, y)<<df->b_off;
+		if(df->a_len)
+			out |= chan_reduce(a, df->a_len, cv->dither[0],
+					   x, y)<<df->a_off;
+		pix_store(dst, df->bpp, out);
+		src += sf->bpp;
+		dst += df->bpp;
+	}
+}
+
+static void convert_row_copy(struct lf1000fb_convert *cv, const u8 *src,
+			     u8 *dst, int width, int y)
+{
+	memcpy(dst, src, width*cv->sf->bpp);
+}
+
+/* 16bpp R/B swap of equal length channels, two pixels per word */
+static void convert_row_swap16(struct lf1000fb_convert *cv, const u8 *src,
+			       u8 *dst, int width, int y)
+{
+	const struct lf1000fb_pixfmt *sf = cv->sf;
+	int hi = max(sf->r_off, sf->b_off);
+	u32 lo_mask = BIT_MASK_ONES(sf->r_len) * 0x10001;
+	u32 hi_mask = lo_mask<<hi;
+	u32 keep = ~(lo_mask|hi_mask);
+	const u32 *s = (const u32 *)src;
+	u32 *d = (u32 *)dst;
+	u32 w;
+	int n;
+
+	for(n = width/2; n > 0; n--) {
+		w = *s++;
+		*d++ = (w & keep) | ((w>>hi) & lo_mask) | ((w & lo_mask)<<hi);
+	}
+	if(width & 1) {
+		w = *(const u16 *)s;
+		*(u16 *)d = (w & keep) | ((w>>hi) & lo_mask) |
+			    ((w & lo_mask)<<hi);
+	}
+}
+
+static void convert_row_swap32(struct lf1000fb_convert *cv, const u8 *src,
+			       u8 *dst, int width, int y)
+{
+	const u32 *s = (const u32 *)src;
+	u32 *d = (u32 *)dst;
+	u32 w;
+
+	while(width--) {
+		w = *s++;
+		*d++ = (w & 0xFF00FF00) | ((w>>16) & 0xFF) | ((w & 0xFF)<<16);
+	}
+}
+
+static void convert_row_565_8888(struct lf1000fb_convert *cv, const u8 *src,
+				 u8 *dst, int width, int y)
+{
+	const u16 *s = (const u16 *)src;
+	u32 alpha = cv->df->a_len ? 0xFF000000 : 0;
+	u32 *d = (u32 *)dst;
+	u32 p, r, g, b;
+
+	while(width--) {
+		p = *s++;
+		r = (p>>11) & 0x1F;
+		g = (p>>5) & 0x3F;
+		b = p & 0x1F;
+		*d++ = alpha | (((r<<3)|(r>>2))<<16) | (((g<<2)|(g>>4))<<8) |
+		       ((b<<3)|(b>>2));
+	}
+}
+
+#define PACK565(p) ((((p)>>8) & 0xF800) | (((p)>>5) & 0x07E0) | \
+		    (((p)>>3) & 0x001F))
+
+/* [AX]RGB8888 to RGB565 without dither, two pixels per word */
+static void convert_row_8888_565(struct lf1000fb_convert *cv, const u8 *src,
+				 u8 *dst, int width, int y)
+{
+	const u32 *s = (const u32 *)src;
+	u32 *d = (u32 *)dst;
+	int n;
+
+	for(n = width/2; n > 0; n--) {
+		*d++ = PACK565(s[0]) | (PACK565(s[1])<<16);
+		s += 2;
+	}
+	if(width & 1)
+		*(u16 *)d = PACK565(s[0]);
+}
+
+static int convert_init(struct lf1000fb_convert *cv, u32 sfmt, u32 sbpp,
+			u32 dfmt, u32 dbpp, u32 flags)
+{
+	const struct lf1000fb_pixfmt *sf = pixfmt_find(sfmt, sbpp);
+	const struct lf1000fb_pixfmt *df = pixfmt_find(dfmt, dbpp);
+	int dither = (flags & CONVERT_DITHER) ? 1 : 0;
+
+	if(sf == NULL || df == NULL)
+		return -EINVAL;
+	cv->sf = sf;
+	cv->df = df;
+
+	/* only dither channels that lose depth, a missing alpha is 8 bits */
+	cv->dither[0] = dither && df->a_len < (sf->a_len ? sf->a_len : 8);
+	cv->dither[1] = dither && df->r_len < sf->r_len;
+	cv->dither[2] = dither && df->g_len < sf->g_len;
+	cv->dither[3] = dither && df->b_len < sf->b_len;
+	if(!df->a_len)
+		cv->dither[0] = 0;
+
+	if(sf == df)
+		cv->row = convert_row_copy;
+	else if(sf->bpp == 2 && df->bpp == 2 && (sf->code ^ df->code) == 0x8000
+		&& sf->r_len == sf->b_len)
+		cv->row = convert_row_swap16;
+	else if(sf->bpp == 4 && df->bpp == 4 && (sf->code ^ df->code) == 0x8000)
+		cv->row = convert_row_swap32;
+	else if(sf->code == 0x4432 && df->bpp == 4 && df->r_off == 16)
+		cv->row = convert_row_565_8888;
+	else if(sf->bpp == 4 && sf->r_off == 16 && df->code == 0x4432 &&
+		!cv->dither[1] && !cv->dither[2] && !cv->dither[3])
+		cv->row = convert_row_8888_565;
+	else
+		cv->row = convert_row_generic;
+	return 0;
+}
+
+#endif /* LF1000FB_CONVERT_H */
@@ -0,0 +1,280 @@
+/*
+ * drivers/video/lf1000fb_mlc.h
+ *
+ * MLC layer register programming for the LF1000/Pollux SoC, shared by
+ * lf1000fb.c and the host tools in tools/, which run it against the MLC
+ * model.  Include after lf1000fb.h, with ioread32()/iowrite32() and the
+ * u8/u16/u32/s32 types defined.  mlc is the base of one MLC's registers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef LF1000FB_MLC_H
+#define LF1000FB_MLC_H
+
+/*
+ * Per-layer register offsets.  The RGB layers are 0x34 apart; the video
+ * layer is laid out differently and alone has the chroma and scaler
+ * registers.  0 marks a register the layer doesn't have (0 is
+ * MLCCONTROLT, never a layer register).  The accessors are inline and
+ * the table const, so with a constant layer they fold to a fixed offset.
+ */
+enum {
+	MLC_REG_CONTROL,
+	MLC_REG_HSTRIDE,
+	MLC_REG_VSTRIDE,
+	MLC_REG_ADDRESS,
+	MLC_REG_LEFTRIGHT,
+	MLC_REG_TOPBOTTOM,
+	MLC_REG_TPCOLOR,
+	MLC_REG_INVCOLOR,
+	MLC_REG_INVLEFTRIGHT,
+	MLC_REG_INVTOPBOTTOM,
+	MLC_REG_ADDRESSCB,
+	MLC_REG_ADDRESSCR,
+	MLC_REG_STRIDECB,
+	MLC_REG_STRIDECR,
+	MLC_REG_HSCALE,
+	MLC_REG_VSCALE,
+	MLC_NUM_REGS
+};
+
+static const u16 mlc_layer_regs[MLC_NUM_LAYERS][MLC_NUM_REGS] = {
+	{
+		[MLC_REG_CONTROL]	= MLCCONTROL0,
+		[MLC_REG_HSTRIDE]	= MLCHSTRIDE0,
+		[MLC_REG_VSTRIDE]	= MLCVSTRIDE0,
+		[MLC_REG_ADDRESS]	= MLCADDRESS0,
+		[MLC_REG_LEFTRIGHT]	= MLCLEFTRIGHT0,
+		[MLC_REG_TOPBOTTOM]	= MLCTOPBOTTOM0,
+		[MLC_REG_TPCOLOR]	= MLCTPCOLOR0,
+		[MLC_REG_INVCOLOR]	= MLCINVCOLOR0,
+		[MLC_REG_INVLEFTRIGHT]	= MLCLEFTRIGHT0_0,
+		[MLC_REG_INVTOPBOTTOM]	= MLCTOPBOTTOM0_0,
+	},
+	{
+		[MLC_REG_CONTROL]	= MLCCONTROL1,
+		[MLC_REG_HSTRIDE]	= MLCHSTRIDE1,
+		[MLC_REG_VSTRIDE]	= MLCVSTRIDE1,
+		[MLC_REG_ADDRESS]	= MLCADDRESS1,
+		[MLC_REG_LEFTRIGHT]	= MLCLEFTRIGHT1,
+		[MLC_REG_TOPBOTTOM]	= MLCTOPBOTTOM1,
+		[MLC_REG_TPCOLOR]	= MLCTPCOLOR1,
+		[MLC_REG_INVCOLOR]	= MLCINVCOLOR1,
+		[MLC_REG_INVLEFTRIGHT]	= MLCLEFTRIGHT1_0,
+		[MLC_REG_INVTOPBOTTOM]	= MLCTOPBOTTOM1_0,
+	},
+	[MLC_VIDEO_LAYER] = {
+		[MLC_REG_CONTROL]	= MLCCONTROL2,
+		[MLC_REG_VSTRIDE]	= MLCVSTRIDE2,
+		[MLC_REG_ADDRESS]	= MLCADDRESS2,
+		[MLC_REG_LEFTRIGHT]	= MLCLEFTRIGHT2,
+		[MLC_REG_TOPBOTTOM]	= MLCTOPBOTTOM2,
+		[MLC_REG_TPCOLOR]	= MLCTPCOLOR2,	/* alpha only */
+		[MLC_REG_ADDRESSCB]	= MLCADDRESSCB,
+		[MLC_REG_ADDRESSCR]	= MLCADDRESSCR,
+		[MLC_REG_STRIDECB]	= MLCSTRIDECB,
+		[MLC_REG_STRIDECR]	= MLCSTRIDECR,
+		[MLC_REG_HSCALE]	= MLCHSCALE,
+		[MLC_REG_VSCALE]	= MLCVSCALE,
+	},
+};
+
+static inline void *mlc_layer_reg(void *mlc, u8 layer, int reg)
+{
+	return mlc + mlc_layer_regs[layer][reg];
+}
+
+static inline int mlc_has_reg(u8 layer, int reg)
+{
+	return mlc_layer_regs[layer][reg] != 0;
+}
+
+static inline u32 mlc_layer_read(void *mlc, u8 layer, int reg)
+{
+	return ioread32(mlc_layer_reg(mlc, layer, reg));
+}
+
+static inline void mlc_layer_write(void *mlc, u8 layer, int reg, u32 val)
+{
+	iowrite32(val, mlc_layer_reg(mlc, layer, reg));
+}
+
+/* MLCHSCALE/MLCVSCALE value for one direction */
+static inline u32 overlay_scale(u32 src, u32 dst)
+{
+	/* Enable adjusted ratio with bilinear filter for upscaling */
+	if (src < dst)
+		return (1<<28) | (((src-1)<<11)/(dst-1));
+	return (src<<11)/dst;
+}
+
+/* scale a src sized picture to dst on screen, layers with a scaler only */
+static inline void mlc_layer_scale(void *mlc, u8 layer, u32 srcwidth,
+				   u32 srcheight, u32 dstwidth, u32 dstheight)
+{
+	if(!mlc_has_reg(layer, MLC_REG_HSCALE))
+		return;
+	mlc_layer_write(mlc, layer, MLC_REG_HSCALE,
+			overlay_scale(srcwidth, dstwidth));
+	/* Ditto for height which scales independently of width */
+	mlc_layer_write(mlc, layer, MLC_REG_VSCALE,
+			overlay_scale(srcheight, dstheight));
+}
+
+static inline int anim_lerp(int v0, int v1, u32 t, u32 f0, u32 f1)
+{
+	return v0 + (v1 - v0)*(int)(t - f0)/(int)(f1 - f0);
+}
+
+/*
+ * The key t vsyncs into a track, interpolated between the keys around
+ * it.  Returns 1 once t is at or past the last key, i.e. the track is
+ * done after this one.
+ */
+static inline int anim_key_at(const struct anim_cmd *track, u32 t,
+			      struct anim_key *k)
+{
+	const struct anim_key *keys = track->keys;
+	int last = track->count-1;
+	int i;
+
+	if((s32)t < 0 || t <= keys[0].frame) {
+		*k = keys[0];
+		return 0;
+	}
+	if(t >= keys[last].frame) {
+		*k = keys[last];
+		return 1;
+	}
+	for(i = 0; t >= keys[i+1].frame; i++)
+		;
+	k->frame = t;
+	k->x = anim_lerp(keys[i].x, keys[i+1].x, t,
+			 keys[i].frame, keys[i+1].frame);
+	k->y = anim_lerp(keys[i].y, keys[i+1].y, t,
+			 keys[i].frame, keys[i+1].frame);
+	k->alpha = anim_lerp(keys[i].alpha, keys[i+1].alpha, t,
+			     keys[i].frame, keys[i+1].frame);
+	k->width = anim_lerp(keys[i].width, keys[i+1].width, t,
+			     keys[i].frame, keys[i+1].frame);
+	k->height = anim_lerp(keys[i].height, keys[i+1].height, t,
+			      keys[i].frame, keys[i+1].frame);
+	return 0;
+}
+
+/*
+ * Program key k of track on a layer and mark it dirty.  width and height
+ * are the layer's on screen size, used when the track doesn't scale.
+ */
+static inline void anim_write(void *mlc, u8 layer,
+			      const struct anim_cmd *track, int width,
+			      int height, const struct anim_key *k)
+{
+	u32 flags = track->flags;
+	int w = width, h = height;
+	u32 tmp;
+
+	if(flags & ANIM_SCALE) {
+		w = k->width < 2 ? 2 : k->width;
+		h = k->height < 2 ? 2 : k->height;
+		mlc_layer_scale(mlc, layer, track->srcwidth,
+				track->srcheight, w, h);
+	}
+	if(flags & (ANIM_POSITION|ANIM_SCALE)) {
+		mlc_layer_write(mlc, layer, MLC_REG_LEFTRIGHT,
+				((k->x & 0x7FF)<<LEFT)|
+				(((k->x+w-1) & 0x7FF)<<RIGHT));
+		mlc_layer_write(mlc, layer, MLC_REG_TOPBOTTOM,
+				((k->y & 0x7FF)<<TOP)|
+				(((k->y+h-1) & 0x7FF)<<BOTTOM));
+	}
+	if(flags & ANIM_ALPHA) {
+		tmp = mlc_layer_read(mlc, layer, MLC_REG_TPCOLOR);
+		tmp &= ~(0xF<<ALPHA);
+		tmp |= ((0xF & k->alpha)<<ALPHA);
+		mlc_layer_write(mlc, layer, MLC_REG_TPCOLOR, tmp);
+	}
+	tmp = mlc_layer_read(mlc, layer, MLC_REG_CONTROL);
+	BIT_SET(tmp,DIRTYFLAG);
+	mlc_layer_write(mlc, layer, MLC_REG_CONTROL, tmp);
+}
+
+/* a compose_cmd's blend, alpha and colour key, marking the layer dirty */
+static inline void compose_write(void *mlc, const struct compose_cmd *cc)
+{
+	u8 layer = cc->layer;
+	u32 tmp;
+
+	tmp = mlc_layer_read(mlc, layer, MLC_REG_TPCOLOR);
+	tmp &= ~(0xF<<ALPHA);
+	tmp |= (cc->alpha & 0xF)<<ALPHA;
+	if(layer != MLC_VIDEO_LAYER) {
+		tmp &= ~(0xFFFFFF<<TPCOLOR);
+		tmp |= (cc->tpcolor & 0xFFFFFF)<<TPCOLOR;
+	}
+	mlc_layer_write(mlc, layer, MLC_REG_TPCOLOR, tmp);
+
+	tmp = mlc_layer_read(mlc, layer, MLC_REG_CONTROL);
+	(cc->mode & COMPOSE_BLEND) ? BIT_SET(tmp,BLENDENB) : BIT_CLR(tmp,BLENDENB);
+	if(layer != MLC_VIDEO_LAYER)
+		(cc->mode & COMPOSE_COLORKEY) ? BIT_SET(tmp,TPENB) :
+						BIT_CLR(tmp,TPENB);
+	BIT_SET(tmp,DIRTYFLAG);
+	mlc_layer_write(mlc, layer, MLC_REG_CONTROL, tmp);
+}
+
+/* the start of an oriented picture from its first pixel, in bytes */
+static inline s32 orient_offset(const struct orient_cmd *oc)
+{
+	s32 offset = 0;
+
+	if(oc->flags & ORIENT_MIRROR_X)
+		offset += (oc->width-1)*oc->hstride;
+	if(oc->flags & ORIENT_FLIP_Y)
+		offset += (oc->height-1)*oc->vstride;
+	return offset;
+}
+
+static inline int orient_check(const struct orient_cmd *oc)
+{
+	/* the video layer has no HSTRIDE and three planes to offset */
+	if(oc->layer >= MLC_NUM_LAYERS || oc->layer == MLC_VIDEO_LAYER)
+		return -EINVAL;
+	if(oc->flags & ~(ORIENT_MIRROR_X|ORIENT_FLIP_Y))
+		return -EINVAL;
+	/* the MLC window is 11 bits each way, which also bounds the offset */
+	if(oc->width == 0 || oc->width > 2048 ||
+	   oc->height == 0 || oc->height > 2048 ||
+	   oc->hstride == 0 || oc->hstride > 4 ||
+	   oc->vstride < oc->width*oc->hstride ||
+	   (u64)(oc->height-1)*oc->vstride + (oc->width-1)*oc->hstride >
+	   INT_MAX)
+		return -EINVAL;
+	return 0;
+}
+
+/*
+ * Scan an RGB layer's picture out mirrored and/or flipped: start at its
+ * last pixel or line and step back with negative strides.  oc must have
+ * passed orient_check().  The dirty flag is left to the caller.
+ */
+static inline void mlc_layer_orient(void *mlc, const struct orient_cmd *oc)
+{
+	s32 hstride = oc->hstride;
+	s32 vstride = oc->vstride;
+
+	if(oc->flags & ORIENT_MIRROR_X)
+		hstride = -hstride;
+	if(oc->flags & ORIENT_FLIP_Y)
+		vstride = -vstride;
+	/* two's complement, negative scans right to left, bottom to top */
+	mlc_layer_write(mlc, oc->layer, MLC_REG_ADDRESS,
+			oc->address + orient_offset(oc));
+	mlc_layer_write(mlc, oc->layer, MLC_REG_HSTRIDE, hstride);
+	mlc_layer_write(mlc, oc->layer, MLC_REG_VSTRIDE, vstride);
+}
+
+#endif /* LF1000FB_MLC_H */
@@ -0,0 +1,192 @@
+/*
+ * tools/animcheck.c
+ *
+ * Check what an ANIM_SCALE track shows.  A short track moves and scales
+ * a 64x48 video picture through a downscale, an upscale with different
+ * ratios across and down, and full screen.  Every vsync of the track the
+ * key is worked out and written to the model's registers by the driver's
+ * own anim_key_at() and anim_write(), and the frame is composed by the
+ * MLC model, twice: once with a luma ramp across the picture and once
+ * with one down it.  Each frame must show
+ *
+ *  - the background outside the key's rectangle, and grey inside it
+ *    (wrong chroma addresses or strides give colour)
+ *  - at every column (row) the source column (row) the ramp says it
+ *    came from, scaled by srcwidth/width (srcheight/height), to within
+ *    a source pixel
+ *
+ * Exits 1 if any frame is off.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "../lf1000fb.h"
+#include "mlcmodel.h"
+#include "mlcdrv.h"
+
+#define FB_ADDR		0x02800000
+#define FB_SIZE		0x00010000
+#define W		320
+#define H		240
+#define SRC_W		64
+#define SRC_H		48
+#define BG		0xFF00FF
+
+static const struct anim_cmd track = {
+	.layer		= MLC_VIDEO_LAYER,
+	.flags		= ANIM_POSITION|ANIM_SCALE,
+	.count		= 4,
+	.srcwidth	= SRC_W,
+	.srcheight	= SRC_H,
+	.keys = {
+		/* frame   x    y  alpha  width height */
+		{  0,     10,  20,  15,    32,   24 },
+		{  4,    100,  50,  15,   200,   60 },
+		{  8,     40,  10,  15,   120,  200 },
+		{ 12,      0,   0,  15,     W,    H },
+	},
+};
+
+static int verbose;
+
+/*
+ * 4:2:0 picture, Y ramping 16..235 across (dir 0) or down (1), grey.
+ * Rows are padded and the edges repeated into the padding and an extra
+ * row, as a decoder leaves them, for the bilinear filter to read.
+ */
+#define PAD		16
+#define Y_STRIDE	(SRC_W + PAD)
+#define C_STRIDE	(Y_STRIDE/2)
+#define Y_SIZE		(Y_STRIDE*(SRC_H + 2))
+#define C_SIZE		(C_STRIDE*(SRC_H/2 + 2))
+
+static void picture(uint8_t *fb, int dir)
+{
+	int x, y, n = dir ? SRC_H : SRC_W;
+	int sx, sy;
+
+	for(y = 0; y < SRC_H + 2; y++)
+		for(x = 0; x < Y_STRIDE; x++) {
+			sx = x < SRC_W ? x : SRC_W-1;
+			sy = y < SRC_H ? y : SRC_H-1;
+			fb[y*Y_STRIDE + x] = 16 + 219*(dir ? sy : sx)/(n-1);
+		}
+	memset(fb + Y_SIZE, 128, 2*C_SIZE);
+}
+
+static void setup(struct mlc_model *m, const uint8_t *fb)
+{
+	void *mlc = mlc_bank(m);
+	u8 l = MLC_VIDEO_LAYER;
+
+	memset(m, 0, sizeof(*m));
+	m->fb = fb;
+	m->fb_addr = FB_ADDR;
+	m->fb_size = FB_SIZE;
+	mlc_wr(m, MLCCONTROLT, (1<<MLCENB) | (2<<PRIORITY));
+	mlc_wr(m, MLCSCREENSIZE, ((H-1)<<SCREENHEIGHT)|((W-1)<<SCREENWIDTH));
+	mlc_wr(m, MLCBGCOLOR, BG);
+	mlc_layer_write(mlc, l, MLC_REG_CONTROL, 1<<LAYERENB);
+	mlc_layer_write(mlc, l, MLC_REG_VSTRIDE, Y_STRIDE);
+	mlc_layer_write(mlc, l, MLC_REG_ADDRESS, FB_ADDR);
+	mlc_layer_write(mlc, l, MLC_REG_ADDRESSCB, FB_ADDR + Y_SIZE);
+	mlc_layer_write(mlc, l, MLC_REG_ADDRESSCR, FB_ADDR + Y_SIZE + C_SIZE);
+	mlc_layer_write(mlc, l, MLC_REG_STRIDECB, C_STRIDE);
+	mlc_layer_write(mlc, l, MLC_REG_STRIDECR, C_STRIDE);
+}
+
+/* check one composed frame against key k, the ramp in direction dir */
+static int check(const uint32_t *frame, const struct anim_key *k, int dir,
+		 unsigned int t)
+{
+	int x, y, in, g, src, n, dst, pos;
+	double want;
+	uint32_t c;
+
+	n = dir ? SRC_H : SRC_W;
+	dst = dir ? k->height : k->width;
+	for(y = 0; y < H; y++)
+		for(x = 0; x < W; x++) {
+			c = frame[y*W + x] & 0xFFFFFF;
+			in = x >= k->x && x < k->x + (int)k->width &&
+			     y >= k->y && y < k->y + (int)k->height;
+			if(!in) {
+				if(c == BG)
+					continue;
+				goto bad;
+			}
+			g = c & 0xFF;
+			if(abs((int)(c>>16) - g) > 1 ||
+			   abs((int)((c>>8) & 0xFF) - g) > 1)
+				goto bad;
+			/* the ramp back to a source position */
+			src = (g*(n-1) + 127)/255;
+			pos = dir ? y - k->y : x - k->x;
+			want = (double)pos*n/dst;
+			if(src < want - 1.5 || src > want + 1.5)
+				goto bad;
+		}
+	return 0;
+
+bad:
+	printf("frame %u %s ramp: at %d,%d 0x%06x, key %d,%d %ux%u\n", t,
+	       dir ? "vertical" : "horizontal", x, y, c, k->x, k->y,
+	       k->width, k->height);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	const struct mlc_pixfmt *of = mlc_pixfmt_byname("XRGB8888");
+	static uint8_t fb[2][FB_SIZE];
+	static uint32_t frame[W*H];
+	struct mlc_model m[2];
+	struct anim_key k;
+	unsigned int t;
+	int opt, dir, done = 0, bad = 0, frames = 0;
+
+	while((opt = getopt(argc, argv, "v")) != -1) {
+		switch(opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: animcheck [-v]\n");
+			return 2;
+		}
+	}
+
+	for(dir = 0; dir < 2; dir++) {
+		picture(fb[dir], dir);
+		setup(&m[dir], fb[dir]);
+	}
+	/* up to the last key, where anim_key_at() must say it's done */
+	for(t = 0; !done && t < 64; t++) {
+		done = anim_key_at(&track, t, &k);
+		for(dir = 0; dir < 2; dir++) {
+			anim_write(mlc_bank(&m[dir]), track.layer, &track,
+				   0, 0, &k);
+			mlc_compose(&m[dir], of, (uint8_t *)frame, W*4);
+			bad += check(frame, &k, dir, t);
+		}
+		if(verbose)
+			printf("frame %2u: %3d,%3d %3ux%3u hscale 0x%08x "
+			       "vscale 0x%08x\n", t, k.x, k.y, k.width,
+			       k.height, mlc_rd(&m[0], MLCHSCALE),
+			       mlc_rd(&m[0], MLCVSCALE));
+		frames++;
+	}
+	if(t != track.keys[track.count-1].frame + 1) {
+		printf("track stopped after %u vsyncs\n", t);
+		bad++;
+	}
+	printf("%d frames checked, %d off\n", frames, bad);
+	return bad ? 1 : 0;
+}
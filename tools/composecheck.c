@@ -0,0 +1,300 @@
+/*
+ * tools/composecheck.c
+ *
+ * Check that a MLC_IOCSCOMPOSE profile shows the same pixels as the CPU
+ * composition it replaces.  For random content and every profile (opaque,
+ * colour key, blend at each alpha, blend with colour key) two frames are
+ * made:
+ *
+ *  - reference: the layers composed on the CPU the way applications do
+ *    it today, into an RGB565 frame, with the driver's ARGB8888 over
+ *    RGB565 blend (blend_row_8888_565) for alpha
+ *  - hardware: the layers on the MLC, the profile programmed by the
+ *    driver's own compose_write(), composed by the MLC model
+ *
+ * Two scenes are run: a HUD on layer 0 over a game on layer 1, and
+ * subtitles on layer 0 over the video layer.  Opaque and colour keyed
+ * profiles must match exactly.  Blends may differ by -t LSBs per RGB565
+ * channel, default 2: the CPU rounds alpha to 5 bits and blends in
+ * RGB565, the MLC blends the widened 8 bit channels with its 4 bit alpha.
+ * A wrong setup (key not widened to RGB888, blend or key on the wrong
+ * layer, alpha out of place) is off by far more.  Exits 1 if any
+ * profile is off.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "../lf1000fb.h"
+#include "mlcmodel.h"
+#include "mlcdrv.h"
+
+#define FB_ADDR		0x02800000
+#define FB_SIZE		0x00080000
+#define W		320
+#define H		240
+#define TOP_OFF		0x00000	/* layer 0: HUD or subtitles */
+#define BOTTOM_OFF	0x40000	/* layer 1: game, or the video planes */
+
+static int tolerance = 2;
+static int verbose;
+
+/* ARGB8888 over RGB565, as blend_row_8888_565() in the driver */
+static void cpu_blend_row(const uint32_t *s, uint16_t *d, int width)
+{
+	uint32_t fg, bg, a;
+	int x;
+
+	for(x = 0; x < width; x++) {
+		a = s[x] >> 24;
+		if(a == 0)
+			continue;
+		fg = ((s[x]>>8) & 0xF800) | ((s[x]>>5) & 0x07E0) |
+		     ((s[x]>>3) & 0x001F);
+		if(a == 0xFF) {
+			d[x] = fg;
+			continue;
+		}
+		a = (a + 4) >> 3;
+		bg = d[x];
+		bg = (bg | (bg << 16)) & 0x07E0F81F;
+		fg = (fg | (fg << 16)) & 0x07E0F81F;
+		bg += (fg - bg)*a >> 5;
+		bg &= 0x07E0F81F;
+		d[x] = bg | (bg >> 16);
+	}
+}
+
+static uint32_t widen565(uint16_t v)
+{
+	return ((v & 0xF800)<<8) | ((v & 0xE000)<<3) |
+	       ((v & 0x07E0)<<5) | ((v & 0x0600)>>1) |
+	       ((v & 0x001F)<<3) | ((v & 0x001C)>>2);
+}
+
+static uint16_t narrow565(uint32_t c)
+{
+	return ((c>>8) & 0xF800) | ((c>>5) & 0x07E0) | ((c>>3) & 0x001F);
+}
+
+static uint16_t rd16(const uint8_t *p)
+{
+	return p[0] | (p[1]<<8);
+}
+
+/* the top layer over frame on the CPU, keyed on the RGB565 key */
+static void cpu_compose(const struct compose_cmd *cc, uint16_t key,
+			const uint8_t *top, uint16_t *frame)
+{
+	uint32_t row[W];
+	uint16_t s;
+	int x, y;
+
+	for(y = 0; y < H; y++) {
+		uint16_t *d = frame + y*W;
+
+		for(x = 0; x < W; x++) {
+			s = rd16(top + (y*W + x)*2);
+			if((cc->mode & COMPOSE_COLORKEY) && s == key) {
+				row[x] = 0;	/* alpha 0 is skipped */
+				continue;
+			}
+			row[x] = widen565(s) | (cc->mode & COMPOSE_BLEND ?
+						cc->alpha*0x11 : 0xFF) << 24;
+		}
+		cpu_blend_row(row, d, W);
+	}
+}
+
+static void hw_layer(struct mlc_model *m, int layer, uint32_t ctl,
+		     uint32_t off, int hstride, int vstride)
+{
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_CONTROL],
+	       ctl | (1<<LAYERENB));
+	if(hstride)
+		mlc_wr(m, mlc_layer_regs[layer][MLC_REG_HSTRIDE], hstride);
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_VSTRIDE], vstride);
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_ADDRESS], FB_ADDR + off);
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_LEFTRIGHT],
+	       (0<<LEFT) | ((W-1)<<RIGHT));
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_TOPBOTTOM],
+	       (0<<TOP) | ((H-1)<<BOTTOM));
+}
+
+static void hw_setup(struct mlc_model *m, uint8_t *fb, int video)
+{
+	memset(m, 0, sizeof(*m));
+	m->fb = fb;
+	m->fb_addr = FB_ADDR;
+	m->fb_size = FB_SIZE;
+	mlc_wr(m, MLCCONTROLT, (1<<MLCENB) | (2<<PRIORITY));
+	mlc_wr(m, MLCSCREENSIZE, ((H-1)<<SCREENHEIGHT) | ((W-1)<<SCREENWIDTH));
+	hw_layer(m, 0, 0x4432<<FORMAT, TOP_OFF, 2, W*2);
+	if(!video) {
+		hw_layer(m, 1, 0x4432<<FORMAT, BOTTOM_OFF, 2, W*2);
+		return;
+	}
+	/* 1:1, overlay_scale(W, W) */
+	hw_layer(m, MLC_VIDEO_LAYER, 0, BOTTOM_OFF, 0, W);
+	mlc_wr(m, MLCADDRESSCB, FB_ADDR + BOTTOM_OFF + W*H);
+	mlc_wr(m, MLCADDRESSCR, FB_ADDR + BOTTOM_OFF + W*H*5/4);
+	mlc_wr(m, MLCSTRIDECB, W/2);
+	mlc_wr(m, MLCSTRIDECR, W/2);
+	mlc_wr(m, MLCHSCALE, (W<<11)/W);
+	mlc_wr(m, MLCVSCALE, (H<<11)/H);
+}
+
+static uint8_t clip8(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* the decoder's output, BT.601 video range as the MLC converts it */
+static void cpu_video(const uint8_t *fb, uint16_t *frame)
+{
+	const uint8_t *py = fb + BOTTOM_OFF, *pb = py + W*H, *pr = pb + W*H/4;
+	int x, y, c, cb, cr;
+
+	for(y = 0; y < H; y++)
+		for(x = 0; x < W; x++) {
+			c = 298*(py[y*W + x] - 16) + 128;
+			cb = pb[(y/2)*(W/2) + x/2] - 128;
+			cr = pr[(y/2)*(W/2) + x/2] - 128;
+			frame[y*W + x] = narrow565(
+				(clip8((c + 409*cr)>>8)<<16) |
+				(clip8((c - 100*cb - 208*cr)>>8)<<8) |
+				clip8((c + 516*cb)>>8));
+		}
+}
+
+static void fill_random(uint8_t *fb, int video, uint16_t key)
+{
+	int i;
+
+	for(i = 0; i < W*H; i++) {
+		uint16_t v = rand();
+
+		/* a quarter of the top layer is the key colour */
+		if(rand() % 4 == 0)
+			v = key;
+		fb[TOP_OFF + i*2] = v;
+		fb[TOP_OFF + i*2 + 1] = v >> 8;
+	}
+	if(video)
+		for(i = 0; i < W*H*3/2; i++)
+			fb[BOTTOM_OFF + i] = rand();
+	else
+		for(i = 0; i < W*H*2; i++)
+			fb[BOTTOM_OFF + i] = rand();
+}
+
+static int check(const char *scene, int video, const struct compose_cmd *cc,
+		 uint16_t key, uint8_t *fb, uint16_t *ref, uint8_t *hw)
+{
+	struct mlc_model m;
+	int i, diff = 0, worst = 0, d, allowed;
+	uint16_t a, b;
+
+	if(video)
+		cpu_video(fb, ref);
+	else
+		for(i = 0; i < W*H; i++)
+			ref[i] = rd16(fb + BOTTOM_OFF + i*2);
+	cpu_compose(cc, key, fb + TOP_OFF, ref);
+
+	hw_setup(&m, fb, video);
+	compose_write(mlc_bank(&m), cc);
+	mlc_compose(&m, mlc_pixfmt_byname("RGB565"), hw, W*2);
+
+	for(i = 0; i < W*H; i++) {
+		a = ref[i];
+		b = rd16(hw + i*2);
+		if(a == b)
+			continue;
+		diff++;
+		d = abs((a>>11) - (b>>11));
+		if(abs(((a>>5) & 0x3F) - ((b>>5) & 0x3F)) > d)
+			d = abs(((a>>5) & 0x3F) - ((b>>5) & 0x3F));
+		if(abs((a & 0x1F) - (b & 0x1F)) > d)
+			d = abs((a & 0x1F) - (b & 0x1F));
+		if(d > worst)
+			worst = d;
+	}
+
+	allowed = cc->mode & COMPOSE_BLEND ? tolerance : 0;
+	if(verbose || worst > allowed || m.oob)
+		printf("%-9s mode %d alpha %2u: %6d of %d pixels differ, "
+		       "worst %d LSB%s\n", scene, cc->mode, cc->alpha, diff,
+		       W*H, worst, worst > allowed || m.oob ? "  FAIL" : "");
+	return worst > allowed || m.oob;
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int modes[] = {
+		COMPOSE_OPAQUE, COMPOSE_COLORKEY, COMPOSE_BLEND,
+		COMPOSE_BLEND|COMPOSE_COLORKEY,
+	};
+	struct compose_cmd cc;
+	int rounds = 4, seed = 1, failed = 0, checks = 0, r, v, i, opt;
+	unsigned int a;
+	uint16_t *ref, key;
+	uint8_t *fb, *hw;
+
+	while((opt = getopt(argc, argv, "n:s:t:v")) != -1) {
+		switch(opt) {
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 't':
+			tolerance = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: composecheck [-n rounds] "
+				"[-s seed] [-t lsb] [-v]\n");
+			return 2;
+		}
+	}
+
+	fb = calloc(1, FB_SIZE);
+	ref = malloc(W*H*2);
+	hw = malloc(W*H*2);
+	if(!fb || !ref || !hw)
+		return 1;
+	srand(seed);
+
+	for(r = 0; r < rounds; r++)
+		for(v = 0; v < 2; v++) {
+			key = rand();
+			fill_random(fb, v, key);
+			for(i = 0; i < 4; i++)
+				for(a = 0; a < 16; a++) {
+					if(!(modes[i] & COMPOSE_BLEND) && a)
+						break;
+					memset(&cc, 0, sizeof(cc));
+					cc.layer = 0;
+					cc.mode = modes[i];
+					cc.alpha = a;
+					/* the key as the MLC sees it, widened */
+					cc.tpcolor = widen565(key);
+					failed += check(v ? "subtitle" : "hud", v,
+							&cc, key, fb, ref, hw);
+					checks++;
+				}
+		}
+
+	printf("%d profiles checked, %d not equivalent\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * tools/convcheck.c
+ *
+ * Check the driver's pixel format converter, ../lf1000fb_convert.h, on
+ * the host:
+ *
+ *	convcheck [-b] [-w width] [-n rows]
+ *
+ * Every format pair convert_init() gives a fast path, with and without
+ * CONVERT_DITHER, converts random rows of many widths, odd ones and
+ * CONVERT_MAX_WIDTH included, on each of the 4 dither rows.  The result
+ * must match the generic converter in every used bit, and nothing past
+ * the end of the row may be written.  -b then times each fast path
+ * against the generic converter on -n rows of -w pixels.  Exits 1 if any
+ * row differs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "../lf1000fb.h"
+#include "mlcmodel.h"
+#include "kcompat.h"
+#include "../lf1000fb_convert.h"
+
+#define GUARD		16
+#define BUF_SIZE	(CONVERT_MAX_WIDTH*4 + GUARD)
+
+static const int widths[] = {
+	1, 2, 3, 4, 5, 7, 8, 15, 16, 17, 31, 64, 319, 320, CONVERT_MAX_WIDTH
+};
+
+static const char *path_name(const struct lf1000fb_convert *cv)
+{
+	if(cv->row == convert_row_copy)
+		return "copy";
+	if(cv->row == convert_row_swap16)
+		return "swap16";
+	if(cv->row == convert_row_swap32)
+		return "swap32";
+	if(cv->row == convert_row_565_8888)
+		return "565_8888";
+	if(cv->row == convert_row_8888_565)
+		return "8888_565";
+	return "generic";
+}
+
+static const char *fmt_name(const struct lf1000fb_pixfmt *pf)
+{
+	const struct mlc_pixfmt *m = mlc_pixfmt_find(pf->code, pf->bpp);
+
+	return m ? m->name : "?";
+}
+
+static u32 used_bits(const struct lf1000fb_pixfmt *df)
+{
+	return (BIT_MASK_ONES(df->r_len)<<df->r_off) |
+	       (BIT_MASK_ONES(df->g_len)<<df->g_off) |
+	       (BIT_MASK_ONES(df->b_len)<<df->b_off) |
+	       ((u32)BIT_MASK_ONES(df->a_len)<<df->a_off);
+}
+
+static u32 seed = 1;
+
+static void fill_random(u8 *p, int n)
+{
+	while(n--) {
+		seed = seed*1103515245 + 12345;
+		*p++ = seed>>16;
+	}
+}
+
+/* one pair: 0, or 1 after printing the first difference */
+static int check_pair(struct lf1000fb_convert *cv, u8 *src, u8 *out,
+		      u8 *exp)
+{
+	const struct lf1000fb_pixfmt *df = cv->df;
+	struct lf1000fb_convert ref = *cv;
+	u32 used = used_bits(df);
+	int i, w, x, y, len;
+
+	ref.row = convert_row_generic;
+	for(i = 0; i < ARRAY_SIZE(widths); i++)
+	for(y = 0; y < 4; y++) {
+		w = widths[i];
+		len = w*df->bpp;
+		fill_random(src, w*cv->sf->bpp);
+		memset(out, 0xA5, len + GUARD);
+		memset(exp, 0xA5, len + GUARD);
+		cv->row(cv, src, out, w, y);
+		ref.row(&ref, src, exp, w, y);
+		for(x = 0; x < w; x++)
+			if((pix_load(out + x*df->bpp, df->bpp) ^
+			    pix_load(exp + x*df->bpp, df->bpp)) & used)
+				goto differs;
+		for(x = len; x < len + GUARD; x++)
+			if(out[x] != 0xA5) {
+				printf("%s -> %s (%s): width %d wrote past "
+				       "the row\n", fmt_name(cv->sf),
+				       fmt_name(df), path_name(cv), w);
+				return 1;
+			}
+	}
+	return 0;
+
+differs:
+	printf("%s -> %s (%s): width %d row %d pixel %d is 0x%08x, "
+	       "generic 0x%08x\n", fmt_name(cv->sf), fmt_name(df),
+	       path_name(cv), w, y, x,
+	       pix_load(out + x*df->bpp, df->bpp) & used,
+	       pix_load(exp + x*df->bpp, df->bpp) & used);
+	return 1;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* Mpixel/s of cv over rows rows of width pixels */
+static double rate(struct lf1000fb_convert *cv, u8 *src, u8 *out,
+		   int width, int rows)
+{
+	double t = now_s();
+	int y;
+
+	for(y = 0; y < rows; y++)
+		cv->row(cv, src, out, width, y);
+	t = now_s() - t;
+	return t > 0 ? (double)width*rows/t/1e6 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	static u8 src[BUF_SIZE], out[BUF_SIZE], exp[BUF_SIZE];
+	const struct lf1000fb_pixfmt *sf, *df;
+	struct lf1000fb_convert cv, ref;
+	int bench = 0, width = 320, rows = 20000;
+	int opt, s, d, dither, pairs = 0, bad = 0;
+	double fast, slow;
+
+	while((opt = getopt(argc, argv, "bw:n:")) != -1) {
+		switch(opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'n':
+			rows = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if(width < 1 || width > CONVERT_MAX_WIDTH || rows < 1)
+		goto usage;
+
+	for(dither = 0; dither < 2; dither++)
+	for(s = 0; s < ARRAY_SIZE(lf1000fb_formats); s++)
+	for(d = 0; d < ARRAY_SIZE(lf1000fb_formats); d++) {
+		sf = &lf1000fb_formats[s];
+		df = &lf1000fb_formats[d];
+		convert_init(&cv, sf->code, sf->bpp, df->code, df->bpp,
+			     dither ? CONVERT_DITHER : 0);
+		if(cv.row == convert_row_generic)
+			continue;
+		pairs++;
+		bad += check_pair(&cv, src, out, exp);
+	}
+	printf("%d fast path pairs checked, %d differ\n", pairs, bad);
+
+	if(bench) {
+		printf("%d rows of %d pixels, Mpixel/s\n", rows, width);
+		fill_random(src, width*4);
+		for(s = 0; s < ARRAY_SIZE(lf1000fb_formats); s++)
+		for(d = 0; d < ARRAY_SIZE(lf1000fb_formats); d++) {
+			sf = &lf1000fb_formats[s];
+			df = &lf1000fb_formats[d];
+			convert_init(&cv, sf->code, sf->bpp, df->code,
+				     df->bpp, 0);
+			if(cv.row == convert_row_generic ||
+			   cv.row == convert_row_copy)
+				continue;
+			ref = cv;
+			ref.row = convert_row_generic;
+			fast = rate(&cv, src, out, width, rows);
+			slow = rate(&ref, src, out, width, rows);
+			printf("  %-9s -> %-9s %-9s %8.1f  generic %7.1f  "
+			       "x%.1f\n", fmt_name(sf), fmt_name(df),
+			       path_name(&cv), fast, slow,
+			       slow > 0 ? fast/slow : 0);
+		}
+	}
+	return bad ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: convcheck [-b] [-w width] [-n rows]\n");
+	return 2;
+}
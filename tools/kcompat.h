@@ -0,0 +1,39 @@
+/*
+ * tools/kcompat.h
+ *
+ * The kernel types, limits and helpers the driver code shared with the tools
+ * (../lf1000fb_mlc.h, ../lf1000fb_convert.h) uses, for the host.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef KCOMPAT_H
+#define KCOMPAT_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t		u8;
+typedef uint16_t	u16;
+typedef uint32_t	u32;
+typedef int32_t		s32;
+typedef uint64_t	u64;
+
+#define ARRAY_SIZE(a)	(sizeof(a)/sizeof((a)[0]))
+#define max(a, b)	((a) > (b) ? (a) : (b))
+
+static inline u32 ioread32(void *addr)
+{
+	return *(volatile u32 *)addr;
+}
+
+static inline void iowrite32(u32 val, void *addr)
+{
+	*(volatile u32 *)addr = val;
+}
+
+#endif /* KCOMPAT_H */
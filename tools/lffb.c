@@ -0,0 +1,258 @@
+/*
+ * tools/lffb.c
+ *
+ * Client library for the lf1000fb MLC layer ioctls, see lffb.h.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lffb.h"
+
+static int sys_ioctl(struct lffb *fb, unsigned long req, void *arg)
+{
+	int ret = ioctl(fb->fd, req, arg);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static int xioctl(struct lffb *fb, unsigned long req, void *arg)
+{
+	fb->syscalls++;
+	return fb->ioctl(fb, req, arg);
+}
+
+int lffb_init(struct lffb *fb, int fd,
+	      int (*ioctl)(struct lffb *fb, unsigned long req, void *arg))
+{
+	int layer;
+
+	fb->fd = fd;
+	fb->ioctl = ioctl ? ioctl : sys_ioctl;
+	fb->syscalls = 0;
+	memset(fb->next, 0, sizeof(fb->next));
+	for(layer = 0; layer < MLC_NUM_LAYERS; layer++) {
+		memset(&fb->state[layer], 0, sizeof(fb->state[layer]));
+		fb->state[layer].layer = layer;
+		/* without it nothing is known and every change goes out */
+		if(xioctl(fb, MLC_IOCGLAYERSTATE, &fb->state[layer]) < 0)
+			fb->state[layer].mask = 0;
+		fb->next[layer].layer = layer;
+	}
+	return 0;
+}
+
+int lffb_open(struct lffb *fb, const char *dev)
+{
+	int fd = open(dev, O_RDWR);
+
+	if(fd < 0)
+		return -errno;
+	return lffb_init(fb, fd, NULL);
+}
+
+void lffb_close(struct lffb *fb)
+{
+	if(fb->fd >= 0)
+		close(fb->fd);
+	fb->fd = -1;
+}
+
+const struct layer_state_cmd *lffb_layer(struct lffb *fb, int layer)
+{
+	if(layer < 0 || layer >= MLC_NUM_LAYERS)
+		return NULL;
+	return &fb->state[layer];
+}
+
+/* mark bit to go out unless the driver already has what next holds */
+static void stage(struct lffb *fb, int layer, unsigned int bit, int same)
+{
+	if((fb->state[layer].mask & bit) && same)
+		fb->next[layer].mask &= ~bit;
+	else
+		fb->next[layer].mask |= bit;
+}
+
+#define STAGE(fb, layer, bit, field, val) do {				\
+	(fb)->next[layer].field = (val);				\
+	stage(fb, layer, bit, (fb)->state[layer].field == (val));	\
+} while(0)
+
+static int bad_layer(int layer, int rgb_only)
+{
+	return layer < 0 || layer >= MLC_NUM_LAYERS ||
+	       (rgb_only && layer == MLC_VIDEO_LAYER);
+}
+
+int lffb_set_enable(struct lffb *fb, int layer, int on)
+{
+	if(bad_layer(layer, 0))
+		return -EINVAL;
+	STAGE(fb, layer, LAYER_ENABLE, enable, on ? 1u : 0u);
+	return 0;
+}
+
+int lffb_set_address(struct lffb *fb, int layer, unsigned int address)
+{
+	if(bad_layer(layer, 0))
+		return -EINVAL;
+	STAGE(fb, layer, LAYER_ADDRESS, address, address);
+	return 0;
+}
+
+int lffb_set_format(struct lffb *fb, int layer, unsigned int code, int bpp)
+{
+	if(bad_layer(layer, 1) || code > 0xFFFF || bpp < 1 || bpp > 4)
+		return -EINVAL;
+	STAGE(fb, layer, LAYER_FORMAT, format, code);
+	STAGE(fb, layer, LAYER_HSTRIDE, hstride, (unsigned int)bpp);
+	return 0;
+}
+
+int lffb_set_stride(struct lffb *fb, int layer, unsigned int vstride)
+{
+	if(bad_layer(layer, 0))
+		return -EINVAL;
+	STAGE(fb, layer, LAYER_VSTRIDE, vstride, vstride);
+	return 0;
+}
+
+int lffb_set_position(struct lffb *fb, int layer, int x, int y,
+		      int width, int height)
+{
+	struct position_cmd *p;
+
+	if(bad_layer(layer, 0) || width <= 0 || height <= 0 ||
+	   x < -0x400 || y < -0x400 || x + width > 0x800 || y + height > 0x800)
+		return -EINVAL;
+	p = &fb->next[layer].position;
+	p->left = x;
+	p->top = y;
+	p->right = x + width;	/* exclusive */
+	p->bottom = y + height;
+	stage(fb, layer, LAYER_POSITION,
+	      !memcmp(p, &fb->state[layer].position, sizeof(*p)));
+	return 0;
+}
+
+int lffb_set_scale(struct lffb *fb, int layer, int src_width,
+		   int src_height, int dst_width, int dst_height)
+{
+	struct overlaysize_cmd *o;
+
+	if(layer != MLC_VIDEO_LAYER || src_width <= 0 || src_height <= 0 ||
+	   dst_width < 2 || dst_height < 2)
+		return -EINVAL;
+	o = &fb->next[layer].overlaysize;
+	o->srcwidth = src_width;
+	o->srcheight = src_height;
+	o->dstwidth = dst_width;
+	o->dstheight = dst_height;
+	stage(fb, layer, LAYER_OVERLAYSIZE,
+	      !memcmp(o, &fb->state[layer].overlaysize, sizeof(*o)));
+	return 0;
+}
+
+int lffb_set_alpha(struct lffb *fb, int layer, unsigned int alpha,
+		   int blend)
+{
+	if(bad_layer(layer, 0) || alpha > 15)
+		return -EINVAL;
+	STAGE(fb, layer, LAYER_ALPHA, alpha, alpha);
+	STAGE(fb, layer, LAYER_BLEND, blend, blend ? 1u : 0u);
+	return 0;
+}
+
+int lffb_set_colorkey(struct lffb *fb, int layer, unsigned int rgb, int on)
+{
+	if(bad_layer(layer, 1) || rgb > 0xFFFFFF)
+		return -EINVAL;
+	STAGE(fb, layer, LAYER_TPCOLOR, tpcolor, rgb);
+	STAGE(fb, layer, LAYER_TRANSP, transp, on ? 1u : 0u);
+	return 0;
+}
+
+/* fields of bits from src into dst */
+static void merge(struct layer_state_cmd *dst,
+		  const struct layer_state_cmd *src, unsigned int bits)
+{
+	if(bits & LAYER_ENABLE)
+		dst->enable = src->enable;
+	if(bits & LAYER_ADDRESS)
+		dst->address = src->address;
+	if(bits & LAYER_FORMAT)
+		dst->format = src->format;
+	if(bits & LAYER_HSTRIDE)
+		dst->hstride = src->hstride;
+	if(bits & LAYER_VSTRIDE)
+		dst->vstride = src->vstride;
+	if(bits & LAYER_POSITION)
+		dst->position = src->position;
+	if(bits & LAYER_OVERLAYSIZE)
+		dst->overlaysize = src->overlaysize;
+	if(bits & LAYER_ALPHA)
+		dst->alpha = src->alpha;
+	if(bits & LAYER_TPCOLOR)
+		dst->tpcolor = src->tpcolor;
+	if(bits & LAYER_BLEND)
+		dst->blend = src->blend;
+	if(bits & LAYER_TRANSP)
+		dst->transp = src->transp;
+	dst->mask |= bits;
+}
+
+int lffb_commit(struct lffb *fb)
+{
+	struct layer_state_cmd st;
+	unsigned int bits;
+	int layer, ret;
+
+	for(layer = 0; layer < MLC_NUM_LAYERS; layer++) {
+		bits = fb->next[layer].mask;
+		if(!bits)
+			continue;
+		st = fb->next[layer];
+		st.layer = layer;
+		st.mask = bits | LAYER_DIRTY;
+		ret = xioctl(fb, MLC_IOCSLAYERSTATE, &st);
+		if(ret < 0)
+			return ret;
+		/*
+		 * The driver applies all of it or none of it, so on an
+		 * error everything stays staged for the next commit.
+		 */
+		fb->next[layer].mask = 0;
+		merge(&fb->state[layer], &st, bits);
+	}
+	return 0;
+}
+
+int lffb_flip(struct lffb *fb, int layer, unsigned int address,
+	      unsigned int target)
+{
+	struct flip_cmd f;
+	int ret;
+
+	if(bad_layer(layer, 0))
+		return -EINVAL;
+	memset(&f, 0, sizeof(f));
+	f.layer = layer;
+	f.address = address;
+	f.target = target;
+	f.fence = -1;
+	ret = xioctl(fb, MLC_IOCSFLIP, &f);
+	if(ret < 0)
+		return ret;
+	/* the flip supersedes an address still waiting for a commit */
+	fb->next[layer].mask &= ~LAYER_ADDRESS;
+	fb->state[layer].address = address;
+	fb->state[layer].mask |= LAYER_ADDRESS;
+	return 0;
+}
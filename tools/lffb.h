@@ -0,0 +1,70 @@
+/*
+ * tools/lffb.h
+ *
+ * Client library for the lf1000fb MLC layer ioctls.  It keeps what the
+ * driver last reported for every layer, so getters cost no syscall and
+ * setters that change nothing are dropped, and it sends all changes to
+ * a layer in one MLC_IOCSLAYERSTATE when lffb_commit() is called:
+ *
+ *	struct lffb fb;
+ *
+ *	lffb_open(&fb, "/dev/fb0");
+ *	lffb_set_position(&fb, 1, x, y, 64, 64);
+ *	lffb_set_alpha(&fb, 1, 8, 1);
+ *	lffb_commit(&fb);		one ioctl for both changes
+ *	lffb_flip(&fb, 2, next_frame, 0);
+ *
+ * Functions return 0 or a negative errno.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef LFFB_H
+#define LFFB_H
+
+#include <sys/ioctl.h>
+
+#include "../lf1000fb.h"
+
+struct lffb {
+	int	fd;
+	/* ioctl() by default, a stand-in for the driver in tests */
+	int	(*ioctl)(struct lffb *fb, unsigned long req, void *arg);
+	void	*priv;
+	unsigned long syscalls;		/* ioctls issued so far */
+	struct layer_state_cmd state[MLC_NUM_LAYERS];	/* driver's view */
+	struct layer_state_cmd next[MLC_NUM_LAYERS];	/* to commit */
+};
+
+int lffb_open(struct lffb *fb, const char *dev);
+int lffb_init(struct lffb *fb, int fd,
+	      int (*ioctl)(struct lffb *fb, unsigned long req, void *arg));
+void lffb_close(struct lffb *fb);
+
+/* cached state, LAYER_* bits in ->mask tell what is known */
+const struct layer_state_cmd *lffb_layer(struct lffb *fb, int layer);
+
+int lffb_set_enable(struct lffb *fb, int layer, int on);
+int lffb_set_address(struct lffb *fb, int layer, unsigned int address);
+/* MLC format code and bytes per pixel, RGB layers */
+int lffb_set_format(struct lffb *fb, int layer, unsigned int code, int bpp);
+int lffb_set_stride(struct lffb *fb, int layer, unsigned int vstride);
+int lffb_set_position(struct lffb *fb, int layer, int x, int y,
+		      int width, int height);
+/* video layer source size scaled to its destination size */
+int lffb_set_scale(struct lffb *fb, int layer, int src_width,
+		   int src_height, int dst_width, int dst_height);
+int lffb_set_alpha(struct lffb *fb, int layer, unsigned int alpha,
+		   int blend);
+int lffb_set_colorkey(struct lffb *fb, int layer, unsigned int rgb, int on);
+
+/* changes since the last commit, one ioctl per changed layer */
+int lffb_commit(struct lffb *fb);
+
+/* show address on layer at vblank target (0 = next), see MLC_IOCSFLIP */
+int lffb_flip(struct lffb *fb, int layer, unsigned int address,
+	      unsigned int target);
+
+#endif /* LFFB_H */
@@ -0,0 +1,322 @@
+/*
+ * tools/lffbbench.c
+ *
+ * Count ioctls per frame for a sprite-plus-video scene, driven once the
+ * way applications do it today, one wrapper call per property that sets
+ * it, sets the dirty flag and reads the layer back, and once through
+ * liblffb.  Each frame the sprite on layer 1 moves, changes its animation
+ * cel every 4th frame and fades in over the first 16 frames; the video
+ * layer shows a new decoded frame.
+ *
+ * By default the ioctls go to a stand-in for the driver that keeps the
+ * layer state as MLC_IOCSLAYERSTATE/MLC_IOCGLAYERSTATE/MLC_IOCSFLIP
+ * would, and the final state of both runs is compared, then a commit
+ * the stand-in refuses must leave its change staged for the next one.
+ * With -d the scene runs on the device instead.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/fb.h>
+
+#include "lffb.h"
+
+#define SPRITE		1
+#define VIDEO		MLC_VIDEO_LAYER
+#define SPRITE_OFF	0x40000	/* 4 cels of 64x64 ARGB8888 */
+#define VIDEO_OFF	0x60000	/* 3 frames of 160x120 4:2:0 */
+#define VIDEO_FRAME	(160*120*3/2)
+
+/* stand-in for the driver: the layer state it would report */
+struct fake {
+	struct layer_state_cmd layer[MLC_NUM_LAYERS];
+	unsigned long calls[3];		/* set, get, flip */
+	int fail;			/* sets to refuse with -EBUSY */
+};
+
+static int fake_ioctl(struct lffb *fb, unsigned long req, void *arg)
+{
+	struct fake *f = fb->priv;
+	struct layer_state_cmd *st = arg, *l;
+	struct flip_cmd *fl = arg;
+	unsigned int m;
+
+	switch(req) {
+	case MLC_IOCSLAYERSTATE:
+		f->calls[0]++;
+		if(st->layer >= MLC_NUM_LAYERS)
+			return -EINVAL;
+		if(f->fail > 0) {
+			f->fail--;
+			return -EBUSY;
+		}
+		l = &f->layer[st->layer];
+		m = st->mask;
+		if(m & LAYER_ENABLE)
+			l->enable = st->enable;
+		if(m & LAYER_ADDRESS)
+			l->address = st->address;
+		if(m & LAYER_FORMAT)
+			l->format = st->format;
+		if(m & LAYER_HSTRIDE)
+			l->hstride = st->hstride;
+		if(m & LAYER_VSTRIDE)
+			l->vstride = st->vstride;
+		if(m & LAYER_POSITION)
+			l->position = st->position;
+		if(m & LAYER_OVERLAYSIZE)
+			l->overlaysize = st->overlaysize;
+		if(m & LAYER_ALPHA)
+			l->alpha = st->alpha;
+		if(m & LAYER_TPCOLOR)
+			l->tpcolor = st->tpcolor;
+		if(m & LAYER_BLEND)
+			l->blend = st->blend;
+		if(m & LAYER_TRANSP)
+			l->transp = st->transp;
+		return 0;
+	case MLC_IOCGLAYERSTATE:
+		f->calls[1]++;
+		if(st->layer >= MLC_NUM_LAYERS)
+			return -EINVAL;
+		*st = f->layer[st->layer];
+		st->mask = LAYER_ENABLE|LAYER_ADDRESS|LAYER_VSTRIDE|
+			   LAYER_POSITION|LAYER_ALPHA|LAYER_BLEND;
+		/* the video layer sizes only once they have been set */
+		if(st->layer != VIDEO)
+			st->mask |= LAYER_RGB_ONLY;
+		else if(st->overlaysize.dstwidth)
+			st->mask |= LAYER_OVERLAYSIZE;
+		return 0;
+	case MLC_IOCSFLIP:
+		f->calls[2]++;
+		if(fl->layer >= MLC_NUM_LAYERS)
+			return -EINVAL;
+		f->layer[fl->layer].address = fl->address;
+		return 0;
+	}
+	return -ENOTTY;
+}
+
+/* today's wrappers: set one property, flag it dirty, read it back */
+static int naive_set(struct lffb *fb, int layer, unsigned int bit,
+		     const struct layer_state_cmd *val)
+{
+	struct layer_state_cmd st = *val;
+	int ret;
+
+	st.layer = layer;
+	st.mask = bit;
+	ret = fb->ioctl(fb, MLC_IOCSLAYERSTATE, &st);
+	st.mask = LAYER_DIRTY;
+	if(ret == 0)
+		ret = fb->ioctl(fb, MLC_IOCSLAYERSTATE, &st);
+	if(ret == 0)
+		ret = fb->ioctl(fb, MLC_IOCGLAYERSTATE, &st);
+	fb->syscalls += 3;
+	return ret;
+}
+
+static void sprite_pos(int frame, struct position_cmd *p)
+{
+	p->left = (frame*3) % (320-64);
+	p->top = (frame*2) % (240-64);
+	p->right = p->left + 64;
+	p->bottom = p->top + 64;
+}
+
+static int naive_setup(struct lffb *fb, unsigned int base)
+{
+	struct layer_state_cmd v;
+	int ret = 0;
+
+	memset(&v, 0, sizeof(v));
+	v.format = 0x0653;
+	v.hstride = 4;
+	v.vstride = 64*4;
+	v.enable = 1;
+	v.tpcolor = 0xFF00FF;
+	v.transp = 1;
+	v.blend = 1;
+	ret |= naive_set(fb, SPRITE, LAYER_FORMAT, &v);
+	ret |= naive_set(fb, SPRITE, LAYER_HSTRIDE, &v);
+	ret |= naive_set(fb, SPRITE, LAYER_VSTRIDE, &v);
+	ret |= naive_set(fb, SPRITE, LAYER_TPCOLOR, &v);
+	ret |= naive_set(fb, SPRITE, LAYER_TRANSP, &v);
+	ret |= naive_set(fb, SPRITE, LAYER_BLEND, &v);
+	ret |= naive_set(fb, SPRITE, LAYER_ENABLE, &v);
+
+	v.vstride = 160;
+	v.overlaysize.srcwidth = 160;
+	v.overlaysize.srcheight = 120;
+	v.overlaysize.dstwidth = 320;
+	v.overlaysize.dstheight = 240;
+	v.position.right = 320;
+	v.position.bottom = 240;
+	v.address = base + VIDEO_OFF;
+	ret |= naive_set(fb, VIDEO, LAYER_VSTRIDE, &v);
+	ret |= naive_set(fb, VIDEO, LAYER_OVERLAYSIZE, &v);
+	ret |= naive_set(fb, VIDEO, LAYER_POSITION, &v);
+	ret |= naive_set(fb, VIDEO, LAYER_ADDRESS, &v);
+	ret |= naive_set(fb, VIDEO, LAYER_ENABLE, &v);
+	return ret;
+}
+
+static int naive_frame(struct lffb *fb, unsigned int base, int frame)
+{
+	struct layer_state_cmd v;
+	int ret = 0;
+
+	memset(&v, 0, sizeof(v));
+	sprite_pos(frame, &v.position);
+	ret |= naive_set(fb, SPRITE, LAYER_POSITION, &v);
+	if(frame % 4 == 0) {
+		v.address = base + SPRITE_OFF + (frame/4 % 4)*64*64*4;
+		ret |= naive_set(fb, SPRITE, LAYER_ADDRESS, &v);
+	}
+	if(frame < 16) {
+		v.alpha = frame;
+		ret |= naive_set(fb, SPRITE, LAYER_ALPHA, &v);
+	}
+	v.address = base + VIDEO_OFF + (frame % 3)*VIDEO_FRAME;
+	ret |= naive_set(fb, VIDEO, LAYER_ADDRESS, &v);
+	return ret;
+}
+
+static int lib_setup(struct lffb *fb, unsigned int base)
+{
+	int ret = 0;
+
+	ret |= lffb_set_format(fb, SPRITE, 0x0653, 4);
+	ret |= lffb_set_stride(fb, SPRITE, 64*4);
+	ret |= lffb_set_colorkey(fb, SPRITE, 0xFF00FF, 1);
+	ret |= lffb_set_alpha(fb, SPRITE, 0, 1);
+	ret |= lffb_set_enable(fb, SPRITE, 1);
+	ret |= lffb_set_stride(fb, VIDEO, 160);
+	ret |= lffb_set_scale(fb, VIDEO, 160, 120, 320, 240);
+	ret |= lffb_set_position(fb, VIDEO, 0, 0, 320, 240);
+	ret |= lffb_set_address(fb, VIDEO, base + VIDEO_OFF);
+	ret |= lffb_set_enable(fb, VIDEO, 1);
+	return ret | lffb_commit(fb);
+}
+
+static int lib_frame(struct lffb *fb, unsigned int base, int frame)
+{
+	struct position_cmd p;
+	int ret = 0;
+
+	sprite_pos(frame, &p);
+	ret |= lffb_set_position(fb, SPRITE, p.left, p.top, 64, 64);
+	/* every frame is fine, unchanged values cost nothing */
+	ret |= lffb_set_address(fb, SPRITE,
+				base + SPRITE_OFF + (frame/4 % 4)*64*64*4);
+	ret |= lffb_set_alpha(fb, SPRITE, frame < 16 ? frame : 15, 1);
+	ret |= lffb_commit(fb);
+	return ret | lffb_flip(fb, VIDEO,
+			       base + VIDEO_OFF + (frame % 3)*VIDEO_FRAME, 0);
+}
+
+static int run(const char *name, struct lffb *fb, unsigned int base,
+	       int frames, int lib)
+{
+	unsigned long start;
+	int i, ret;
+
+	ret = lib ? lib_setup(fb, base) : naive_setup(fb, base);
+	start = fb->syscalls;
+	for(i = 0; i < frames && ret == 0; i++)
+		ret = lib ? lib_frame(fb, base, i) : naive_frame(fb, base, i);
+	if(ret) {
+		fprintf(stderr, "lffbbench: %s: %s\n", name, strerror(-ret));
+		return -1;
+	}
+	printf("%-8s %6lu ioctls for %d frames, %.2f per frame "
+	       "(%lu in setup)\n", name, fb->syscalls - start, frames,
+	       (double)(fb->syscalls - start)/frames, start);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct fake naive, lib;
+	struct fb_fix_screeninfo fix;
+	const char *dev = NULL;
+	struct lffb fb;
+	unsigned int base = 0x02800000;
+	int frames = 600, opt, fd, i;
+
+	while((opt = getopt(argc, argv, "n:d:")) != -1) {
+		switch(opt) {
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'd':
+			dev = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: lffbbench [-n frames] "
+				"[-d /dev/fb0]\n");
+			return 2;
+		}
+	}
+	if(frames <= 0)
+		return 2;
+
+	if(dev) {
+		fd = open(dev, O_RDWR);
+		if(fd < 0 || ioctl(fd, FBIOGET_FSCREENINFO, &fix) < 0) {
+			perror(dev);
+			return 1;
+		}
+		base = fix.smem_start;
+		lffb_init(&fb, fd, NULL);
+		fb.syscalls = 0;
+		if(run("naive", &fb, base, frames, 0) < 0)
+			return 1;
+		lffb_init(&fb, fd, NULL);
+		fb.syscalls = 0;
+		return run("liblffb", &fb, base, frames, 1) < 0;
+	}
+
+	memset(&naive, 0, sizeof(naive));
+	memset(&lib, 0, sizeof(lib));
+	for(i = 0; i < MLC_NUM_LAYERS; i++)
+		naive.layer[i].layer = lib.layer[i].layer = i;
+
+	fb.priv = &naive;
+	lffb_init(&fb, -1, fake_ioctl);
+	fb.syscalls = 0;
+	if(run("naive", &fb, base, frames, 0) < 0)
+		return 1;
+
+	fb.priv = &lib;
+	lffb_init(&fb, -1, fake_ioctl);
+	fb.syscalls = 0;
+	if(run("liblffb", &fb, base, frames, 1) < 0)
+		return 1;
+
+	if(memcmp(naive.layer, lib.layer, sizeof(naive.layer))) {
+		printf("final layer state differs\n");
+		return 1;
+	}
+	printf("final layer state identical\n");
+
+	/* a refused commit must leave the change staged for the next one */
+	lffb_set_alpha(&fb, SPRITE, 7, 1);
+	lib.fail = 1;
+	if(lffb_commit(&fb) != -EBUSY || lffb_commit(&fb) != 0 ||
+	   lib.layer[SPRITE].alpha != 7) {
+		printf("change lost after a failed commit\n");
+		return 1;
+	}
+	printf("failed commit retried\n");
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * tools/mlcbench.c
+ *
+ * Compose many frames with the MLC model and report the rate.  Without
+ * -r/-m it builds a 320x240 scene: an RGB565 layer 0, a 64x64 ARGB8888
+ * sprite on layer 1 blended and colour keyed, moving every frame, and a
+ * 160x120 video layer scaled up to full screen underneath.  The CRC of
+ * the last frame is printed so runs can be compared.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "../lf1000fb.h"
+#include "mlcmodel.h"
+#include "mlcdrv.h"
+
+#define SCENE_FB_ADDR	0x02800000
+#define SCENE_FB_SIZE	0x00100000
+#define SCENE_W		320
+#define SCENE_H		240
+#define SPRITE_OFF	0x40000
+#define VIDEO_OFF	0x60000
+#define VIDEO_W		160
+#define VIDEO_H		120
+
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = ~0;
+	int k;
+
+	while(len--) {
+		crc ^= *p++;
+		for(k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static void scene_layer(struct mlc_model *m, int layer, uint32_t ctl,
+			uint32_t addr, int hstride, int vstride)
+{
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_CONTROL], ctl);
+	if(hstride)
+		mlc_wr(m, mlc_layer_regs[layer][MLC_REG_HSTRIDE], hstride);
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_VSTRIDE], vstride);
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_ADDRESS], addr);
+}
+
+static void scene_position(struct mlc_model *m, int layer, int left,
+			   int top, int right, int bottom)
+{
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_LEFTRIGHT],
+	       ((left & 0x7FF)<<LEFT) | (((right-1) & 0x7FF)<<RIGHT));
+	mlc_wr(m, mlc_layer_regs[layer][MLC_REG_TOPBOTTOM],
+	       ((top & 0x7FF)<<TOP) | (((bottom-1) & 0x7FF)<<BOTTOM));
+}
+
+static void scene_build(struct mlc_model *m, uint8_t *fb)
+{
+	uint8_t *p;
+	int x, y;
+
+	m->fb = fb;
+	m->fb_addr = SCENE_FB_ADDR;
+	m->fb_size = SCENE_FB_SIZE;
+
+	mlc_wr(m, MLCCONTROLT, (1<<MLCENB) | (2<<PRIORITY));
+	mlc_wr(m, MLCSCREENSIZE,
+	       ((SCENE_H-1)<<SCREENHEIGHT) | ((SCENE_W-1)<<SCREENWIDTH));
+	mlc_wr(m, MLCBGCOLOR, 0x203040);
+
+	/* layer 0: RGB565 gradient with a keyed hole in the middle */
+	for(y = 0; y < SCENE_H; y++)
+		for(x = 0; x < SCENE_W; x++) {
+			p = fb + (y*SCENE_W + x)*2;
+			p[0] = x ^ y;
+			p[1] = (x + y) >> 1;
+			if(x >= 100 && x < 220 && y >= 80 && y < 160)
+				p[0] = p[1] = 0;
+		}
+	scene_layer(m, 0, (1<<LAYERENB) | (1<<TPENB) | (0x4432<<FORMAT),
+		    SCENE_FB_ADDR, 2, SCENE_W*2);
+	scene_position(m, 0, 0, 0, SCENE_W, SCENE_H);
+
+	/* layer 1: ARGB8888 sprite, alpha ramp, keyed corners */
+	for(y = 0; y < 64; y++)
+		for(x = 0; x < 64; x++) {
+			p = fb + SPRITE_OFF + (y*64 + x)*4;
+			p[0] = x*4;
+			p[1] = y*4;
+			p[2] = 0xC0;
+			p[3] = (x + y)*2;
+			if((x < 8 || x >= 56) && (y < 8 || y >= 56))
+				p[0] = p[1] = p[2] = 0xFF;
+		}
+	scene_layer(m, 1, (1<<LAYERENB) | (1<<BLENDENB) | (1<<TPENB) |
+		    (0x0653<<FORMAT), SCENE_FB_ADDR + SPRITE_OFF, 4, 64*4);
+	mlc_wr(m, mlc_layer_regs[1][MLC_REG_TPCOLOR], 0xFFFFFF<<TPCOLOR);
+
+	/* video layer: Y plane ramp, flat chroma, 2x up with the filter */
+	for(y = 0; y < VIDEO_H; y++)
+		for(x = 0; x < VIDEO_W; x++)
+			fb[VIDEO_OFF + y*VIDEO_W + x] = 16 + (x + y) % 220;
+	memset(fb + VIDEO_OFF + VIDEO_W*VIDEO_H, 100, VIDEO_W*VIDEO_H/2);
+	scene_layer(m, MLC_VIDEO_LAYER, 1<<LAYERENB,
+		    SCENE_FB_ADDR + VIDEO_OFF, 0, VIDEO_W);
+	mlc_wr(m, MLCADDRESSCB, SCENE_FB_ADDR + VIDEO_OFF +
+	       VIDEO_W*VIDEO_H);
+	mlc_wr(m, MLCADDRESSCR, SCENE_FB_ADDR + VIDEO_OFF +
+	       VIDEO_W*VIDEO_H*5/4);
+	mlc_wr(m, MLCSTRIDECB, VIDEO_W/2);
+	mlc_wr(m, MLCSTRIDECR, VIDEO_W/2);
+	mlc_wr(m, MLCHSCALE, (1<<HFILTERENB) |
+	       (((VIDEO_W-1)<<11)/(SCENE_W-1)));
+	mlc_wr(m, MLCVSCALE, (1<<VFILTERENB) |
+	       (((VIDEO_H-1)<<11)/(SCENE_H-1)));
+	scene_position(m, MLC_VIDEO_LAYER, 0, 0, SCENE_W, SCENE_H);
+}
+
+static uint8_t *load_file(const char *name, uint32_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *buf;
+	long len;
+
+	if(!f || fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0) {
+		perror(name);
+		exit(1);
+	}
+	rewind(f);
+	buf = malloc(len ? len : 1);
+	if(!buf || fread(buf, 1, len, f) != (size_t)len) {
+		perror(name);
+		exit(1);
+	}
+	fclose(f);
+	*size = len;
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	const char *regs = NULL, *mem = NULL, *fmt = "RGB565";
+	const struct mlc_pixfmt *of;
+	struct timespec t0, t1;
+	struct mlc_model m;
+	int frames = 1000, width, height, i, opt;
+	uint32_t size;
+	uint8_t *frame, *fb;
+	double s;
+	FILE *f;
+
+	while((opt = getopt(argc, argv, "n:r:m:f:")) != -1) {
+		switch(opt) {
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'r':
+			regs = optarg;
+			break;
+		case 'm':
+			mem = optarg;
+			break;
+		case 'f':
+			fmt = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: mlcbench [-n frames] "
+				"[-r registers -m fbmem] [-f format]\n");
+			return 2;
+		}
+	}
+	of = mlc_pixfmt_byname(fmt);
+	if(!of || frames <= 0 || !regs != !mem) {
+		fprintf(stderr, "mlcbench: bad arguments\n");
+		return 2;
+	}
+
+	memset(&m, 0, sizeof(m));
+	if(regs) {
+		f = fopen(regs, "r");
+		if(!f || mlc_load_snapshot(&m, f, 0) < 0) {
+			fprintf(stderr, "mlcbench: can't load %s\n", regs);
+			return 1;
+		}
+		fclose(f);
+		m.fb = load_file(mem, &size);
+		if(size < m.fb_size)
+			m.fb_size = size;
+	}
+	else {
+		fb = calloc(1, SCENE_FB_SIZE);
+		if(!fb)
+			return 1;
+		scene_build(&m, fb);
+	}
+
+	mlc_screen_size(&m, &width, &height);
+	frame = malloc((size_t)width*height*of->bpp);
+	if(!frame)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < frames; i++) {
+		if(!regs)
+			scene_position(&m, 1, (i*3) % (SCENE_W-64),
+				       (i*2) % (SCENE_H-64),
+				       (i*3) % (SCENE_W-64) + 64,
+				       (i*2) % (SCENE_H-64) + 64);
+		mlc_compose(&m, of, frame, width*of->bpp);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9;
+	printf("%d frames %dx%d %s in %.3f s: %.1f frames/s, "
+	       "%.1f Mpixel/s, crc 0x%08x\n", frames, width, height,
+	       of->name, s, frames/s, (double)frames*width*height/s/1e6,
+	       crc32(frame, (size_t)width*height*of->bpp));
+	if(m.oob)
+		printf("%lu fetches outside the fb in the last frame\n",
+		       m.oob);
+	return 0;
+}
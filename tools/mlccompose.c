@@ -0,0 +1,146 @@
+/*
+ * tools/mlccompose.c
+ *
+ * Compose a captured MLC state into a frame:
+ *
+ *	cat /sys/kernel/debug/lf1000fb/registers > regs.txt
+ *	dd if=/dev/fb0 of=fb.bin bs=4096	# whole carveout, see below
+ *	mlccompose -r regs.txt -m fb.bin [-b 1] [-f RGB565] -o frame.ppm
+ *
+ * fb.bin must start at the "fb" address of the snapshot; read() on
+ * /dev/fb0 covers the visible framebuffer only, buffers further up the
+ * carveout need /dev/mem or an mmap of the whole smem_len.  Output is
+ * raw pixels in the -f format, or PPM when the name ends in .ppm.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mlcmodel.h"
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: mlccompose -r registers -m fbmem "
+		"[-b bank] [-f format] -o out[.ppm]\n");
+	exit(2);
+}
+
+static uint8_t *load_file(const char *name, uint32_t *size)
+{
+	FILE *f = fopen(name, "rb");
+	uint8_t *buf;
+	long len;
+
+	if(!f || fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0) {
+		perror(name);
+		exit(1);
+	}
+	rewind(f);
+	buf = malloc(len ? len : 1);
+	if(!buf || fread(buf, 1, len, f) != (size_t)len) {
+		perror(name);
+		exit(1);
+	}
+	fclose(f);
+	*size = len;
+	return buf;
+}
+
+static int write_ppm(FILE *f, const uint8_t *frame, int width, int height)
+{
+	int i;
+
+	fprintf(f, "P6\n%d %d\n255\n", width, height);
+	for(i = 0; i < width*height; i++, frame += 3) {
+		/* RGB888 is stored B, G, R */
+		fputc(frame[2], f);
+		fputc(frame[1], f);
+		fputc(frame[0], f);
+	}
+	return ferror(f) ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *regs = NULL, *mem = NULL, *out = NULL, *fmt = "RGB565";
+	const struct mlc_pixfmt *of;
+	struct mlc_model m;
+	int bank = 0, width, height, ppm, opt;
+	uint32_t size;
+	uint8_t *frame;
+	FILE *f;
+
+	while((opt = getopt(argc, argv, "r:m:b:f:o:")) != -1) {
+		switch(opt) {
+		case 'r':
+			regs = optarg;
+			break;
+		case 'm':
+			mem = optarg;
+			break;
+		case 'b':
+			bank = atoi(optarg);
+			break;
+		case 'f':
+			fmt = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if(!regs || !mem || !out)
+		usage();
+
+	ppm = strlen(out) > 4 && !strcmp(out + strlen(out) - 4, ".ppm");
+	of = mlc_pixfmt_byname(ppm ? "RGB888" : fmt);
+	if(!of) {
+		fprintf(stderr, "mlccompose: unknown format %s\n", fmt);
+		return 2;
+	}
+
+	f = fopen(regs, "r");
+	if(!f) {
+		perror(regs);
+		return 1;
+	}
+	memset(&m, 0, sizeof(m));
+	if(mlc_load_snapshot(&m, f, bank) < 0) {
+		fprintf(stderr, "mlccompose: no mlc%d in %s\n", bank, regs);
+		return 1;
+	}
+	fclose(f);
+	m.fb = load_file(mem, &size);
+	if(size < m.fb_size)
+		m.fb_size = size;
+
+	mlc_screen_size(&m, &width, &height);
+	frame = malloc((size_t)width*height*of->bpp);
+	if(!frame)
+		return 1;
+	mlc_compose(&m, of, frame, width*of->bpp);
+	if(m.oob)
+		fprintf(stderr, "mlccompose: %lu fetches outside the fb\n",
+			m.oob);
+
+	f = fopen(out, "wb");
+	if(!f) {
+		perror(out);
+		return 1;
+	}
+	if(ppm ? write_ppm(f, frame, width, height) :
+	    fwrite(frame, of->bpp, (size_t)width*height, f) !=
+	    (size_t)width*height) {
+		perror(out);
+		return 1;
+	}
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * tools/mlcdrv.h
+ *
+ * The driver's MLC register code, ../lf1000fb_mlc.h, built for the host.
+ * Its register accesses go to the bank of a struct mlc_model, so tools
+ * program the model exactly as the driver programs the MLC.  Include
+ * after ../lf1000fb.h and mlcmodel.h.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef MLCDRV_H
+#define MLCDRV_H
+
+#include "kcompat.h"
+#include "../lf1000fb_mlc.h"
+
+/* the registers of a model, as the driver's mlc_base */
+static inline void *mlc_bank(struct mlc_model *m)
+{
+	return m->reg;
+}
+
+#endif /* MLCDRV_H */
@@ -0,0 +1,498 @@
+/*
+ * tools/mlcmodel.c
+ *
+ * Software model of the LF1000 MLC layer mixer.  It takes the register
+ * state of one MLC and the fb memory and produces the frame the MLC
+ * sends to its DPC.  The rules it follows, bottom layer first:
+ *
+ *  - the frame starts as MLCBGCOLOR
+ *  - MLCCONTROLT PRIORITY orders the layers as in enum VID_PRIORITY:
+ *    0 video > layer 0 > layer 1, 1 layer 0 > video > layer 1,
+ *    2 layer 0 > layer 1 > video
+ *  - a layer covers left..right, top..bottom (inclusive, 11 bit signed)
+ *    minus its invisible area, if INVALIDENB is set
+ *  - RGB pixels are widened to 8 bits per channel by bit replication,
+ *    as the driver's format converter does
+ *  - TPENB drops pixels equal to TPCOLOR, INVENB inverts what is below
+ *    pixels equal to INVCOLOR
+ *  - BLENDENB blends with the pixel alpha cut to 4 bits for formats with
+ *    alpha, the layer ALPHA otherwise, see mlc_blend4()
+ *  - the video layer is 8 bit 4:2:0 planar YCbCr, BT.601 video range,
+ *    scaled by MLCHSCALE/MLCVSCALE, bilinear when the filter bit is set
+ *  - the frame is narrowed to the output format by truncation
+ *
+ * Register offsets come from lf1000fb.h and the driver's mlc_layer_regs[].
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+
+#include "../lf1000fb.h"
+#include "mlcmodel.h"
+#include "mlcdrv.h"
+
+/* same layouts as lf1000fb_formats[] in the driver */
+static const struct mlc_pixfmt mlc_formats[] = {
+	/* code  Bpp  a       r       g      b */
+	{ 0x4432, 2,  0,  0,  5, 11,  6, 5,  5, 0,  "RGB565" },
+	{ 0xC432, 2,  0,  0,  5, 0,   6, 5,  5, 11, "BGR565" },
+	{ 0x4342, 2,  0,  0,  5, 10,  5, 5,  5, 0,  "XRGB1555" },
+	{ 0xC342, 2,  0,  0,  5, 0,   5, 5,  5, 10, "XBGR1555" },
+	{ 0x3342, 2,  1, 15,  5, 10,  5, 5,  5, 0,  "ARGB1555" },
+	{ 0xB342, 2,  1, 15,  5, 0,   5, 5,  5, 10, "ABGR1555" },
+	{ 0x4211, 2,  0,  0,  4, 8,   4, 4,  4, 0,  "XRGB4444" },
+	{ 0xC211, 2,  0,  0,  4, 0,   4, 4,  4, 8,  "XBGR4444" },
+	{ 0x2211, 2,  4, 12,  4, 8,   4, 4,  4, 0,  "ARGB4444" },
+	{ 0xA211, 2,  4, 12,  4, 0,   4, 4,  4, 8,  "ABGR4444" },
+	{ 0x4120, 2,  0,  0,  3, 5,   3, 2,  2, 0,  "XRGB8332" },
+	{ 0xC120, 2,  0,  0,  2, 0,   3, 2,  3, 5,  "XBGR8332" },
+	{ 0x1120, 2,  8,  8,  3, 5,   3, 2,  2, 0,  "ARGB8332" },
+	{ 0x9120, 2,  8,  8,  2, 0,   3, 2,  3, 5,  "ABGR8332" },
+	{ 0x4653, 3,  0,  0,  8, 16,  8, 8,  8, 0,  "RGB888" },
+	{ 0xC653, 3,  0,  0,  8, 0,   8, 8,  8, 16, "BGR888" },
+	{ 0x4653, 4,  0,  0,  8, 16,  8, 8,  8, 0,  "XRGB8888" },
+	{ 0xC653, 4,  0,  0,  8, 0,   8, 8,  8, 16, "XBGR8888" },
+	{ 0x0653, 4,  8, 24,  8, 16,  8, 8,  8, 0,  "ARGB8888" },
+	{ 0x8653, 4,  8, 24,  8, 0,   8, 8,  8, 16, "ABGR8888" },
+};
+
+#define NFORMATS	(sizeof(mlc_formats)/sizeof(mlc_formats[0]))
+
+/* bpp 0 picks the first match, i.e. 24bpp for the shared 888 codes */
+const struct mlc_pixfmt *mlc_pixfmt_find(uint32_t code, uint32_t bpp)
+{
+	unsigned int i;
+
+	for(i = 0; i < NFORMATS; i++)
+		if(mlc_formats[i].code == code &&
+		   (bpp == 0 || mlc_formats[i].bpp == bpp))
+			return &mlc_formats[i];
+	return NULL;
+}
+
+const struct mlc_pixfmt *mlc_pixfmt_byname(const char *name)
+{
+	unsigned int i;
+
+	for(i = 0; i < NFORMATS; i++)
+		if(!strcasecmp(mlc_formats[i].name, name))
+			return &mlc_formats[i];
+	return NULL;
+}
+
+/* n bit channel to 8 bits by bit replication */
+static inline uint32_t widen(uint32_t v, int len)
+{
+	switch(len) {
+	case 8:
+		return v;
+	case 6:
+		return (v<<2)|(v>>4);
+	case 5:
+		return (v<<3)|(v>>2);
+	case 4:
+		return v*0x11;
+	case 3:
+		return (v<<5)|(v<<2)|(v>>1);
+	case 2:
+		return v*0x55;
+	case 1:
+		return v ? 0xFF : 0;
+	}
+	return 0xFF;	/* no alpha channel */
+}
+
+static inline uint32_t load(const uint8_t *p, int bpp)
+{
+	switch(bpp) {
+	case 2:
+		return p[0] | (p[1]<<8);
+	case 3:
+		return p[0] | (p[1]<<8) | (p[2]<<16);
+	}
+	return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+uint32_t mlc_pixfmt_unpack(const struct mlc_pixfmt *pf, const uint8_t *p)
+{
+	uint32_t v = load(p, pf->bpp);
+
+	return (widen((v>>pf->a_off) & ((1<<pf->a_len)-1), pf->a_len)<<24) |
+	       (widen((v>>pf->r_off) & ((1<<pf->r_len)-1), pf->r_len)<<16) |
+	       (widen((v>>pf->g_off) & ((1<<pf->g_len)-1), pf->g_len)<<8) |
+	       widen((v>>pf->b_off) & ((1<<pf->b_len)-1), pf->b_len);
+}
+
+void mlc_pixfmt_pack(const struct mlc_pixfmt *pf, uint32_t argb, uint8_t *p)
+{
+	uint32_t v;
+	int i;
+
+	v = ((argb>>16 & 0xFF) >> (8-pf->r_len)) << pf->r_off;
+	v |= ((argb>>8 & 0xFF) >> (8-pf->g_len)) << pf->g_off;
+	v |= ((argb & 0xFF) >> (8-pf->b_len)) << pf->b_off;
+	if(pf->a_len)
+		v |= ((argb>>24) >> (8-pf->a_len)) << pf->a_off;
+	for(i = 0; i < pf->bpp; i++)
+		p[i] = v >> (8*i);
+}
+
+void mlc_screen_size(const struct mlc_model *m, int *width, int *height)
+{
+	uint32_t v = mlc_rd(m, MLCSCREENSIZE);
+
+	*width = ((v>>SCREENWIDTH) & 0xFFF) + 1;
+	*height = ((v>>SCREENHEIGHT) & 0xFFF) + 1;
+}
+
+int mlc_load_snapshot(struct mlc_model *m, FILE *f, int bank)
+{
+	char line[128], name[16];
+	unsigned int off, val, size;
+	int found = 0;
+
+	memset(m->reg, 0, sizeof(m->reg));
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, "fb %x %x", &val, &size) == 2) {
+			m->fb_addr = val;
+			m->fb_size = size;
+			continue;
+		}
+		if(sscanf(line, "%15s %x %x", name, &off, &val) != 3)
+			continue;
+		if(strncmp(name, "mlc", 3) || atoi(name+3) != bank ||
+		   off >= MLC_BANK_SIZE)
+			continue;
+		mlc_wr(m, off, val);
+		found = 1;
+	}
+	return found ? 0 : -1;
+}
+
+/* 11 bit two's complement, as mlc_SetPosition() stores it */
+static inline int pos11(uint32_t v)
+{
+	v &= 0x7FF;
+	return v & 0x400 ? (int)v - 0x800 : (int)v;
+}
+
+struct layer {
+	int		id;
+	int		left, top, right, bottom;	/* inclusive */
+	int		inv_on;
+	int		inv_left, inv_top, inv_right, inv_bottom;
+	uint32_t	ctl;
+	const struct mlc_pixfmt *pf;
+	int32_t		hstride, vstride;
+	int64_t		base;		/* offset of (left, top) in fb */
+	unsigned int	alpha;
+	uint32_t	tpcolor, invcolor;
+	/* video layer */
+	int64_t		cb, cr;
+	int32_t		cbstride, crstride;
+	uint32_t	hscale, vscale;
+};
+
+static int layer_setup(const struct mlc_model *m, int id, struct layer *l)
+{
+	uint32_t v;
+
+	l->id = id;
+	l->ctl = mlc_rd(m, mlc_layer_regs[id][MLC_REG_CONTROL]);
+	if(!IS_SET(l->ctl, LAYERENB))
+		return 0;
+
+	v = mlc_rd(m, mlc_layer_regs[id][MLC_REG_LEFTRIGHT]);
+	l->left = pos11(v>>LEFT);
+	l->right = pos11(v>>RIGHT);
+	v = mlc_rd(m, mlc_layer_regs[id][MLC_REG_TOPBOTTOM]);
+	l->top = pos11(v>>TOP);
+	l->bottom = pos11(v>>BOTTOM);
+	if(l->right < l->left || l->bottom < l->top)
+		return 0;
+
+	v = mlc_rd(m, mlc_layer_regs[id][MLC_REG_TPCOLOR]);
+	l->alpha = (v>>ALPHA) & 0xF;
+	l->tpcolor = (v>>TPCOLOR) & 0xFFFFFF;
+	l->vstride = mlc_rd(m, mlc_layer_regs[id][MLC_REG_VSTRIDE]);
+	l->base = (int64_t)mlc_rd(m, mlc_layer_regs[id][MLC_REG_ADDRESS]) -
+		  m->fb_addr;
+	l->inv_on = 0;
+
+	if(id == MLC_VIDEO_LAYER) {
+		l->pf = NULL;
+		l->cb = (int64_t)mlc_rd(m, MLCADDRESSCB) - m->fb_addr;
+		l->cr = (int64_t)mlc_rd(m, MLCADDRESSCR) - m->fb_addr;
+		l->cbstride = mlc_rd(m, MLCSTRIDECB);
+		l->crstride = mlc_rd(m, MLCSTRIDECR);
+		l->hscale = mlc_rd(m, MLCHSCALE);
+		l->vscale = mlc_rd(m, MLCVSCALE);
+		return 1;
+	}
+
+	l->hstride = mlc_rd(m, mlc_layer_regs[id][MLC_REG_HSTRIDE]);
+	l->pf = mlc_pixfmt_find((l->ctl>>FORMAT) & 0xFFFF,
+				abs(l->hstride));
+	if(!l->pf)
+		return 0;
+	l->invcolor = mlc_rd(m, mlc_layer_regs[id][MLC_REG_INVCOLOR]) & 0xFFFFFF;
+	v = mlc_rd(m, mlc_layer_regs[id][MLC_REG_INVLEFTRIGHT]);
+	l->inv_on = IS_SET(v, INVALIDENB) ? 1 : 0;
+	l->inv_left = (v>>INVALIDLEFT) & 0x7FF;
+	l->inv_right = (v>>INVALIDRIGHT) & 0x7FF;
+	v = mlc_rd(m, mlc_layer_regs[id][MLC_REG_INVTOPBOTTOM]);
+	l->inv_top = (v>>INVALIDTOP) & 0x7FF;
+	l->inv_bottom = (v>>INVALIDBOTTOM) & 0x7FF;
+	return 1;
+}
+
+static inline uint8_t clip8(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline uint32_t ycbcr(int y, int cb, int cr)
+{
+	int c = 298*(y-16) + 128;
+
+	cb -= 128;
+	cr -= 128;
+	return 0xFF000000 | (clip8((c + 409*cr)>>8)<<16) |
+	       (clip8((c - 100*cb - 208*cr)>>8)<<8) | clip8((c + 516*cb)>>8);
+}
+
+static inline int fetch8(struct mlc_model *m, int64_t off)
+{
+	if(off < 0 || off >= m->fb_size) {
+		m->oob++;
+		return 0;
+	}
+	return m->fb[off];
+}
+
+/* one plane sample at 11 bit fixed point (sx, sy), bilinear or nearest */
+static int sample(struct mlc_model *m, int64_t base, int32_t stride,
+		  uint32_t sx, uint32_t sy, int hf, int vf)
+{
+	int64_t o = base + (int64_t)(sy>>11)*stride + (sx>>11);
+	int fx = hf ? sx & 0x7FF : 0;
+	int fy = vf ? sy & 0x7FF : 0;
+	int a, b;
+
+	a = fetch8(m, o);
+	if(fx)
+		a = (a*(2048-fx) + fetch8(m, o+1)*fx + 1024) >> 11;
+	if(!fy)
+		return a;
+	b = fetch8(m, o+stride);
+	if(fx)
+		b = (b*(2048-fx) + fetch8(m, o+stride+1)*fx + 1024) >> 11;
+	return (a*(2048-fy) + b*fy + 1024) >> 11;
+}
+
+/* sample of rows r0 (and r1 when fy) at 11 bit fixed point column sx */
+static inline int lerp(const uint8_t *r0, const uint8_t *r1, uint32_t sx,
+		       int hf, int fy)
+{
+	int i = sx>>11, fx = hf ? sx & 0x7FF : 0;
+	int a = r0[i], b;
+
+	if(fx)
+		a = (a*(2048-fx) + r0[i+1]*fx + 1024) >> 11;
+	if(!fy)
+		return a;
+	b = r1[i];
+	if(fx)
+		b = (b*(2048-fx) + r1[i+1]*fx + 1024) >> 11;
+	return (a*(2048-fy) + b*fy + 1024) >> 11;
+}
+
+/* the rows a plane sample needs at sy, up to column cols, if in the fb */
+static const uint8_t *plane_rows(const struct mlc_model *m, int64_t base,
+				 int32_t stride, uint32_t sy, int fy,
+				 uint32_t cols, const uint8_t **r1)
+{
+	int64_t o0 = base + (int64_t)(sy>>11)*stride;
+	int64_t o1 = fy ? o0 + stride : o0;
+
+	if(o0 < 0 || o1 < 0 || o0 + cols >= m->fb_size ||
+	   o1 + cols >= m->fb_size)
+		return NULL;
+	*r1 = m->fb + o1;
+	return m->fb + o0;
+}
+
+static void video_row(struct mlc_model *m, const struct layer *l, int y,
+		      int x0, int x1, uint32_t *px)
+{
+	uint32_t hr = l->hscale & 0x7FFFFFF, vr = l->vscale & 0x7FFFFFF;
+	int hf = IS_SET(l->hscale, HFILTERENB) ? 1 : 0;
+	int vf = IS_SET(l->vscale, VFILTERENB) ? 1 : 0;
+	uint32_t sy = (uint32_t)(y - l->top)*vr, sx;
+	uint32_t cols = (((uint32_t)(x1 - l->left)*hr)>>11) + 1;
+	const uint8_t *y0, *b0, *r0, *y1 = NULL, *b1 = NULL, *r1 = NULL;
+	int fy = vf ? sy & 0x7FF : 0, fc = vf ? (sy>>1) & 0x7FF : 0;
+	int x, Y, cb, cr;
+
+	y0 = plane_rows(m, l->base, l->vstride, sy, fy, cols, &y1);
+	b0 = plane_rows(m, l->cb, l->cbstride, sy>>1, fc, cols/2+1, &b1);
+	r0 = plane_rows(m, l->cr, l->crstride, sy>>1, fc, cols/2+1, &r1);
+	if(y0 && b0 && r0) {
+		for(x = x0; x <= x1; x++) {
+			sx = (uint32_t)(x - l->left)*hr;
+			px[x] = ycbcr(lerp(y0, y1, sx, hf, fy),
+				      lerp(b0, b1, sx>>1, hf, fc),
+				      lerp(r0, r1, sx>>1, hf, fc));
+		}
+		return;
+	}
+
+	for(x = x0; x <= x1; x++) {
+		sx = (uint32_t)(x - l->left)*hr;
+		Y = sample(m, l->base, l->vstride, sx, sy, hf, vf);
+		cb = sample(m, l->cb, l->cbstride, sx>>1, sy>>1, hf, vf);
+		cr = sample(m, l->cr, l->crstride, sx>>1, sy>>1, hf, vf);
+		px[x] = ycbcr(Y, cb, cr);
+	}
+}
+
+static void rgb_row(struct mlc_model *m, const struct layer *l, int y,
+		    int x0, int x1, uint32_t *px)
+{
+	const struct mlc_pixfmt *pf = l->pf;
+	int64_t o = l->base + (int64_t)(y - l->top)*l->vstride +
+		    (int64_t)(x0 - l->left)*l->hstride;
+	int64_t last = o + (int64_t)(x1 - x0)*l->hstride;
+	int x;
+
+	if(o >= 0 && last >= 0 && o + pf->bpp <= m->fb_size &&
+	   last + pf->bpp <= m->fb_size) {
+		const uint8_t *p = m->fb + o;
+		uint32_t v;
+
+		if(pf->code == 0x4432) {
+			for(x = x0; x <= x1; x++, p += l->hstride) {
+				v = p[0] | (p[1]<<8);
+				px[x] = 0xFF000000 |
+					((v & 0xF800)<<8) | ((v & 0xE000)<<3) |
+					((v & 0x07E0)<<5) | ((v & 0x0600)>>1) |
+					((v & 0x001F)<<3) | ((v & 0x001C)>>2);
+			}
+			return;
+		}
+		if(pf->code == 0x0653 && pf->bpp == 4) {
+			for(x = x0; x <= x1; x++, p += l->hstride)
+				px[x] = p[0] | (p[1]<<8) | (p[2]<<16) |
+					((uint32_t)p[3]<<24);
+			return;
+		}
+		for(x = x0; x <= x1; x++, p += l->hstride)
+			px[x] = mlc_pixfmt_unpack(pf, p);
+		return;
+	}
+	for(x = x0; x <= x1; x++, o += l->hstride) {
+		if(o < 0 || o + pf->bpp > m->fb_size) {
+			m->oob++;
+			px[x] = 0xFF000000;
+			continue;
+		}
+		px[x] = mlc_pixfmt_unpack(pf, m->fb + o);
+	}
+}
+
+static void layer_row(struct mlc_model *m, const struct layer *l, int y,
+		      int width, uint32_t *line, uint32_t *px)
+{
+	int x0 = l->left < 0 ? 0 : l->left;
+	int x1 = l->right >= width ? width-1 : l->right;
+	int blend = IS_SET(l->ctl, BLENDENB) ? 1 : 0;
+	int tp = IS_SET(l->ctl, TPENB) && l->pf;
+	int inv = IS_SET(l->ctl, INVENB) && l->pf;
+	int pixel_alpha = l->pf && l->pf->a_len;
+	uint32_t s, a;
+	int x;
+
+	if(y < l->top || y > l->bottom || x0 > x1)
+		return;
+	if(l->pf)
+		rgb_row(m, l, y, x0, x1, px);
+	else
+		video_row(m, l, y, x0, x1, px);
+
+	for(x = x0; x <= x1; x++) {
+		if(l->inv_on && x >= l->inv_left && x <= l->inv_right &&
+		   y >= l->inv_top && y <= l->inv_bottom)
+			continue;
+		s = px[x];
+		if(tp && (s & 0xFFFFFF) == l->tpcolor)
+			continue;
+		if(inv && (s & 0xFFFFFF) == l->invcolor) {
+			line[x] ^= 0xFFFFFF;
+			continue;
+		}
+		if(!blend) {
+			line[x] = s & 0xFFFFFF;
+			continue;
+		}
+		a = pixel_alpha ? s>>28 : l->alpha;
+		line[x] = mlc_blend4(s, line[x], a);
+	}
+}
+
+/* bottom to top for each PRIORITY value */
+static const int layer_order[4][MLC_NUM_LAYERS] = {
+	{ 1, 0, MLC_VIDEO_LAYER },
+	{ 1, MLC_VIDEO_LAYER, 0 },
+	{ MLC_VIDEO_LAYER, 1, 0 },
+	{ MLC_VIDEO_LAYER, 1, 0 },
+};
+
+void mlc_compose(struct mlc_model *m, const struct mlc_pixfmt *of,
+		 uint8_t *out, int stride)
+{
+	struct layer layers[MLC_NUM_LAYERS];
+	uint32_t top = mlc_rd(m, MLCCONTROLT);
+	uint32_t bg = mlc_rd(m, MLCBGCOLOR) & 0xFFFFFF;
+	const int *order = layer_order[(top>>PRIORITY) & 3];
+	uint32_t *line, *px;
+	int width, height, nl = 0, i, x, y;
+	uint8_t *d;
+
+	mlc_screen_size(m, &width, &height);
+	m->oob = 0;
+	for(i = 0; i < MLC_NUM_LAYERS && IS_SET(top, MLCENB); i++)
+		if(layer_setup(m, order[i], &layers[nl]))
+			nl++;
+
+	line = malloc(2*width*sizeof(*line));
+	if(!line)
+		abort();
+	px = line + width;
+	for(y = 0; y < height; y++) {
+		for(x = 0; x < width; x++)
+			line[x] = bg;
+		for(i = 0; i < nl; i++)
+			layer_row(m, &layers[i], y, width, line, px);
+		d = out + (size_t)y*stride;
+		if(of->bpp == 2 && of->code == 0x4432) {
+			for(x = 0; x < width; x++, d += 2) {
+				uint32_t c = line[x];
+				uint16_t v = ((c>>8) & 0xF800) |
+					     ((c>>5) & 0x07E0) |
+					     ((c>>3) & 0x001F);
+				d[0] = v;
+				d[1] = v>>8;
+			}
+			continue;
+		}
+		for(x = 0; x < width; x++, d += of->bpp)
+			mlc_pixfmt_pack(of, 0xFF000000 | line[x], d);
+	}
+	free(line);
+}
@@ -0,0 +1,83 @@
+/*
+ * tools/mlcmodel.h
+ *
+ * Software model of the LF1000 MLC layer mixer.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#ifndef MLCMODEL_H
+#define MLCMODEL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MLC_BANK_SIZE		0x400	/* registers of one MLC */
+#define MLC_MAX_WIDTH		2048	/* 11 bit layer positions */
+
+/* register state of one MLC plus the fb memory its layers point into */
+struct mlc_model {
+	uint32_t	reg[MLC_BANK_SIZE/4];
+	uint32_t	fb_addr;	/* physical address of fb[0] */
+	uint32_t	fb_size;
+	const uint8_t	*fb;
+	unsigned long	oob;		/* fetches outside fb, last frame */
+};
+
+/* MLC RGB pixel format, (length, offset) per channel */
+struct mlc_pixfmt {
+	uint16_t code;
+	uint8_t bpp;		/* bytes per pixel */
+	uint8_t a_len, a_off;
+	uint8_t r_len, r_off;
+	uint8_t g_len, g_off;
+	uint8_t b_len, b_off;
+	const char *name;
+};
+
+const struct mlc_pixfmt *mlc_pixfmt_find(uint32_t code, uint32_t bpp);
+const struct mlc_pixfmt *mlc_pixfmt_byname(const char *name);
+uint32_t mlc_pixfmt_unpack(const struct mlc_pixfmt *pf, const uint8_t *p);
+void mlc_pixfmt_pack(const struct mlc_pixfmt *pf, uint32_t argb, uint8_t *p);
+
+static inline uint32_t mlc_rd(const struct mlc_model *m, unsigned int off)
+{
+	return m->reg[(off & (MLC_BANK_SIZE-1))/4];
+}
+
+static inline void mlc_wr(struct mlc_model *m, unsigned int off, uint32_t v)
+{
+	m->reg[(off & (MLC_BANK_SIZE-1))/4] = v;
+}
+
+void mlc_screen_size(const struct mlc_model *m, int *width, int *height);
+
+/*
+ * Read a debugfs lf1000fb/registers snapshot.  bank 0 is the LCD MLC,
+ * 1 the TV MLC.  Returns 0, or -1 if the bank isn't in the file.
+ */
+int mlc_load_snapshot(struct mlc_model *m, FILE *f, int bank);
+
+/*
+ * Compose one frame into out, stride bytes per line, in the given
+ * format.  out must hold the MLCSCREENSIZE frame.
+ */
+void mlc_compose(struct mlc_model *m, const struct mlc_pixfmt *of,
+		 uint8_t *out, int stride);
+
+/* the blend the model uses, a is the MLC's 4 bit alpha */
+static inline uint32_t mlc_blend4(uint32_t fg, uint32_t bg, unsigned int a)
+{
+	uint32_t r = 0;
+	int s;
+
+	for(s = 0; s < 24; s += 8)
+		/* n*4370>>16 is n/15 for every n this can make */
+		r |= (((((fg>>s) & 0xFF)*a + ((bg>>s) & 0xFF)*(15-a) + 7)*
+		       4370) >> 16) << s;
+	return r;
+}
+
+#endif /* MLCMODEL_H */
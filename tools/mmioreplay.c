@@ -0,0 +1,334 @@
+/*
+ * tools/mmioreplay.c
+ *
+ * Replay an MLC/DPC register trace from a kernel built with
+ * LF1000FB_MMIO_TRACE into a model register file:
+ *
+ *	echo > /sys/kernel/debug/lf1000fb/mmio_trace
+ *	cat /sys/kernel/debug/lf1000fb/registers > regs.txt
+ *	(run the mode set or ioctls of interest)
+ *	cat /sys/kernel/debug/lf1000fb/mmio_trace > new.trace
+ *	mmioreplay [-s regs.txt] [-o final.txt] [-v] [old.trace] new.trace
+ *
+ * It reports accesses per controller, redundant writes (the register
+ * already held the value, as known from the snapshot, an earlier write
+ * or a read) and the time the trace spans.  Dirty and interrupt pending
+ * bits are taken as cleared after every write and in the snapshot, so
+ * setting them again is not redundant.  Given a second trace, the
+ * traffic of the two is compared register by register, e.g. the same
+ * step before and after a driver change.  -o writes the final registers
+ * of the last trace in snapshot format for mlccompose.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "../lf1000fb.h"
+#include "mlcmodel.h"
+#include "mlcdrv.h"
+
+#define NCTRL		4	/* mlc0, mlc1, dpc0, dpc1 */
+#define BANK		0x400
+#define NOPS		4	/* r16, r32, w16, w32 */
+
+static const char *ctrl_name[NCTRL] = { "mlc0", "mlc1", "dpc0", "dpc1" };
+static const char *op_name[NOPS] = { "r16", "r32", "w16", "w32" };
+
+struct regfile {
+	uint8_t		val[NCTRL][BANK];
+	uint8_t		known[NCTRL][BANK];
+	int		have_fb;
+	uint32_t	fb_addr, fb_size;
+};
+
+struct replay {
+	struct regfile	rf;
+	unsigned long	ops[NCTRL][NOPS];
+	unsigned long	redundant[NCTRL];
+	/* per register, indexed by offset/2 */
+	unsigned long	writes[NCTRL][BANK/2];
+	unsigned long	wasted[NCTRL][BANK/2];
+	unsigned long	total;
+	long long	first_ns, last_ns, gap_ns;
+	unsigned long	gap_line;
+	char		gap_what[48];
+};
+
+static int verbose;
+
+static uint32_t rf_get(const struct regfile *rf, int c, unsigned int off,
+		       int size, int *known)
+{
+	uint32_t v = 0;
+	int i;
+
+	*known = 1;
+	for(i = size-1; i >= 0; i--) {
+		v = v<<8 | rf->val[c][off+i];
+		*known &= rf->known[c][off+i];
+	}
+	return v;
+}
+
+static void rf_set(struct regfile *rf, int c, unsigned int off, int size,
+		   uint32_t v)
+{
+	int i;
+
+	for(i = 0; i < size; i++, v >>= 8) {
+		rf->val[c][off+i] = v;
+		rf->known[c][off+i] = 1;
+	}
+}
+
+/* bits the hardware clears by itself after they are written */
+static uint32_t self_clearing(int c, unsigned int off)
+{
+	int layer;
+
+	if(c >= 2)
+		return off == DPCCTRL0 ? 1<<_INTPEND : 0;
+	if(off == MLCCONTROLT)
+		return 1<<DITTYFLAG;
+	for(layer = 0; layer < MLC_NUM_LAYERS; layer++)
+		if(off == mlc_layer_regs[layer][MLC_REG_CONTROL])
+			return 1<<DIRTYFLAG;
+	return 0;
+}
+
+static int ctrl_index(const char *name)
+{
+	int c;
+
+	for(c = 0; c < NCTRL; c++)
+		if(!strcmp(name, ctrl_name[c]))
+			return c;
+	return -1;
+}
+
+static int load_snapshot(struct regfile *rf, const char *name)
+{
+	FILE *f = fopen(name, "r");
+	char line[128], ctrl[16];
+	unsigned int off, val, size;
+	int c;
+
+	if(!f) {
+		perror(name);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, "fb %x %x", &val, &size) == 2) {
+			rf->have_fb = 1;
+			rf->fb_addr = val;
+			rf->fb_size = size;
+			continue;
+		}
+		if(sscanf(line, "%15s %x %x", ctrl, &off, &val) != 3 ||
+		   (c = ctrl_index(ctrl)) < 0 || off > BANK-4)
+			continue;
+		/* the snapshot reads DPC sync registers 16 bits wide */
+		rf_set(rf, c, off, c >= 2 && off < DPCCLKENB ? 2 : 4,
+		       val & ~self_clearing(c, off));
+	}
+	fclose(f);
+	return 0;
+}
+
+static int replay(struct replay *r, const char *name)
+{
+	FILE *f = fopen(name, "r");
+	char line[128], ctrl[16], op[8];
+	unsigned int off, val, size;
+	unsigned long lineno = 0;
+	long long ns;
+	uint32_t old, sc;
+	int c, o, known;
+
+	if(!f) {
+		perror(name);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		lineno++;
+		if(sscanf(line, "%lld %15s %7s %x %x", &ns, ctrl, op, &off,
+			  &val) != 5)
+			continue;
+		c = ctrl_index(ctrl);
+		for(o = 0; o < NOPS && strcmp(op, op_name[o]); o++)
+			;
+		size = o & 1 ? 4 : 2;
+		if(c < 0 || o == NOPS || off > BANK-size || off & (size-1)) {
+			fprintf(stderr, "%s:%lu: bad access\n", name, lineno);
+			continue;
+		}
+
+		if(r->total == 0)
+			r->first_ns = ns;
+		else if(ns - r->last_ns > r->gap_ns) {
+			r->gap_ns = ns - r->last_ns;
+			r->gap_line = lineno;
+			snprintf(r->gap_what, sizeof(r->gap_what),
+				 "%s %s 0x%03x", ctrl, op, off);
+		}
+		r->last_ns = ns;
+		r->total++;
+		r->ops[c][o]++;
+
+		if(o < 2) {
+			/* a read tells what the register holds */
+			rf_set(&r->rf, c, off, size, val);
+			continue;
+		}
+		old = rf_get(&r->rf, c, off, size, &known);
+		r->writes[c][off/2]++;
+		if(known && old == val) {
+			r->redundant[c]++;
+			r->wasted[c][off/2]++;
+			if(verbose)
+				printf("%s:%lu: %s 0x%03x 0x%08x redundant\n",
+				       name, lineno, ctrl, off, val);
+		}
+		sc = self_clearing(c, off);
+		rf_set(&r->rf, c, off, size, val & ~sc);
+	}
+	fclose(f);
+	return 0;
+}
+
+static void report(const struct replay *r, const char *name)
+{
+	long long span = r->last_ns - r->first_ns;
+	unsigned int off;
+	int c, o;
+
+	printf("%s: %lu accesses over %lld.%03lld ms\n", name, r->total,
+	       span/1000000, span/1000 % 1000);
+	printf("       r16    r32    w16    w32  redundant\n");
+	for(c = 0; c < NCTRL; c++) {
+		printf("%s", ctrl_name[c]);
+		for(o = 0; o < NOPS; o++)
+			printf(" %6lu", r->ops[c][o]);
+		printf(" %10lu\n", r->redundant[c]);
+	}
+	for(c = 0; c < NCTRL; c++)
+		for(off = 0; off < BANK; off += 2)
+			if(r->wasted[c][off/2])
+				printf("  %s 0x%03x  %lu of %lu writes "
+				       "redundant\n", ctrl_name[c], off,
+				       r->wasted[c][off/2],
+				       r->writes[c][off/2]);
+	if(r->total > 1)
+		printf("mean gap %lld ns, longest %lld ns before line %lu "
+		       "(%s)\n", span/(long long)(r->total-1), r->gap_ns,
+		       r->gap_line, r->gap_what);
+}
+
+/* write traffic and final values that differ between the two traces */
+static void compare(const struct replay *a, const struct replay *b)
+{
+	unsigned int off;
+	uint32_t va, vb;
+	int c, ka, kb, size, n = 0;
+
+	printf("\nregister traffic, first trace -> second\n");
+	for(c = 0; c < NCTRL; c++)
+		for(off = 0; off < BANK; off += 2)
+			if(a->writes[c][off/2] != b->writes[c][off/2]) {
+				printf("  %s 0x%03x  writes %lu -> %lu\n",
+				       ctrl_name[c], off, a->writes[c][off/2],
+				       b->writes[c][off/2]);
+				n++;
+			}
+	for(c = 0; c < NCTRL; c++) {
+		size = c < 2 ? 4 : 2;
+		for(off = 0; off < BANK; off += size) {
+			va = rf_get(&a->rf, c, off, size, &ka);
+			vb = rf_get(&b->rf, c, off, size, &kb);
+			if(ka != kb || va != vb) {
+				printf("  %s 0x%03x  final 0x%08x%s -> "
+				       "0x%08x%s\n", ctrl_name[c], off,
+				       va, ka ? "" : "?", vb, kb ? "" : "?");
+				n++;
+			}
+		}
+	}
+	if(!n)
+		printf("  identical\n");
+}
+
+static int dump(const struct regfile *rf, const char *name)
+{
+	FILE *f = fopen(name, "w");
+	unsigned int off;
+	uint32_t v;
+	int c, known, size;
+
+	if(!f) {
+		perror(name);
+		return -1;
+	}
+	if(rf->have_fb)
+		fprintf(f, "fb 0x%08x 0x%08x\n", rf->fb_addr, rf->fb_size);
+	for(c = 0; c < NCTRL; c++)
+		for(off = 0; off < BANK; off += size) {
+			size = c < 2 || off >= DPCCLKENB ? 4 : 2;
+			v = rf_get(rf, c, off, size, &known);
+			if(known)
+				fprintf(f, "%s 0x%03x 0x%0*x\n", ctrl_name[c],
+					off, size*2, v);
+		}
+	return fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	static struct replay r[2];
+	const char *snap = NULL, *out = NULL;
+	int opt, i, n;
+
+	while((opt = getopt(argc, argv, "s:o:v")) != -1) {
+		switch(opt) {
+		case 's':
+			snap = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	n = argc - optind;
+	if(n < 1 || n > 2)
+		goto usage;
+
+	for(i = 0; i < n; i++) {
+		if(snap && load_snapshot(&r[i].rf, snap) < 0)
+			return 1;
+		if(replay(&r[i], argv[optind+i]) < 0)
+			return 1;
+		if(i)
+			printf("\n");
+		report(&r[i], argv[optind+i]);
+	}
+	if(n == 2)
+		compare(&r[0], &r[1]);
+	if(out && dump(&r[n-1].rf, out))
+		return 1;
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: mmioreplay [-s registers] [-o final] [-v] "
+		"trace [trace2]\n");
+	return 2;
+}
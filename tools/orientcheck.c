@@ -0,0 +1,191 @@
+/*
+ * tools/orientcheck.c
+ *
+ * Check what MLC_IOCSORIENT shows.  A picture of distinct pixels, with
+ * padded lines, is put on each RGB layer in RGB565, RGB888 and XRGB8888
+ * and oriented every way by the driver's own orient_check() and
+ * mlc_layer_orient(), then composed by the MLC model.  Each frame must
+ * show the background outside the layer and inside it the picture
+ * mirrored and/or flipped on the CPU, pixel for pixel, with nothing
+ * fetched from outside the picture.  Commands the driver must refuse are
+ * checked to be refused.  Exits 1 if any frame is off.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "../lf1000fb.h"
+#include "mlcmodel.h"
+#include "mlcdrv.h"
+
+#define FB_ADDR		0x02800000
+#define FB_SIZE		0x00010000
+#define PIC_OFF		0x1000	/* guard before the picture */
+#define W		320
+#define H		240
+#define PIC_W		61
+#define PIC_H		37
+#define PIC_X		100
+#define PIC_Y		50
+#define PAD		12	/* bytes past each line */
+#define BG		0x123456
+
+static const char *formats[] = { "RGB565", "RGB888", "XRGB8888" };
+
+static const char *orient_name[] = {
+	"upright", "mirrored", "flipped", "mirrored and flipped"
+};
+
+/* must be refused, against a good command */
+static const struct {
+	const char *what;
+	unsigned int layer, flags, hstride, vstride, width, height;
+} bad_cmds[] = {
+	{ "video layer", MLC_VIDEO_LAYER, 0, 2, 128, 61, 37 },
+	{ "no layer", MLC_NUM_LAYERS, 0, 2, 128, 61, 37 },
+	{ "unknown flag", 0, 1<<2, 2, 128, 61, 37 },
+	{ "no width", 0, 0, 2, 128, 0, 37 },
+	{ "too wide", 0, 0, 2, 8192, 2049, 37 },
+	{ "too high", 0, 0, 2, 128, 61, 2049 },
+	{ "5 byte pixels", 0, 0, 5, 320, 61, 37 },
+	{ "short lines", 0, ORIENT_FLIP_Y, 2, 121, 61, 37 },
+	{ "offset past INT_MAX", 0, ORIENT_FLIP_Y, 4, 0x7FFFFFFF/2, 61, 37 },
+};
+
+/* a different colour at every pixel, in any of the formats */
+static uint32_t pixel(int x, int y)
+{
+	return 0xFF000000 | (x*4)<<16 | (y*6)<<8 | ((x*7 + y*3) & 0xF8);
+}
+
+static void picture(const struct mlc_pixfmt *pf, uint8_t *fb, int vstride)
+{
+	int x, y;
+
+	memset(fb, 0xA5, FB_SIZE);
+	for(y = 0; y < PIC_H; y++)
+		for(x = 0; x < PIC_W; x++)
+			mlc_pixfmt_pack(pf, pixel(x, y),
+					fb + PIC_OFF + y*vstride + x*pf->bpp);
+}
+
+static void setup(struct mlc_model *m, const uint8_t *fb, int layer,
+		  const struct mlc_pixfmt *pf)
+{
+	void *mlc = mlc_bank(m);
+
+	memset(m, 0, sizeof(*m));
+	m->fb = fb;
+	m->fb_addr = FB_ADDR;
+	m->fb_size = FB_SIZE;
+	mlc_wr(m, MLCCONTROLT, (1<<MLCENB) | (2<<PRIORITY));
+	mlc_wr(m, MLCSCREENSIZE, ((H-1)<<SCREENHEIGHT)|((W-1)<<SCREENWIDTH));
+	mlc_wr(m, MLCBGCOLOR, BG);
+	mlc_layer_write(mlc, layer, MLC_REG_CONTROL,
+			(1<<LAYERENB) | (pf->code<<FORMAT));
+	mlc_layer_write(mlc, layer, MLC_REG_LEFTRIGHT,
+			(PIC_X<<LEFT) | ((PIC_X+PIC_W-1)<<RIGHT));
+	mlc_layer_write(mlc, layer, MLC_REG_TOPBOTTOM,
+			(PIC_Y<<TOP) | ((PIC_Y+PIC_H-1)<<BOTTOM));
+}
+
+/* one composed frame against the picture oriented on the CPU */
+static int check(struct mlc_model *m, const uint32_t *frame,
+		 const struct mlc_pixfmt *pf, const struct orient_cmd *oc)
+{
+	uint8_t ref[4];
+	uint32_t c, want;
+	int x, y, sx, sy;
+
+	for(y = 0; y < H; y++)
+		for(x = 0; x < W; x++) {
+			c = frame[y*W + x] & 0xFFFFFF;
+			if(x < PIC_X || x >= PIC_X + PIC_W ||
+			   y < PIC_Y || y >= PIC_Y + PIC_H) {
+				want = BG;
+			}
+			else {
+				sx = x - PIC_X;
+				sy = y - PIC_Y;
+				if(oc->flags & ORIENT_MIRROR_X)
+					sx = PIC_W-1 - sx;
+				if(oc->flags & ORIENT_FLIP_Y)
+					sy = PIC_H-1 - sy;
+				mlc_pixfmt_pack(pf, pixel(sx, sy), ref);
+				want = mlc_pixfmt_unpack(pf, ref) & 0xFFFFFF;
+			}
+			if(c != want)
+				goto bad;
+		}
+	if(m->oob == 0)
+		return 0;
+	printf("layer %u %s %s: %lu fetches outside the fb\n", oc->layer,
+	       pf->name, orient_name[oc->flags], m->oob);
+	return 1;
+
+bad:
+	printf("layer %u %s %s: at %d,%d 0x%06x, want 0x%06x\n", oc->layer,
+	       pf->name, orient_name[oc->flags], x, y, c, want);
+	return 1;
+}
+
+int main(void)
+{
+	const struct mlc_pixfmt *of = mlc_pixfmt_byname("XRGB8888");
+	const struct mlc_pixfmt *pf;
+	static uint8_t fb[FB_SIZE];
+	static uint32_t frame[W*H];
+	struct mlc_model m;
+	struct orient_cmd oc;
+	int i, f, layer, frames = 0, bad = 0;
+
+	for(i = 0; i < ARRAY_SIZE(formats); i++)
+	for(layer = 0; layer < MLC_VIDEO_LAYER; layer++)
+	for(f = 0; f <= (ORIENT_MIRROR_X|ORIENT_FLIP_Y); f++) {
+		pf = mlc_pixfmt_byname(formats[i]);
+		memset(&oc, 0, sizeof(oc));
+		oc.layer = layer;
+		oc.flags = f;
+		oc.address = FB_ADDR + PIC_OFF;
+		oc.hstride = pf->bpp;
+		oc.vstride = PIC_W*pf->bpp + PAD;
+		oc.width = PIC_W;
+		oc.height = PIC_H;
+		picture(pf, fb, oc.vstride);
+		setup(&m, fb, layer, pf);
+		if(orient_check(&oc) < 0) {
+			printf("layer %d %s %s: refused\n", layer, pf->name,
+			       orient_name[f]);
+			bad++;
+			continue;
+		}
+		mlc_layer_orient(mlc_bank(&m), &oc);
+		mlc_compose(&m, of, (uint8_t *)frame, W*4);
+		bad += check(&m, frame, pf, &oc);
+		frames++;
+	}
+
+	for(i = 0; i < ARRAY_SIZE(bad_cmds); i++) {
+		memset(&oc, 0, sizeof(oc));
+		oc.layer = bad_cmds[i].layer;
+		oc.flags = bad_cmds[i].flags;
+		oc.address = FB_ADDR + PIC_OFF;
+		oc.hstride = bad_cmds[i].hstride;
+		oc.vstride = bad_cmds[i].vstride;
+		oc.width = bad_cmds[i].width;
+		oc.height = bad_cmds[i].height;
+		if(orient_check(&oc) != -EINVAL) {
+			printf("%s: not refused\n", bad_cmds[i].what);
+			bad++;
+		}
+	}
+	printf("%d frames and %d bad commands checked, %d off\n", frames,
+	       (int)ARRAY_SIZE(bad_cmds), bad);
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * tools/prod3d.c
+ *
+ * Software stand-in for the 3D core on the MLC_IOCS3DSCANOUT path.  It
+ * sets up 3D scanout on an RGB layer, renders a moving pattern into the
+ * back buffer with the CPU where the 3D core would, and hands it over
+ * with MLC_IOCT3DFLIP:
+ *
+ *	prod3d [-d /dev/fb0] [-l layer] [-w width] [-h height]
+ *	       [-f format] [-n frames] [-c]
+ *
+ * Every flip is checked: the buffer returned must be the other one, and
+ * once the call returns the layer must be showing the buffer just
+ * queued.  -c renders into a malloc()ed buffer and copies it into the
+ * back buffer, the resolve the scanout path is there to remove, so its
+ * cost can be compared.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+
+#include "../lf1000fb.h"
+#include "mlcmodel.h"
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+/* diagonal colour bars scrolling under a bouncing white box */
+static void render(const struct mlc_pixfmt *pf, uint8_t *buf, int width,
+		   int height, int frame)
+{
+	int x, y, bx, by, box = height/4;
+	uint32_t argb;
+	uint8_t *p = buf;
+
+	bx = frame*3 % (2*(width-box));
+	by = frame*2 % (2*(height-box));
+	if(bx >= width-box)
+		bx = 2*(width-box) - bx;
+	if(by >= height-box)
+		by = 2*(height-box) - by;
+
+	for(y = 0; y < height; y++)
+		for(x = 0; x < width; x++, p += pf->bpp) {
+			if(x >= bx && x < bx+box && y >= by && y < by+box)
+				argb = 0xFFFFFFFF;
+			else
+				argb = 0xFF000000 |
+				       ((x+frame) & 0xFF) << 16 |
+				       ((y+2*frame) & 0xFF) << 8 |
+				       ((x+y+frame) & 0xFF);
+			mlc_pixfmt_pack(pf, argb, p);
+		}
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/fb0", *fmt = "RGB565";
+	struct fb_var_screeninfo var;
+	struct scanout3d_cmd sc;
+	struct layer_state_cmd st;
+	const struct mlc_pixfmt *pf;
+	int layer = 1, width = 0, height = 0, frames = 300, copy = 0;
+	int fd, opt, i, back, queued, errors = 0;
+	double t0, t, render_ms = 0, copy_ms = 0;
+	uint8_t *buf[2], *draw = NULL;
+	size_t size, map;
+
+	while((opt = getopt(argc, argv, "d:l:w:h:f:n:c")) != -1) {
+		switch(opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'l':
+			layer = atoi(optarg);
+			break;
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'h':
+			height = atoi(optarg);
+			break;
+		case 'f':
+			fmt = optarg;
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'c':
+			copy = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	pf = mlc_pixfmt_byname(fmt);
+	if(pf == NULL || frames <= 0 || width < 0 || height < 0)
+		goto usage;
+
+	fd = open(dev, O_RDWR);
+	if(fd < 0 || ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0) {
+		perror(dev);
+		return 1;
+	}
+	if(width == 0)
+		width = var.xres;
+	if(height == 0)
+		height = var.yres;
+	if(width < 8 || height < 8)
+		goto usage;
+
+	memset(&sc, 0, sizeof(sc));
+	sc.layer = layer;
+	sc.enable = 1;
+	sc.width = width;
+	sc.height = height;
+	sc.format = pf->code;
+	sc.bpp = pf->bpp;
+	if(ioctl(fd, MLC_IOCS3DSCANOUT, &sc) < 0) {
+		perror("MLC_IOCS3DSCANOUT");
+		return 1;
+	}
+	size = (size_t)width*height*pf->bpp;
+	map = (size + getpagesize()-1) & ~(size_t)(getpagesize()-1);
+	for(i = 0; i < 2; i++) {
+		buf[i] = mmap(NULL, map, PROT_READ|PROT_WRITE, MAP_SHARED,
+			      fd, sc.offset[i]);
+		if(buf[i] == MAP_FAILED) {
+			perror("mmap");
+			errors++;
+			goto out;
+		}
+	}
+	if(copy && (draw = malloc(size)) == NULL) {
+		perror("malloc");
+		errors++;
+		goto out;
+	}
+	printf("layer %d %dx%d %s, buffers at 0x%08x and 0x%08x\n", layer,
+	       width, height, pf->name, sc.address[0], sc.address[1]);
+
+	/* buffer 0 is on screen from the start, 1 is the back buffer */
+	render(pf, buf[0], width, height, 0);
+	back = 1;
+	t0 = now_ms();
+	for(i = 1; i <= frames; i++) {
+		t = now_ms();
+		render(pf, copy ? draw : buf[back], width, height, i);
+		render_ms += now_ms() - t;
+		if(copy) {
+			t = now_ms();
+			memcpy(buf[back], draw, size);
+			copy_ms += now_ms() - t;
+		}
+
+		queued = back;
+		/* an interrupted flip stays queued, retrying waits for it */
+		do
+			back = ioctl(fd, MLC_IOCT3DFLIP);
+		while(back < 0 && errno == EINTR);
+		if(back < 0) {
+			perror("MLC_IOCT3DFLIP");
+			errors++;
+			break;
+		}
+		if(back != !queued) {
+			fprintf(stderr, "frame %d: got buffer %d back, "
+				"queued %d\n", i, back, queued);
+			errors++;
+			back = !queued;
+		}
+		memset(&st, 0, sizeof(st));
+		st.layer = layer;
+		if(ioctl(fd, MLC_IOCGLAYERSTATE, &st) < 0 ||
+		   st.address != sc.address[queued]) {
+			fprintf(stderr, "frame %d: layer shows 0x%08x, "
+				"queued 0x%08x\n", i, st.address,
+				sc.address[queued]);
+			errors++;
+		}
+	}
+	t = now_ms() - t0;
+	frames = i-1 > 0 ? i-1 : 1;
+	printf("%d frames in %.0f ms, %.1f fps, render %.2f ms/frame",
+	       i-1, t, (i-1)*1e3/t, render_ms/frames);
+	if(copy)
+		printf(", copy %.2f ms/frame", copy_ms/frames);
+	printf(", %d errors\n", errors);
+
+out:
+	sc.enable = 0;
+	if(ioctl(fd, MLC_IOCS3DSCANOUT, &sc) < 0) {
+		perror("MLC_IOCS3DSCANOUT off");
+		errors++;
+	}
+	close(fd);
+	free(draw);
+	return errors ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: prod3d [-d /dev/fb0] [-l layer] [-w width] "
+		"[-h height] [-f format] [-n frames] [-c]\n");
+	return 2;
+}
@@ -0,0 +1,172 @@
+/*
+ * tools/rwbench.c
+ *
+ * Time read() and write() on the framebuffer with the driver's burst
+ * copies and with the byte-wise memcpy_fromio()/memcpy_toio() they
+ * replace, switched with debugfs lf1000fb/rw_bytewise:
+ *
+ *	rwbench [-d /dev/fb0] [-D /sys/kernel/debug] [-n passes]
+ *
+ * Each pass writes a whole screen with a new pattern and reads it back,
+ * once from offset 0 and once from offset 1, where the fb and the
+ * driver's bounce buffer are out of word alignment and the burst copy
+ * falls back to bytes.  What is read must be what was written.  The
+ * read()/write() window is reset to linear first.  Without debugfs only
+ * the burst copies are timed.  Exits 1 if any read back differs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fb.h>
+
+#include "../lf1000fb.h"
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static int set_bytewise(const char *knob, int on)
+{
+	int fd = open(knob, O_WRONLY);
+	int ret;
+
+	if(fd < 0)
+		return -1;
+	ret = write(fd, on ? "1" : "0", 1) == 1 ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+/* passes of write and read back at off, MB/s of each, -1 on any error */
+static int run(int fd, size_t size, off_t off, int passes, uint8_t *buf,
+	       uint8_t *back, double *wr, double *rd)
+{
+	double tw = 0, tr = 0, t;
+	size_t len = size - off;
+	int i, bad = 0;
+
+	for(i = 0; i < passes; i++) {
+		memset(buf, 0x11*(i+1), len);
+		buf[0] = i;
+		buf[len-1] = ~i;
+		t = now_s();
+		if(pwrite(fd, buf, len, off) != (ssize_t)len) {
+			perror("write");
+			return -1;
+		}
+		tw += now_s() - t;
+		t = now_s();
+		if(pread(fd, back, len, off) != (ssize_t)len) {
+			perror("read");
+			return -1;
+		}
+		tr += now_s() - t;
+		if(memcmp(buf, back, len)) {
+			fprintf(stderr, "pass %d at offset %ld: read back "
+				"differs\n", i, (long)off);
+			bad = 1;
+		}
+	}
+	*wr = tw > 0 ? (double)len*passes/tw/1e6 : 0;
+	*rd = tr > 0 ? (double)len*passes/tr/1e6 : 0;
+	return bad ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *mode[2] = { "burst", "bytewise" };
+	const char *dev = "/dev/fb0", *debugfs = "/sys/kernel/debug";
+	struct fb_fix_screeninfo fix;
+	struct fb_var_screeninfo var;
+	struct rect_cmd linear;
+	char knob[256];
+	uint8_t *buf, *back;
+	double wr, rd;
+	size_t size;
+	int fd, opt, passes = 20, m, off, modes = 2, errors = 0;
+
+	while((opt = getopt(argc, argv, "d:D:n:")) != -1) {
+		switch(opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'D':
+			debugfs = optarg;
+			break;
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if(passes <= 0)
+		goto usage;
+
+	fd = open(dev, O_RDWR);
+	if(fd < 0 || ioctl(fd, FBIOGET_FSCREENINFO, &fix) < 0 ||
+	   ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0) {
+		perror(dev);
+		return 1;
+	}
+	memset(&linear, 0, sizeof(linear));
+	if(ioctl(fd, MLC_IOCSRWRECT, &linear) < 0) {
+		perror("MLC_IOCSRWRECT");
+		return 1;
+	}
+	size = (size_t)fix.line_length*var.yres;
+	buf = malloc(size);
+	back = malloc(size);
+	if(buf == NULL || back == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	snprintf(knob, sizeof(knob), "%s/lf1000fb/rw_bytewise", debugfs);
+	if(set_bytewise(knob, 0) < 0) {
+		fprintf(stderr, "%s: no byte-wise copies to compare\n", knob);
+		modes = 1;
+	}
+	printf("%zu bytes x %d passes, MB/s\n", size, passes);
+	printf("              write    read\n");
+	for(m = 0; m < modes; m++) {
+		if(m && set_bytewise(knob, 1) < 0) {
+			perror(knob);
+			break;
+		}
+		for(off = 0; off < 2; off++) {
+			if(run(fd, size, off, passes, buf, back, &wr,
+			       &rd) < 0) {
+				errors++;
+				continue;
+			}
+			printf("%-8s +%d  %7.1f %7.1f\n", mode[m], off, wr,
+			       rd);
+		}
+	}
+	if(modes > 1)
+		set_bytewise(knob, 0);
+	free(buf);
+	free(back);
+	close(fd);
+	return errors ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: rwbench [-d /dev/fb0] [-D /sys/kernel/debug] "
+		"[-n passes]\n");
+	return 2;
+}